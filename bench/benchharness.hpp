@@ -0,0 +1,156 @@
+#pragma once
+
+/*
+ * 基准测试用的小框架(不依赖Google Benchmark)
+ * 每个用例是一个函数，循环执行state.iterations次被测操作；框架先把次数翻倍直到一轮超过10ms，
+ * 再按目标时间算出次数，重复REPEATS轮，取中位数和最小值(ns/op)
+ * 结果每个用例一行JSON(方便脚本比较两个版本)，同时在stderr打印可读的表格
+ */
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+namespace bench
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// 防止编译器把被测的结果优化掉
+	template <class T>
+	inline void DoNotOptimize(const T &value)
+	{
+		asm volatile("" : : "r,m"(value) : "memory");
+	}
+
+	class State
+	{
+	public:
+		explicit State(size_t iterations) : iterations(iterations), bytesPerOp(0), pausedNs_(0) {}
+
+		// 暂停计时，用来排除准备数据、等后台线程这类不想计入的时间
+		void Pause() { pauseStart_ = Clock::now(); }
+		void Resume() { pausedNs_ += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - pauseStart_).count(); }
+
+		void SetBytesPerOp(size_t bytes) { bytesPerOp = bytes; }
+
+		int64_t PausedNs() const { return pausedNs_; }
+
+		const size_t iterations;
+		size_t bytesPerOp;
+
+	private:
+		Clock::time_point pauseStart_;
+		int64_t pausedNs_;
+	};
+
+	struct Case
+	{
+		std::string name;
+		std::function<void(State &)> fn;
+	};
+
+	inline std::vector<Case> &Registry()
+	{
+		static std::vector<Case> cases;
+		return cases;
+	}
+
+	inline void Register(const std::string &name, std::function<void(State &)> fn)
+	{
+		Registry().push_back({name, std::move(fn)});
+	}
+
+	// 执行一轮，返回ns/op
+	inline double RunOnce(const Case &c, size_t iterations, size_t *bytesPerOp)
+	{
+		State state(iterations);
+		Clock::time_point start = Clock::now();
+		c.fn(state);
+		int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() - state.PausedNs();
+		*bytesPerOp = state.bytesPerOp;
+		return static_cast<double>(ns) / iterations;
+	}
+
+	/*
+	 * 参数: --filter=子串 只跑名字里包含子串的用例
+	 *       --min-ms=N   每轮的目标时间(默认100ms)
+	 *       --out=文件   JSON结果写到文件(默认stdout)
+	 */
+	inline int RunAll(const char *suite, int argc, char *argv[])
+	{
+		const int REPEATS = 5;
+		std::string filter;
+		double minMs = 100;
+		const char *outPath = nullptr;
+		for (int i = 1; i < argc; i++)
+		{
+			if (strncmp(argv[i], "--filter=", 9) == 0)
+			{
+				filter = argv[i] + 9;
+			}
+			else if (strncmp(argv[i], "--min-ms=", 9) == 0)
+			{
+				minMs = atof(argv[i] + 9);
+			}
+			else if (strncmp(argv[i], "--out=", 6) == 0)
+			{
+				outPath = argv[i] + 6;
+			}
+			else
+			{
+				fprintf(stderr, "usage: %s [--filter=substr] [--min-ms=N] [--out=file.jsonl]\n", argv[0]);
+				return 1;
+			}
+		}
+		FILE *out = outPath ? fopen(outPath, "w") : stdout;
+		if (!out)
+		{
+			perror("open output");
+			return 1;
+		}
+
+		fprintf(stderr, "%-36s %12s %12s %12s %10s\n", "benchmark", "iterations", "ns/op", "min ns/op", "MB/s");
+		for (const Case &c : Registry())
+		{
+			if (!filter.empty() && c.name.find(filter) == std::string::npos)
+			{
+				continue;
+			}
+			/* 标定次数 */
+			size_t bytesPerOp = 0;
+			size_t iterations = 1;
+			double nsPerOp = RunOnce(c, iterations, &bytesPerOp);
+			while (nsPerOp * iterations < 10e6 && iterations < (static_cast<size_t>(1) << 30))
+			{
+				iterations *= 2;
+				nsPerOp = RunOnce(c, iterations, &bytesPerOp);
+			}
+			iterations = std::max<size_t>(1, static_cast<size_t>(minMs * 1e6 / std::max(nsPerOp, 0.1)));
+
+			std::vector<double> samples;
+			for (int r = 0; r < REPEATS; r++)
+			{
+				samples.push_back(RunOnce(c, iterations, &bytesPerOp));
+			}
+			std::sort(samples.begin(), samples.end());
+			double median = samples[REPEATS / 2];
+			double mbPerSec = bytesPerOp > 0 ? bytesPerOp / median * 1e9 / (1 << 20) : 0;
+
+			fprintf(stderr, "%-36s %12zu %12.1f %12.1f %10.1f\n", c.name.c_str(), iterations, median, samples[0], mbPerSec);
+			fprintf(out, "{\"suite\":\"%s\",\"name\":\"%s\",\"iterations\":%zu,\"repeats\":%d,"
+						 "\"ns_per_op\":%.2f,\"min_ns_per_op\":%.2f,\"max_ns_per_op\":%.2f,\"mb_per_sec\":%.2f}\n",
+					suite, c.name.c_str(), iterations, REPEATS, median, samples[0], samples[REPEATS - 1], mbPerSec);
+			fflush(out);
+		}
+		if (out != stdout)
+		{
+			fclose(out);
+		}
+		return 0;
+	}
+}
@@ -0,0 +1,331 @@
+/*
+ * 核心组件的微基准测试：Buffer、HttpRequest::parse、HttpResponse::MakeResponse、HeapTimer、
+ * ThreadPool、BlockDeque、日志前端，以及指标计数和HDR直方图
+ * 用法: ./core_bench [--filter=buffer] [--min-ms=100] [--out=core_bench.jsonl]
+ * 每个用例输出一行JSON，用来比较两个版本之间有没有退化
+ */
+#include <atomic>
+#include <thread>
+#include <random>
+
+#include "benchharness.hpp"
+#include "buffer.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+#include "heaptimer.h"
+#include "threadpool.hpp"
+#include "blockqueue.hpp"
+#include "log.h"
+#include "metrics.h"
+#include "hdrhistogram.hpp"
+
+using namespace std;
+
+#ifndef BENCH_SRC_DIR
+#define BENCH_SRC_DIR "./resources/"
+#endif
+
+namespace
+{
+	// 浏览器发出的一个典型的GET请求
+	const char GET_REQUEST[] = "GET /index.html HTTP/1.1\r\n"
+							   "Host: 127.0.0.1:1316\r\n"
+							   "Connection: keep-alive\r\n"
+							   "Cache-Control: max-age=0\r\n"
+							   "Upgrade-Insecure-Requests: 1\r\n"
+							   "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0 Safari/537.36\r\n"
+							   "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+							   "Accept-Encoding: gzip, deflate, br\r\n"
+							   "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n\r\n";
+
+	const char POST_REQUEST[] = "POST /login HTTP/1.1\r\n"
+								"Host: 127.0.0.1:1316\r\n"
+								"Connection: keep-alive\r\n"
+								"Content-Length: 29\r\n"
+								"Content-Type: application/x-www-form-urlencoded\r\n"
+								"Origin: http://127.0.0.1:1316\r\n"
+								"Referer: http://127.0.0.1:1316/login\r\n\r\n"
+								"username=toy&password=123456";
+
+	const size_t TIMER_CHUNK = 10000; // 定时器用例每次操作的节点数，超过就重建，避免堆无限变大
+	const size_t LOG_BURST = 1000;	  // 日志用例连续写的行数，之后暂停计时让写线程取走
+
+	void BufferCases()
+	{
+		bench::Register("buffer/append_retrieve_64B", [](bench::State &state)
+						{
+			Buffer buff;
+			char data[64] = {0};
+			state.SetBytesPerOp(sizeof(data));
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				buff.Append(data, sizeof(data));
+				bench::DoNotOptimize(buff.Peek());
+				buff.Retrieve(sizeof(data));
+			} });
+
+		bench::Register("buffer/append_iovec_16KB", [](bench::State &state)
+						{
+			Buffer buff;
+			string data(16384, 'x');
+			struct iovec iov[16];
+			state.SetBytesPerOp(data.size());
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				buff.Append(data);
+				bench::DoNotOptimize(buff.ReadIovec(iov, 16));
+				buff.RetrieveAll();
+			} });
+
+		/* 数据跨块时Peek()要合并成连续内存 */
+		bench::Register("buffer/compact_across_blocks", [](bench::State &state)
+						{
+			Buffer buff;
+			string head(BlockPool::BLOCK_SIZE - 100, 'h');
+			string tail(300, 't');
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				buff.Append(head);
+				buff.Retrieve(head.size() - 100);
+				buff.Append(tail);
+				bench::DoNotOptimize(buff.Peek());
+				buff.RetrieveAll();
+			} });
+	}
+
+	void HttpCases()
+	{
+		bench::Register("http/parse_get", [](bench::State &state)
+						{
+			Buffer buff;
+			HttpRequest request;
+			state.SetBytesPerOp(sizeof(GET_REQUEST) - 1);
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				buff.Append(GET_REQUEST, sizeof(GET_REQUEST) - 1);
+				request.Init();
+				bench::DoNotOptimize(request.parse(buff));
+				buff.RetrieveAll();
+			} });
+
+		bench::Register("http/parse_post_form", [](bench::State &state)
+						{
+			Buffer buff;
+			HttpRequest request;
+			state.SetBytesPerOp(sizeof(POST_REQUEST) - 1);
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				buff.Append(POST_REQUEST, sizeof(POST_REQUEST) - 1);
+				request.Init();
+				bench::DoNotOptimize(request.parse(buff));
+				buff.RetrieveAll();
+			} });
+
+		bench::Register("http/make_response_cached", [](bench::State &state)
+						{
+			Buffer buff;
+			HttpResponse response;
+			string path = "/index.html";
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				response.Init(BENCH_SRC_DIR, path, true, 200);
+				response.MakeResponse(buff);
+				bench::DoNotOptimize(response.File());
+				buff.RetrieveAll();
+			} });
+
+		bench::Register("http/make_response_404", [](bench::State &state)
+						{
+			Buffer buff;
+			HttpResponse response;
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				string path = "/no-such-file.html";
+				response.Init(BENCH_SRC_DIR, path, false, 200);
+				response.MakeResponse(buff);
+				bench::DoNotOptimize(response.File());
+				buff.RetrieveAll();
+			} });
+	}
+
+	void TimerCases()
+	{
+		bench::Register("heaptimer/add", [](bench::State &state)
+						{
+			HeapTimer *timer = new HeapTimer();
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				if (i > 0 && i % TIMER_CHUNK == 0)
+				{
+					state.Pause();
+					delete timer;
+					timer = new HeapTimer();
+					state.Resume();
+				}
+				timer->add(static_cast<int>(i % TIMER_CHUNK), 60000 + static_cast<int>(i % 1000), [] {});
+			}
+			state.Pause();
+			delete timer;
+			state.Resume(); });
+
+		bench::Register("heaptimer/adjust", [](bench::State &state)
+						{
+			state.Pause();
+			HeapTimer timer;
+			for (size_t i = 0; i < TIMER_CHUNK; i++)
+			{
+				timer.add(static_cast<int>(i), 60000 + static_cast<int>(i % 1000), [] {});
+			}
+			mt19937 rng(42);
+			vector<int> order(TIMER_CHUNK);
+			for (size_t i = 0; i < TIMER_CHUNK; i++)
+			{
+				order[i] = static_cast<int>(rng() % TIMER_CHUNK);
+			}
+			state.Resume();
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				timer.adjust(order[i % TIMER_CHUNK], 60000);
+			}
+			state.Pause(); });
+
+		/* 每个操作是一个到期节点的处理(回调+出堆) */
+		bench::Register("heaptimer/tick_expire", [](bench::State &state)
+						{
+			HeapTimer timer;
+			int fired = 0;
+			for (size_t done = 0; done < state.iterations;)
+			{
+				size_t n = min(TIMER_CHUNK, state.iterations - done);
+				state.Pause();
+				for (size_t i = 0; i < n; i++)
+				{
+					timer.add(static_cast<int>(i), 0, [&fired]
+							  { fired++; });
+				}
+				state.Resume();
+				timer.tick();
+				done += n;
+			}
+			bench::DoNotOptimize(fired); });
+	}
+
+	void PoolCases()
+	{
+		/* 一个线程(相当于事件循环)提交，4个工作线程执行，每个操作是一个任务从提交到执行完 */
+		bench::Register("threadpool/submit_dispatch", [](bench::State &state)
+						{
+			state.Pause();
+			ThreadPool *pool = new ThreadPool(4);
+			atomic<size_t> done(0);
+			state.Resume();
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				while (!pool->AddTask([&done]
+									  { done.fetch_add(1, memory_order_release); }))
+				{
+					this_thread::yield();
+				}
+			}
+			while (done.load(memory_order_acquire) < state.iterations)
+			{
+				this_thread::yield();
+			}
+			state.Pause();
+			delete pool;
+			state.Resume(); });
+
+		bench::Register("blockdeque/push_pop", [](bench::State &state)
+						{
+			BlockDeque<int> deque(1024);
+			int item = 0;
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				deque.push_back(static_cast<int>(i));
+				deque.pop(item);
+			}
+			bench::DoNotOptimize(item); });
+
+		/* 一个生产者一个消费者，队列容量1024 */
+		bench::Register("blockdeque/producer_consumer", [](bench::State &state)
+						{
+			BlockDeque<int> deque(1024);
+			size_t n = state.iterations;
+			thread consumer([&deque, n]
+							{
+				int item;
+				for (size_t i = 0; i < n; i++)
+				{
+					deque.pop(item);
+				} });
+			for (size_t i = 0; i < n; i++)
+			{
+				deque.push_back(static_cast<int>(i));
+			}
+			consumer.join(); });
+	}
+
+	void LogCases()
+	{
+		/* 在调用方格式化整行后追加到缓冲区 */
+		bench::Register("log/write_formatted", [](bench::State &state)
+						{
+			Log *log = Log::Instance();
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				if (i > 0 && i % LOG_BURST == 0)
+				{
+					state.Pause();
+					this_thread::sleep_for(chrono::milliseconds(2));
+					state.Resume();
+				}
+				log->write(1, "Client[%zu] GET /index.html 200 %d bytes, keep-alive", i, 3270);
+			} });
+
+		/* LOG_INFO：只把参数写进线程的环，由写线程格式化 */
+		bench::Register("log/deferred_record", [](bench::State &state)
+						{
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				if (i > 0 && i % LOG_BURST == 0)
+				{
+					state.Pause();
+					this_thread::sleep_for(chrono::milliseconds(2));
+					state.Resume();
+				}
+				LOG_INFO("Client[%zu] GET /index.html 200 %d bytes, keep-alive", i, 3270);
+			} });
+	}
+
+	void ObservabilityCases()
+	{
+		bench::Register("metrics/counter_add", [](bench::State &state)
+						{
+			static const int counter = Metrics::Instance()->AddCounter("bench_counter_total", "Counter used by core_bench");
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				Metrics::Instance()->Add(counter);
+			} });
+
+		bench::Register("hdr/record", [](bench::State &state)
+						{
+			HdrHistogram *hist = new HdrHistogram();
+			for (size_t i = 0; i < state.iterations; i++)
+			{
+				hist->Record((i * 2654435761u) & 0xfffff);
+			}
+			delete hist; });
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Log::Instance()->init(1, "./bench_log", ".log", 1024);
+	BufferCases();
+	HttpCases();
+	TimerCases();
+	PoolCases();
+	LogCases();
+	ObservabilityCases();
+	return bench::RunAll("core", argc, argv);
+}
@@ -0,0 +1,789 @@
+/*
+ * HTTP压测工具：本机对服务器施加负载，统计吞吐和延迟分位数
+ * 用法: ./loadgen [--scenario=pages] [--rate=20000] [--connections=64] [--threads=2] [--duration=10]
+ *                 [--warmup=2] [--pipeline=1] [--keepalive=1] [--host=127.0.0.1] [--port=1316]
+ *                 [--timeout-ms=5000] [--out=result.jsonl] [--list]
+ * rate>0是开环：请求按固定速率排好计划发送时间，不管服务器回得多慢都照样产生；连接都忙时请求在本地排队。
+ * 延迟从计划发送时间算到收完响应(修正了协调遗漏，服务器卡住的那段时间里本该发出的请求也算上了卡顿)，
+ * 同时给出从实际发出开始算的延迟作对比。rate=0是闭环：每个连接收到响应立刻发下一个，测最大吞吐
+ * 结果在stderr打印表格，同时输出一行JSON(stdout或--out指定的文件)
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "hdrhistogram.hpp"
+#include "responseparser.hpp"
+
+using namespace std;
+
+namespace
+{
+	const size_t READ_CHUNK = 65536;
+	const int64_t DRAIN_NS = 2000000000; // 结束后最多再等2s收完已经发出的请求
+
+	int64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+
+	struct Options
+	{
+		string host = "127.0.0.1";
+		int port = 1316;
+		string scenario = "pages";
+		double rate = 0; // 每秒请求数，0是闭环
+		int connections = 64;
+		int threads = 2;
+		double duration = 10; // 秒，包括预热
+		double warmup = 2;	  // 预热期间的请求不统计
+		int pipeline = 1;	  // 每个连接最多同时有几个请求没收到响应，服务器还不支持流水线，只能是1
+		bool keepAlive = true;
+		int timeoutMs = 5000;
+		const char *out = nullptr;
+	};
+
+	struct Request
+	{
+		int weight;
+		string raw;
+	};
+
+	/* 场景：按resources下的页面组织的请求组合 */
+	struct Scenario
+	{
+		const char *name;
+		const char *desc;
+		vector<pair<int, string>> gets; // (权重, 路径)
+		int rangeWeight;				// 带Range的大文件请求
+		int loginWeight;				// POST /login
+		int registerWeight;				// POST /register
+	};
+
+	const char RANGE_PATH[] = "/fonts/fontawesome-webfont.svg"; // 目录里没有视频，用最大的静态文件代替
+	const size_t RANGE_SIZE = 65536;
+
+	vector<Scenario> Scenarios()
+	{
+		const vector<pair<int, string>> homeAssets = {
+			{1, "/index.html"},
+			{1, "/css/bootstrap.min.css"},
+			{1, "/css/font-awesome.min.css"},
+			{1, "/css/animate.css"},
+			{1, "/css/magnific-popup.css"},
+			{1, "/css/style.css"},
+			{1, "/js/jquery.js"},
+			{1, "/js/bootstrap.min.js"},
+			{1, "/js/jquery.magnific-popup.min.js"},
+			{1, "/js/magnific-popup-options.js"},
+			{1, "/js/smoothscroll.js"},
+			{1, "/js/wow.min.js"},
+			{1, "/js/custom.js"},
+			{1, "/images/favicon.ico"},
+			{1, "/images/profile-image.jpg"},
+		};
+		const vector<pair<int, string>> pages = {
+			{1, "/index.html"},
+			{1, "/login.html"},
+			{1, "/register.html"},
+			{1, "/welcome.html"},
+			{1, "/picture.html"},
+			{1, "/video.html"},
+			{1, "/error.html"},
+		};
+		vector<pair<int, string>> mixed = pages;
+		for (auto &p : mixed)
+		{
+			p.first = 10;
+		}
+		mixed.insert(mixed.end(), homeAssets.begin() + 1, homeAssets.end());
+		mixed.push_back({2, "/images/instagram-image1.jpg"});
+		mixed.push_back({2, "/fonts/fontawesome-webfont.woff2"});
+		mixed.push_back({2, "/missing.html"});
+		return {
+			{"pages", "the seven HTML pages, equal weight (small cached files)", pages, 0, 0, 0},
+			{"home", "everything a browser fetches for /index.html (css, js, images)", homeAssets, 0, 0, 0},
+			{"fonts", "the font-awesome webfonts (64KB-360KB bodies)",
+			 {{4, "/fonts/fontawesome-webfont.woff2"},
+			  {2, "/fonts/fontawesome-webfont.woff"},
+			  {1, "/fonts/fontawesome-webfont.ttf"},
+			  {1, "/fonts/fontawesome-webfont.eot"},
+			  {1, "/fonts/fontawesome-webfont.svg"},
+			  {1, "/fonts/FontAwesome.otf"}},
+			 0, 0, 0},
+			{"video", "/video.html plus Range requests for 64KB chunks of a large file", {{1, "/video.html"}}, 9, 0, 0},
+			{"login", "login/register form posts (database path) plus the form pages",
+			 {{1, "/login.html"}, {1, "/register.html"}, {1, "/welcome.html"}}, 0, 6, 1},
+			{"mixed", "pages, assets, images, fonts, 404s, ranges and a few logins", mixed, 2, 1, 0},
+		};
+	}
+
+	string MakeRequest(const Options &opt, const char *method, const string &path, const string &extra, const string &body)
+	{
+		string req = string(method) + " " + path + " HTTP/1.1\r\n";
+		req += "Host: " + opt.host + ":" + to_string(opt.port) + "\r\n";
+		req += "User-Agent: toy-loadgen\r\n";
+		req += "Accept: */*\r\n";
+		req += opt.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+		req += extra;
+		if (!body.empty())
+		{
+			req += "Content-Type: application/x-www-form-urlencoded\r\n";
+			req += "Content-Length: " + to_string(body.size()) + "\r\n";
+		}
+		req += "\r\n";
+		req += body;
+		return req;
+	}
+
+	// 把场景展开成带权重的请求报文，找不到场景返回false
+	bool BuildRequests(const Options &opt, vector<Request> &requests)
+	{
+		for (const Scenario &s : Scenarios())
+		{
+			if (opt.scenario != s.name)
+			{
+				continue;
+			}
+			for (const auto &get : s.gets)
+			{
+				requests.push_back({get.first, MakeRequest(opt, "GET", get.second, "", "")});
+			}
+			/* 每个Range请求取文件里不同的一段，拆成多个权重1的请求 */
+			for (int i = 0; i < s.rangeWeight; i++)
+			{
+				size_t from = i * RANGE_SIZE;
+				string range = "Range: bytes=" + to_string(from) + "-" + to_string(from + RANGE_SIZE - 1) + "\r\n";
+				requests.push_back({1, MakeRequest(opt, "GET", RANGE_PATH, range, "")});
+			}
+			if (s.loginWeight > 0)
+			{
+				requests.push_back({s.loginWeight, MakeRequest(opt, "POST", "/login", "", "username=loadgen&password=loadgen")});
+			}
+			if (s.registerWeight > 0)
+			{
+				requests.push_back({s.registerWeight, MakeRequest(opt, "POST", "/register", "", "username=loadgen&password=loadgen")});
+			}
+			return true;
+		}
+		return false;
+	}
+
+	struct Pending
+	{
+		int64_t intendedNs; // 计划发送的时间
+		int64_t sentNs;		// 实际写进发送缓冲的时间
+	};
+
+	struct Conn
+	{
+		int fd = -1;
+		bool connecting = false;
+		string out;
+		size_t outPos = 0;
+		ResponseParser parser;
+		deque<Pending> pending;
+	};
+
+	/* 每个线程一个：自己的连接、自己的epoll和直方图 */
+	class Worker
+	{
+	public:
+		Worker(const Options &opt, const vector<Request> &requests, int id, int conns)
+			: opt_(opt), requests_(requests), conns_(conns), rng_(id * 7919 + 1)
+		{
+			depth_ = opt.keepAlive ? max(1, opt.pipeline) : 1;
+			totalWeight_ = 0;
+			for (const Request &r : requests_)
+			{
+				totalWeight_ += r.weight;
+			}
+			/* 每个线程按rate/threads的速率发，各线程错开一点，避免同时发 */
+			intervalNs_ = opt.rate > 0 ? 1e9 * opt.threads / opt.rate : 0;
+			offsetNs_ = opt.rate > 0 ? 1e9 * id / opt.rate : 0;
+		}
+
+		void Run(int64_t startNs, int64_t warmupEndNs, int64_t endNs);
+
+		HdrHistogram corrected; // us，从计划发送时间算
+		HdrHistogram raw;		// us，从实际发出算
+		uint64_t maxCorrected = 0;
+		uint64_t maxRaw = 0;
+		uint64_t completed = 0; // 预热之后完成的请求
+		uint64_t errors = 0;	// 连接断开、超时、响应格式错误时丢掉的请求
+		uint64_t unsent = 0;	// 结束时还在本地排队、没发出去的请求
+		uint64_t connects = 0;
+		uint64_t bytes = 0;
+		uint64_t maxBacklog = 0;
+		map<int, uint64_t> codes;
+
+	private:
+		const Request &Pick_();
+		bool Available_(const Conn &c) const;
+		void Send_(Conn &c, int64_t intendedNs, int64_t now);
+		bool Connect_(Conn &c);
+		void Close_(Conn &c);
+		bool Flush_(Conn &c);
+		void OnEvent_(Conn &c, uint32_t events);
+		bool Feed_(Conn &c, const char *data, size_t len);
+		void Complete_(Conn &c, int status, int64_t now);
+		void Dispatch_(int64_t now, int64_t endNs);
+		void CheckTimeouts_(int64_t now);
+
+		const Options &opt_;
+		const vector<Request> &requests_;
+		vector<Conn> conns_;
+		mt19937 rng_;
+		int depth_;
+		int totalWeight_;
+		double intervalNs_;
+		double offsetNs_;
+		int64_t startNs_ = 0;
+		int64_t warmupEndNs_ = 0;
+		int epollFd_ = -1;
+		uint64_t next_ = 0; // 下一个计划发送的请求序号
+		deque<int64_t> backlog_;
+		size_t cursor_ = 0;
+	};
+
+	const Request &Worker::Pick_()
+	{
+		int r = static_cast<int>(rng_() % totalWeight_);
+		for (const Request &req : requests_)
+		{
+			r -= req.weight;
+			if (r < 0)
+			{
+				return req;
+			}
+		}
+		return requests_.back();
+	}
+
+	// 短连接每个连接只发一个请求，收到响应就关掉，下次用时重连
+	bool Worker::Available_(const Conn &c) const
+	{
+		if (!opt_.keepAlive)
+		{
+			return c.fd < 0;
+		}
+		return static_cast<int>(c.pending.size()) < depth_;
+	}
+
+	bool Worker::Connect_(Conn &c)
+	{
+		c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (c.fd < 0)
+		{
+			return false;
+		}
+		int one = 1;
+		setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(opt_.port);
+		inet_pton(AF_INET, opt_.host.c_str(), &addr.sin_addr);
+		int ret = connect(c.fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+		if (ret < 0 && errno != EINPROGRESS)
+		{
+			close(c.fd);
+			c.fd = -1;
+			return false;
+		}
+		c.connecting = ret < 0;
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.u32 = static_cast<uint32_t>(&c - conns_.data());
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, c.fd, &ev);
+		connects++;
+		return true;
+	}
+
+	// 关闭连接，没收到响应的请求都算出错
+	void Worker::Close_(Conn &c)
+	{
+		if (c.fd >= 0)
+		{
+			close(c.fd);
+			c.fd = -1;
+		}
+		for (const Pending &p : c.pending)
+		{
+			if (p.intendedNs >= warmupEndNs_)
+			{
+				errors++;
+			}
+		}
+		c.pending.clear();
+		c.connecting = false;
+		c.out.clear();
+		c.outPos = 0;
+		c.parser.Reset();
+	}
+
+	// 发送缓冲里的数据尽量写出去，连接出错返回false
+	bool Worker::Flush_(Conn &c)
+	{
+		while (c.outPos < c.out.size())
+		{
+			ssize_t n = send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+			if (n < 0)
+			{
+				return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+			}
+			c.outPos += n;
+		}
+		c.out.clear();
+		c.outPos = 0;
+		return true;
+	}
+
+	void Worker::Send_(Conn &c, int64_t intendedNs, int64_t now)
+	{
+		if (c.fd < 0 && !Connect_(c))
+		{
+			if (intendedNs >= warmupEndNs_)
+			{
+				errors++;
+			}
+			return;
+		}
+		c.out += Pick_().raw;
+		c.pending.push_back({intendedNs, now});
+		if (!c.connecting && !Flush_(c))
+		{
+			Close_(c);
+		}
+	}
+
+	void Worker::Complete_(Conn &c, int status, int64_t now)
+	{
+		Pending p = c.pending.front();
+		c.pending.pop_front();
+		if (p.intendedNs < warmupEndNs_)
+		{
+			return;
+		}
+		uint64_t correctedUs = static_cast<uint64_t>(now - p.intendedNs) / 1000;
+		uint64_t rawUs = static_cast<uint64_t>(now - p.sentNs) / 1000;
+		corrected.Record(correctedUs);
+		raw.Record(rawUs);
+		maxCorrected = max(maxCorrected, correctedUs);
+		maxRaw = max(maxRaw, rawUs);
+		completed++;
+		codes[status]++;
+	}
+
+	// 处理收到的数据，可能包含多个(流水线)响应；格式错误返回false
+	bool Worker::Feed_(Conn &c, const char *data, size_t len)
+	{
+		bytes += len;
+		return c.parser.Feed(data, len, [this, &c](int status, size_t)
+							 {
+			if (c.pending.empty())
+			{
+				return false; // 没发请求却收到了响应
+			}
+			Complete_(c, status, NowNs());
+			return true; });
+	}
+
+	void Worker::OnEvent_(Conn &c, uint32_t events)
+	{
+		if (c.fd < 0)
+		{
+			return;
+		}
+		if (events & EPOLLOUT)
+		{
+			if (c.connecting)
+			{
+				int err = 0;
+				socklen_t len = sizeof(err);
+				getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (err != 0)
+				{
+					Close_(c);
+					return;
+				}
+				c.connecting = false;
+			}
+			if (!Flush_(c))
+			{
+				Close_(c);
+				return;
+			}
+		}
+		if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		{
+			char buf[READ_CHUNK];
+			while (true)
+			{
+				ssize_t n = read(c.fd, buf, sizeof(buf));
+				if (n > 0)
+				{
+					if (!Feed_(c, buf, n))
+					{
+						Close_(c);
+						return;
+					}
+					continue;
+				}
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					break;
+				}
+				if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				Close_(c); // 对方关闭或出错
+				return;
+			}
+			if (!opt_.keepAlive && c.pending.empty())
+			{
+				Close_(c);
+			}
+		}
+	}
+
+	void Worker::Dispatch_(int64_t now, int64_t endNs)
+	{
+		if (opt_.rate > 0)
+		{
+			/* 开环：到了计划时间的请求先进本地队列，延迟从计划时间算起 */
+			while (true)
+			{
+				int64_t due = startNs_ + static_cast<int64_t>(offsetNs_ + next_ * intervalNs_);
+				if (due > now || due >= endNs)
+				{
+					break;
+				}
+				backlog_.push_back(due);
+				next_++;
+			}
+			maxBacklog = max<uint64_t>(maxBacklog, backlog_.size());
+		}
+		else if (now < endNs)
+		{
+			/* 闭环：所有空闲的位置马上填满 */
+			for (Conn &c : conns_)
+			{
+				while (Available_(c))
+				{
+					Send_(c, now, now);
+					if (c.fd < 0)
+					{
+						break; // 连不上
+					}
+				}
+			}
+			return;
+		}
+		/* 轮流找有空位的连接 */
+		for (size_t tried = 0; !backlog_.empty() && tried < conns_.size(); tried++)
+		{
+			Conn &c = conns_[cursor_];
+			if (Available_(c))
+			{
+				Send_(c, backlog_.front(), now);
+				backlog_.pop_front();
+				tried = 0;
+			}
+			cursor_ = (cursor_ + 1) % conns_.size();
+		}
+	}
+
+	void Worker::CheckTimeouts_(int64_t now)
+	{
+		int64_t limit = static_cast<int64_t>(opt_.timeoutMs) * 1000000;
+		for (Conn &c : conns_)
+		{
+			if (!c.pending.empty() && now - c.pending.front().sentNs > limit)
+			{
+				Close_(c);
+			}
+		}
+	}
+
+	void Worker::Run(int64_t startNs, int64_t warmupEndNs, int64_t endNs)
+	{
+		startNs_ = startNs;
+		warmupEndNs_ = warmupEndNs;
+		epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+		/* 下一个请求的计划时间到了由timerfd唤醒，比epoll_wait的毫秒超时准 */
+		int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = UINT32_MAX;
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd, &ev);
+
+		vector<struct epoll_event> events(conns_.size() + 1);
+		int64_t lastCheck = NowNs();
+		while (true)
+		{
+			int64_t now = NowNs();
+			Dispatch_(now, endNs);
+			if (now >= endNs)
+			{
+				bool idle = backlog_.empty();
+				for (const Conn &c : conns_)
+				{
+					idle = idle && c.pending.empty();
+				}
+				if (idle || now >= endNs + DRAIN_NS)
+				{
+					break;
+				}
+			}
+			if (now - lastCheck > 100000000)
+			{
+				CheckTimeouts_(now);
+				lastCheck = now;
+			}
+			int timeoutMs = 100;
+			if (opt_.rate > 0 && now < endNs)
+			{
+				int64_t due = startNs + static_cast<int64_t>(offsetNs_ + next_ * intervalNs_);
+				struct itimerspec its;
+				memset(&its, 0, sizeof(its));
+				its.it_value.tv_sec = due / 1000000000;
+				its.it_value.tv_nsec = due % 1000000000;
+				timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, nullptr);
+				timeoutMs = backlog_.empty() ? 100 : 1; // 本地还有积压时尽快重试
+			}
+			int n = epoll_wait(epollFd_, events.data(), static_cast<int>(events.size()), timeoutMs);
+			for (int i = 0; i < n; i++)
+			{
+				if (events[i].data.u32 == UINT32_MAX)
+				{
+					uint64_t expirations;
+					ssize_t ignored = read(timerFd, &expirations, sizeof(expirations));
+					(void)ignored;
+					continue;
+				}
+				OnEvent_(conns_[events[i].data.u32], events[i].events);
+			}
+		}
+		for (const int64_t due : backlog_)
+		{
+			if (due >= warmupEndNs_)
+			{
+				unsent++;
+			}
+		}
+		for (Conn &c : conns_)
+		{
+			Close_(c);
+		}
+		close(timerFd);
+		close(epollFd_);
+	}
+
+	bool ParseArgs(int argc, char *argv[], Options &opt)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char *arg = argv[i];
+			const char *eq = strchr(arg, '=');
+			string key = eq ? string(arg, eq - arg) : string(arg);
+			const char *val = eq ? eq + 1 : "";
+			if (key == "--list")
+			{
+				for (const Scenario &s : Scenarios())
+				{
+					printf("%-8s %s\n", s.name, s.desc);
+				}
+				exit(0);
+			}
+			else if (key == "--host")
+				opt.host = val;
+			else if (key == "--port")
+				opt.port = atoi(val);
+			else if (key == "--scenario")
+				opt.scenario = val;
+			else if (key == "--rate")
+				opt.rate = atof(val);
+			else if (key == "--connections")
+				opt.connections = atoi(val);
+			else if (key == "--threads")
+				opt.threads = atoi(val);
+			else if (key == "--duration")
+				opt.duration = atof(val);
+			else if (key == "--warmup")
+				opt.warmup = atof(val);
+			else if (key == "--pipeline")
+				opt.pipeline = atoi(val);
+			else if (key == "--keepalive")
+				opt.keepAlive = atoi(val) != 0;
+			else if (key == "--timeout-ms")
+				opt.timeoutMs = atoi(val);
+			else if (key == "--out")
+				opt.out = val;
+			else
+				return false;
+		}
+		if (opt.pipeline != 1)
+		{
+			/* 服务器把一次读到的数据当成一个请求解析，后面流水线的请求会被当成请求体，结果没有意义 */
+			fprintf(stderr, "--pipeline=%d: the server does not support HTTP pipelining, only --pipeline=1 is allowed\n", opt.pipeline);
+			return false;
+		}
+		opt.threads = max(1, min(opt.threads, opt.connections));
+		return opt.connections > 0 && opt.duration > opt.warmup && opt.warmup >= 0 && opt.rate >= 0;
+	}
+
+	void PrintLatency(const char *name, const HdrHistogram::Snapshot &s, uint64_t maxUs)
+	{
+		fprintf(stderr, "  %-22s p50 %9.3f  p90 %9.3f  p99 %9.3f  p99.9 %9.3f  max %9.3f ms\n", name,
+				s.Quantile(0.5) / 1e3, s.Quantile(0.9) / 1e3, s.Quantile(0.99) / 1e3, s.Quantile(0.999) / 1e3, maxUs / 1e3);
+	}
+
+	string LatencyJson(const HdrHistogram::Snapshot &s, uint64_t maxUs)
+	{
+		char buf[256];
+		snprintf(buf, sizeof(buf), "{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f,\"mean\":%.3f}",
+				 s.Quantile(0.5) / 1e3, s.Quantile(0.9) / 1e3, s.Quantile(0.99) / 1e3, s.Quantile(0.999) / 1e3,
+				 maxUs / 1e3, s.total ? s.sum / 1e3 / s.total : 0.0);
+		return buf;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Options opt;
+	if (!ParseArgs(argc, argv, opt))
+	{
+		fprintf(stderr, "usage: %s [--scenario=pages] [--rate=N] [--connections=N] [--threads=N] [--duration=s] [--warmup=s]\n"
+						"       [--pipeline=1] [--keepalive=0|1] [--host=ip] [--port=N] [--timeout-ms=N] [--out=file] [--list]\n",
+				argv[0]);
+		return 1;
+	}
+	vector<Request> requests;
+	if (!BuildRequests(opt, requests))
+	{
+		fprintf(stderr, "unknown scenario '%s', see --list\n", opt.scenario.c_str());
+		return 1;
+	}
+
+	/* 连接平均分给各线程 */
+	vector<unique_ptr<Worker>> workers;
+	for (int i = 0; i < opt.threads; i++)
+	{
+		int conns = opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0);
+		workers.emplace_back(new Worker(opt, requests, i, conns));
+	}
+	int64_t startNs = NowNs() + 10000000;
+	int64_t warmupEndNs = startNs + static_cast<int64_t>(opt.warmup * 1e9);
+	int64_t endNs = startNs + static_cast<int64_t>(opt.duration * 1e9);
+	vector<thread> threads;
+	for (auto &w : workers)
+	{
+		Worker *worker = w.get();
+		threads.emplace_back([worker, startNs, warmupEndNs, endNs]
+							 {
+			while (NowNs() < startNs)
+			{
+				this_thread::sleep_for(chrono::microseconds(100));
+			}
+			worker->Run(startNs, warmupEndNs, endNs); });
+	}
+	for (thread &t : threads)
+	{
+		t.join();
+	}
+
+	/* 合并各线程的结果 */
+	unique_ptr<HdrHistogram::Snapshot> corrected(new HdrHistogram::Snapshot());
+	unique_ptr<HdrHistogram::Snapshot> raw(new HdrHistogram::Snapshot());
+	uint64_t maxCorrected = 0, maxRaw = 0, completed = 0, errors = 0, unsent = 0, connects = 0, bytes = 0, maxBacklog = 0;
+	map<int, uint64_t> codes;
+	for (auto &w : workers)
+	{
+		corrected->Add(w->corrected);
+		raw->Add(w->raw);
+		maxCorrected = max(maxCorrected, w->maxCorrected);
+		maxRaw = max(maxRaw, w->maxRaw);
+		completed += w->completed;
+		errors += w->errors;
+		unsent += w->unsent;
+		connects += w->connects;
+		bytes += w->bytes;
+		maxBacklog += w->maxBacklog;
+		for (auto &code : w->codes)
+		{
+			codes[code.first] += code.second;
+		}
+	}
+	double seconds = opt.duration - opt.warmup;
+	double rps = completed / seconds;
+	double mbps = bytes / seconds / (1 << 20);
+
+	fprintf(stderr, "scenario %s, %s, %d connections, %d threads, pipeline %d, %s\n", opt.scenario.c_str(),
+			opt.rate > 0 ? (to_string(static_cast<long long>(opt.rate)) + " req/s open loop").c_str() : "closed loop",
+			opt.connections, opt.threads, opt.pipeline, opt.keepAlive ? "keep-alive" : "short connections");
+	fprintf(stderr, "  completed %llu (%.0f req/s, %.1f MB/s), errors %llu, unsent %llu, connects %llu\n",
+			static_cast<unsigned long long>(completed), rps, mbps, static_cast<unsigned long long>(errors),
+			static_cast<unsigned long long>(unsent), static_cast<unsigned long long>(connects));
+	string codeText, codeJson;
+	for (auto &code : codes)
+	{
+		codeText += " " + to_string(code.first) + ":" + to_string(code.second);
+		codeJson += (codeJson.empty() ? "\"" : ",\"") + to_string(code.first) + "\":" + to_string(code.second);
+	}
+	fprintf(stderr, "  status%s\n", codeText.c_str());
+	if (opt.rate > 0)
+	{
+		PrintLatency("latency (corrected)", *corrected, maxCorrected);
+	}
+	PrintLatency(opt.rate > 0 ? "latency (from send)" : "latency", *raw, maxRaw);
+	if (opt.rate > 0 && rps < opt.rate * 0.95)
+	{
+		fprintf(stderr, "  server did not keep up with %.0f req/s (local backlog peaked at %llu requests)\n", opt.rate,
+				static_cast<unsigned long long>(maxBacklog));
+	}
+
+	FILE *out = opt.out ? fopen(opt.out, "a") : stdout;
+	if (!out)
+	{
+		perror("open output");
+		return 1;
+	}
+	fprintf(out, "{\"scenario\":\"%s\",\"rate\":%.0f,\"connections\":%d,\"threads\":%d,\"pipeline\":%d,\"keepalive\":%s,"
+				 "\"seconds\":%.1f,\"completed\":%llu,\"errors\":%llu,\"unsent\":%llu,\"connects\":%llu,\"rps\":%.1f,\"mb_per_sec\":%.2f,"
+				 "\"status\":{%s},\"latency_ms\":%s,\"latency_from_send_ms\":%s}\n",
+			opt.scenario.c_str(), opt.rate, opt.connections, opt.threads, opt.pipeline, opt.keepAlive ? "true" : "false",
+			seconds, static_cast<unsigned long long>(completed), static_cast<unsigned long long>(errors),
+			static_cast<unsigned long long>(unsent), static_cast<unsigned long long>(connects), rps, mbps, codeJson.c_str(),
+			LatencyJson(opt.rate > 0 ? *corrected : *raw, opt.rate > 0 ? maxCorrected : maxRaw).c_str(),
+			LatencyJson(*raw, maxRaw).c_str());
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return errors + unsent > 0 && completed == 0 ? 1 : 0;
+}
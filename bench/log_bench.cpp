@@ -0,0 +1,56 @@
+/*
+ * 日志前端的开销测试：多个线程同时写INFO日志，统计调用方每行的平均耗时
+ * 用法: ./log_bench [lines] [threads] [bufferKB] [burst]
+ * 每个线程每次连续写burst行(只统计这段时间)，然后停一会儿让写线程取走，模拟服务器的突发日志
+ * bufferKB为0时是同步写文件，日志写在./bench_log下
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+
+using namespace std;
+
+typedef chrono::steady_clock BenchClock;
+
+static const int PAUSE_MS = 2; // 两次突发之间的间隔
+
+int main(int argc, char *argv[])
+{
+	size_t lines = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	size_t threads = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4;
+	int bufferKB = argc > 3 ? atoi(argv[3]) : 1024;
+	size_t burst = argc > 4 ? strtoul(argv[4], nullptr, 10) : 1000;
+
+	Log::Instance()->init(1, "./bench_log", ".log", bufferKB);
+	size_t perThread = lines / threads;
+	atomic<int64_t> busyNs(0);
+	vector<thread> workers;
+	for (size_t i = 0; i < threads; i++)
+	{
+		workers.emplace_back([i, perThread, burst, &busyNs]
+							 {
+			for (size_t j = 0; j < perThread;)
+			{
+				auto start = BenchClock::now();
+				for (size_t k = 0; k < burst && j < perThread; k++, j++)
+				{
+					LOG_INFO("Client[%zu] GET /index.html 200 %zu bytes, keep-alive", i, j);
+				}
+				busyNs += chrono::duration_cast<chrono::nanoseconds>(BenchClock::now() - start).count();
+				this_thread::sleep_for(chrono::milliseconds(PAUSE_MS));
+			} });
+	}
+	for (thread &worker : workers)
+	{
+		worker.join();
+	}
+	size_t total = perThread * threads;
+	printf("%zu lines, %zu threads, buffer %dKB, burst %zu: %.1f ns/line\n",
+		   total, threads, bufferKB, burst, static_cast<double>(busyNs) / total);
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * ThreadPool(工作窃取) 和 MutexThreadPool(单锁队列) 的对比测试
+ * 用法: ./pool_bench [tasks] [threads] [capacity]
+ * external: 一个线程(相当于事件循环)提交所有任务
+ * nested:   任务在工作线程里再提交子任务，走本地队列
+ * bounded:  有界队列模式的ThreadPool，队列满时提交方让出CPU后重试，同时统计被拒绝的次数
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "threadpool.hpp"
+#include "mutexthreadpool.hpp"
+
+using namespace std;
+
+typedef chrono::steady_clock BenchClock;
+
+static void WaitFor(const atomic<size_t> &done, size_t n)
+{
+	while (done.load(memory_order_acquire) < n)
+	{
+		this_thread::yield();
+	}
+}
+
+template <class Pool>
+static double External(size_t tasks, size_t threads)
+{
+	Pool pool(threads);
+	atomic<size_t> done(0);
+	auto start = BenchClock::now();
+	for (size_t i = 0; i < tasks; i++)
+	{
+		pool.AddTask([&done]
+					 { done.fetch_add(1, memory_order_release); });
+	}
+	WaitFor(done, tasks);
+	return chrono::duration<double, nano>(BenchClock::now() - start).count() / tasks;
+}
+
+template <class Pool>
+static double Nested(size_t tasks, size_t threads)
+{
+	Pool pool(threads);
+	atomic<size_t> done(0);
+	const size_t fanout = 16;
+	size_t roots = tasks / fanout > 0 ? tasks / fanout : 1;
+	auto start = BenchClock::now();
+	for (size_t i = 0; i < roots; i++)
+	{
+		pool.AddTask([&pool, &done]
+					 {
+			for (size_t j = 0; j < fanout; j++)
+			{
+				pool.AddTask([&done]
+							 { done.fetch_add(1, memory_order_release); });
+			} });
+	}
+	WaitFor(done, roots * fanout);
+	return chrono::duration<double, nano>(BenchClock::now() - start).count() / (roots * fanout);
+}
+
+// 有界队列满了就重试，返回被拒绝的次数
+template <class F>
+static size_t SubmitRetry(ThreadPool &pool, F task)
+{
+	size_t rejected = 0;
+	while (!pool.AddTask(task))
+	{
+		rejected++;
+		this_thread::yield();
+	}
+	return rejected;
+}
+
+static double BoundedExternal(size_t tasks, size_t threads, size_t capacity, size_t &rejected)
+{
+	ThreadPool pool(threads, capacity);
+	atomic<size_t> done(0);
+	auto start = BenchClock::now();
+	for (size_t i = 0; i < tasks; i++)
+	{
+		SubmitRetry(pool, [&done]
+					{ done.fetch_add(1, memory_order_release); });
+	}
+	WaitFor(done, tasks);
+	rejected = pool.RejectedCount();
+	return chrono::duration<double, nano>(BenchClock::now() - start).count() / tasks;
+}
+
+static double BoundedNested(size_t tasks, size_t threads, size_t capacity)
+{
+	ThreadPool pool(threads, capacity);
+	atomic<size_t> done(0);
+	const size_t fanout = 16;
+	size_t roots = tasks / fanout > 0 ? tasks / fanout : 1;
+	auto start = BenchClock::now();
+	for (size_t i = 0; i < roots; i++)
+	{
+		SubmitRetry(pool, [&pool, &done]
+					{
+			for (size_t j = 0; j < fanout; j++)
+			{
+				SubmitRetry(pool, [&done]
+							{ done.fetch_add(1, memory_order_release); });
+			} });
+	}
+	WaitFor(done, roots * fanout);
+	return chrono::duration<double, nano>(BenchClock::now() - start).count() / (roots * fanout);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t tasks = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	size_t threads = argc > 2 ? strtoul(argv[2], nullptr, 10) : 6;
+	size_t capacity = argc > 3 ? strtoul(argv[3], nullptr, 10) : 4096;
+
+	printf("tasks=%zu threads=%zu\n", tasks, threads);
+	printf("%-18s %14s %14s\n", "impl", "external(ns)", "nested(ns)");
+	printf("%-18s %14.1f %14.1f\n", "MutexThreadPool", External<MutexThreadPool>(tasks, threads), Nested<MutexThreadPool>(tasks, threads));
+	printf("%-18s %14.1f %14.1f\n", "ThreadPool", External<ThreadPool>(tasks, threads), Nested<ThreadPool>(tasks, threads));
+	size_t rejected = 0;
+	double external = BoundedExternal(tasks, threads, capacity, rejected);
+	printf("%-18s %14.1f %14.1f   capacity=%zu rejected=%zu\n", "ThreadPool(bound)",
+		   external, BoundedNested(tasks, threads, capacity), capacity, rejected);
+	return 0;
+}
@@ -0,0 +1,618 @@
+/*
+ * 重放服务器抓下来的流量(WebServer的capturePath参数)，检查新版本的行为和性能
+ * 用法: ./replay capture.bin [--speed=1] [--host=127.0.0.1] [--port=1316] [--max-diffs=20] [--timeout-ms=5000] [--out=result.jsonl]
+ * 每个抓到的连接用一个新连接重放，按原来的时间打开、发送数据、关闭，所以并发的连接数和原来一样；
+ * speed=2是两倍速；speed=0不按时间，每个连接收到上一个响应就发下一个请求(和抓包时一样，前面有几个响应才发)。
+ * 收到的每个响应和抓包时的状态码、响应大小按顺序比较，
+ * 打印前max-diffs个不一致的响应，统计响应延迟和发送比计划晚了多少
+ * 有不一致(或者缺少响应)时退出码是2
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "capture.h"
+#include "hdrhistogram.hpp"
+#include "responseparser.hpp"
+
+using namespace std;
+
+namespace
+{
+	const size_t READ_CHUNK = 65536;
+	const int64_t DRAIN_NS = 2000000000; // 最后一个事件之后最多再等2s收响应
+
+	int64_t NowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+
+	struct Options
+	{
+		const char *file = nullptr;
+		string host = "127.0.0.1";
+		int port = 1316;
+		double speed = 1;
+		int maxDiffs = 20;
+		int timeoutMs = 5000;
+		const char *out = nullptr;
+	};
+
+	struct Expected
+	{
+		int status;
+		uint32_t bytes;
+	};
+
+	struct Conn
+	{
+		uint32_t id = 0;
+		uint32_t index = 0; // 在order_里的下标，作为epoll的数据
+		int fd = -1;
+		bool connecting = false;
+		bool closing = false; // 抓包里这个连接已经关了，收完响应就关
+		bool done = false;	  // 已经关闭，不再重放
+		bool captured = false; // 抓包里有这个连接的CLOSE
+		string out;
+		size_t outPos = 0;
+		ResponseParser parser;
+		vector<Expected> expected;
+		size_t received = 0;
+		int64_t lastSendNs = 0;
+		int64_t lastDoneNs = 0;
+		vector<size_t> events; // 这个连接的事件在events_里的下标(speed=0时按连接各自推进)
+		size_t next = 0;
+	};
+
+	/* 时间线上的一个事件：打开、发数据、关闭 */
+	struct Event
+	{
+		uint64_t timeUs;
+		Conn *conn;
+		uint16_t type;
+		const char *data;
+		uint32_t len;
+		uint32_t after; // 抓包时这个事件之前连接上已经发完了几个响应
+	};
+
+	class Replayer
+	{
+	public:
+		explicit Replayer(const Options &opt) : opt_(opt) {}
+
+		bool Load(const char *path);
+		void Run();
+		int Report();
+
+	private:
+		bool Connect_(Conn &c);
+		void Close_(Conn &c);
+		bool Flush_(Conn &c);
+		void Fire_(const Event &e, int64_t now, int64_t due);
+		void OnEvent_(Conn &c, uint32_t events);
+		bool OnResponse_(Conn &c, int status, size_t bytes);
+		bool AllDone_() const;
+		bool FireReady_(int64_t now); // speed=0：每个连接等到响应数够了就执行下一个事件，返回是否还有事件
+
+		const Options &opt_;
+		vector<char> file_;
+		unordered_map<uint32_t, unique_ptr<Conn>> conns_;
+		vector<Conn *> order_; // 按打开的顺序，epoll用下标找连接
+		vector<Event> events_;
+		int epollFd_ = -1;
+		int64_t startUs_ = 0;
+
+		HdrHistogram latency_; // us，发出请求到收完响应
+		HdrHistogram lag_;	   // us，实际发送比计划晚了多少
+		uint64_t maxLatencyUs_ = 0;
+		uint64_t maxLagUs_ = 0;
+		uint64_t responses_ = 0;
+		uint64_t statusDiffs_ = 0;
+		uint64_t sizeDiffs_ = 0;
+		uint64_t extra_ = 0;
+		uint64_t connectErrors_ = 0;
+		uint64_t bytesSent_ = 0;
+		int printed_ = 0;
+	};
+
+	bool Replayer::Load(const char *path)
+	{
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			perror(path);
+			return false;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		file_.resize(st.st_size);
+		size_t got = 0;
+		while (got < file_.size())
+		{
+			ssize_t n = read(fd, file_.data() + got, file_.size() - got);
+			if (n <= 0)
+			{
+				break;
+			}
+			got += n;
+		}
+		close(fd);
+		CaptureFileHeader header;
+		if (got != file_.size() || got < sizeof(header) || memcmp(file_.data(), "TOYCAP01", 8) != 0)
+		{
+			fprintf(stderr, "%s is not a capture file\n", path);
+			return false;
+		}
+		memcpy(&header, file_.data(), sizeof(header));
+		startUs_ = header.startUs;
+
+		/* 文件末尾可能有写了一半的记录(服务器被杀掉)，忽略 */
+		size_t pos = sizeof(header);
+		while (pos + sizeof(CaptureRecord) <= file_.size())
+		{
+			CaptureRecord r;
+			memcpy(&r, file_.data() + pos, sizeof(r));
+			pos += sizeof(r);
+			const char *data = file_.data() + pos;
+			if (r.type == CaptureRecord::DATA)
+			{
+				if (pos + r.len > file_.size())
+				{
+					break;
+				}
+				pos += r.len;
+			}
+			unique_ptr<Conn> &slot = conns_[r.conn];
+			if (r.type == CaptureRecord::OPEN)
+			{
+				slot.reset(new Conn());
+				slot->id = r.conn;
+				slot->index = static_cast<uint32_t>(order_.size());
+				order_.push_back(slot.get());
+			}
+			if (!slot)
+			{
+				continue; // 没有OPEN的连接(比如抓包中途停止后的残留)
+			}
+			if (r.type == CaptureRecord::RESPONSE)
+			{
+				slot->expected.push_back({r.code, r.len});
+				continue;
+			}
+			if (r.type == CaptureRecord::CLOSE)
+			{
+				slot->captured = true;
+			}
+			slot->events.push_back(events_.size());
+			events_.push_back({r.timeUs, slot.get(), r.type, data, r.type == CaptureRecord::DATA ? r.len : 0,
+							   static_cast<uint32_t>(slot->expected.size())});
+		}
+		/* 抓包里没关闭的连接在最后关掉 */
+		uint64_t endUs = events_.empty() ? 0 : events_.back().timeUs;
+		for (Conn *c : order_)
+		{
+			if (!c->captured)
+			{
+				c->events.push_back(events_.size());
+				events_.push_back({endUs, c, CaptureRecord::CLOSE, nullptr, 0, static_cast<uint32_t>(c->expected.size())});
+			}
+		}
+		return true;
+	}
+
+	bool Replayer::Connect_(Conn &c)
+	{
+		c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (c.fd < 0)
+		{
+			return false;
+		}
+		int one = 1;
+		setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(opt_.port);
+		inet_pton(AF_INET, opt_.host.c_str(), &addr.sin_addr);
+		int ret = connect(c.fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+		if (ret < 0 && errno != EINPROGRESS)
+		{
+			close(c.fd);
+			c.fd = -1;
+			return false;
+		}
+		c.connecting = ret < 0;
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.u32 = c.index;
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, c.fd, &ev);
+		return true;
+	}
+
+	void Replayer::Close_(Conn &c)
+	{
+		if (c.fd >= 0)
+		{
+			close(c.fd);
+			c.fd = -1;
+		}
+		c.done = true;
+		c.out.clear();
+		c.outPos = 0;
+	}
+
+	bool Replayer::Flush_(Conn &c)
+	{
+		while (c.outPos < c.out.size())
+		{
+			ssize_t n = send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+			if (n < 0)
+			{
+				return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+			}
+			c.outPos += n;
+			bytesSent_ += n;
+		}
+		c.out.clear();
+		c.outPos = 0;
+		return true;
+	}
+
+	void Replayer::Fire_(const Event &e, int64_t now, int64_t due)
+	{
+		Conn &c = *e.conn;
+		if (c.done)
+		{
+			return; // 服务器已经关了这个连接(和抓包时不一样)，剩下的数据不再发
+		}
+		uint64_t lagUs = now > due ? static_cast<uint64_t>(now - due) / 1000 : 0;
+		lag_.Record(lagUs);
+		maxLagUs_ = max(maxLagUs_, lagUs);
+		switch (e.type)
+		{
+		case CaptureRecord::OPEN:
+			if (!Connect_(c))
+			{
+				connectErrors_++;
+				c.done = true;
+			}
+			break;
+		case CaptureRecord::DATA:
+			c.out.append(e.data, e.len);
+			c.lastSendNs = now;
+			if (!c.connecting && !Flush_(c))
+			{
+				Close_(c);
+			}
+			break;
+		case CaptureRecord::CLOSE:
+			c.closing = true;
+			if (c.received >= c.expected.size())
+			{
+				Close_(c);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	// 和抓包时的第received个响应比较
+	bool Replayer::OnResponse_(Conn &c, int status, size_t bytes)
+	{
+		int64_t now = NowNs();
+		uint64_t us = static_cast<uint64_t>(now - max(c.lastSendNs, c.lastDoneNs)) / 1000;
+		latency_.Record(us);
+		maxLatencyUs_ = max(maxLatencyUs_, us);
+		c.lastDoneNs = now;
+		responses_++;
+		if (c.received >= c.expected.size())
+		{
+			extra_++;
+			if (printed_++ < opt_.maxDiffs)
+			{
+				printf("conn %u response %zu: unexpected response, status %d, %zu bytes\n", c.id, c.received, status, bytes);
+			}
+		}
+		else
+		{
+			const Expected &want = c.expected[c.received];
+			bool statusDiff = want.status != status;
+			bool sizeDiff = want.bytes != bytes;
+			statusDiffs_ += statusDiff;
+			sizeDiffs_ += sizeDiff;
+			if ((statusDiff || sizeDiff) && printed_++ < opt_.maxDiffs)
+			{
+				printf("conn %u response %zu: status %d -> %d, bytes %u -> %zu\n", c.id, c.received, want.status, status, want.bytes, bytes);
+			}
+		}
+		c.received++;
+		return true;
+	}
+
+	void Replayer::OnEvent_(Conn &c, uint32_t events)
+	{
+		if (c.fd < 0)
+		{
+			return;
+		}
+		if (events & EPOLLOUT)
+		{
+			if (c.connecting)
+			{
+				int err = 0;
+				socklen_t len = sizeof(err);
+				getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (err != 0)
+				{
+					connectErrors_++;
+					Close_(c);
+					return;
+				}
+				c.connecting = false;
+			}
+			if (!Flush_(c))
+			{
+				Close_(c);
+				return;
+			}
+		}
+		if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		{
+			char buf[READ_CHUNK];
+			while (true)
+			{
+				ssize_t n = read(c.fd, buf, sizeof(buf));
+				if (n > 0)
+				{
+					if (!c.parser.Feed(buf, n, [this, &c](int status, size_t bytes)
+									   { return OnResponse_(c, status, bytes); }))
+					{
+						Close_(c);
+						return;
+					}
+					continue;
+				}
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					break;
+				}
+				if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				Close_(c); // 服务器关闭了连接
+				return;
+			}
+			if (c.closing && c.received >= c.expected.size())
+			{
+				Close_(c);
+			}
+		}
+	}
+
+	bool Replayer::AllDone_() const
+	{
+		for (const Conn *c : order_)
+		{
+			if (!c->done)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Replayer::FireReady_(int64_t now)
+	{
+		bool more = false;
+		for (Conn *c : order_)
+		{
+			while (c->next < c->events.size())
+			{
+				const Event &e = events_[c->events[c->next]];
+				if (!c->done && e.after > c->received)
+				{
+					more = true;
+					break;
+				}
+				Fire_(e, now, now);
+				c->next++;
+			}
+		}
+		return more;
+	}
+
+	void Replayer::Run()
+	{
+		epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+		int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = UINT32_MAX;
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd, &ev);
+
+		vector<struct epoll_event> events(order_.size() + 1);
+		int64_t start = NowNs();
+		int64_t lastEventNs = 0;
+		size_t next = 0;
+		while (true)
+		{
+			int64_t now = NowNs();
+			if (opt_.speed == 0)
+			{
+				if (FireReady_(now))
+				{
+					lastEventNs = now;
+				}
+				else
+				{
+					next = events_.size();
+				}
+			}
+			/* 到时间的事件都执行掉 */
+			while (opt_.speed > 0 && next < events_.size())
+			{
+				int64_t due = start + static_cast<int64_t>(events_[next].timeUs * 1000 / opt_.speed);
+				if (due > now)
+				{
+					struct itimerspec its;
+					memset(&its, 0, sizeof(its));
+					its.it_value.tv_sec = due / 1000000000;
+					its.it_value.tv_nsec = due % 1000000000;
+					timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, nullptr);
+					break;
+				}
+				Fire_(events_[next], now, due);
+				next++;
+				lastEventNs = now;
+			}
+			if (next == events_.size() && (AllDone_() || now - lastEventNs > DRAIN_NS))
+			{
+				break;
+			}
+			int n = epoll_wait(epollFd_, events.data(), static_cast<int>(events.size()), 100);
+			for (int i = 0; i < n; i++)
+			{
+				if (events[i].data.u32 == UINT32_MAX)
+				{
+					uint64_t expirations;
+					ssize_t ignored = read(timerFd, &expirations, sizeof(expirations));
+					(void)ignored;
+					continue;
+				}
+				OnEvent_(*order_[events[i].data.u32], events[i].events);
+			}
+			/* 迟迟收不到响应的连接关掉，算作缺少响应 */
+			now = NowNs();
+			for (Conn *c : order_)
+			{
+				if (!c->done && c->fd >= 0 && c->received < c->expected.size() &&
+					c->lastSendNs > c->lastDoneNs && now - c->lastSendNs > static_cast<int64_t>(opt_.timeoutMs) * 1000000)
+				{
+					Close_(*c);
+				}
+			}
+		}
+		for (Conn *c : order_)
+		{
+			Close_(*c);
+		}
+		close(timerFd);
+		close(epollFd_);
+	}
+
+	int Replayer::Report()
+	{
+		uint64_t expected = 0, missing = 0;
+		for (const Conn *c : order_)
+		{
+			expected += c->expected.size();
+			if (c->received < c->expected.size())
+			{
+				missing += c->expected.size() - c->received;
+			}
+		}
+		unique_ptr<HdrHistogram::Snapshot> latency(new HdrHistogram::Snapshot());
+		unique_ptr<HdrHistogram::Snapshot> lag(new HdrHistogram::Snapshot());
+		latency->Add(latency_);
+		lag->Add(lag_);
+
+		fprintf(stderr, "replayed %zu connections at speed %g, %llu bytes sent\n", order_.size(), opt_.speed,
+				static_cast<unsigned long long>(bytesSent_));
+		fprintf(stderr, "  responses %llu of %llu expected: status diffs %llu, size diffs %llu, missing %llu, unexpected %llu, connect errors %llu\n",
+				static_cast<unsigned long long>(responses_), static_cast<unsigned long long>(expected),
+				static_cast<unsigned long long>(statusDiffs_), static_cast<unsigned long long>(sizeDiffs_),
+				static_cast<unsigned long long>(missing), static_cast<unsigned long long>(extra_),
+				static_cast<unsigned long long>(connectErrors_));
+		fprintf(stderr, "  latency   p50 %9.3f  p99 %9.3f  p99.9 %9.3f  max %9.3f ms\n", latency->Quantile(0.5) / 1e3,
+				latency->Quantile(0.99) / 1e3, latency->Quantile(0.999) / 1e3, maxLatencyUs_ / 1e3);
+		fprintf(stderr, "  send lag  p50 %9.3f  p99 %9.3f  max %9.3f ms\n", lag->Quantile(0.5) / 1e3, lag->Quantile(0.99) / 1e3,
+				maxLagUs_ / 1e3);
+
+		FILE *out = opt_.out ? fopen(opt_.out, "a") : stdout;
+		if (!out)
+		{
+			perror("open output");
+			return 1;
+		}
+		fprintf(out, "{\"capture\":\"%s\",\"capture_start_us\":%lld,\"speed\":%g,\"connections\":%zu,\"expected\":%llu,\"responses\":%llu,"
+					 "\"status_diffs\":%llu,\"size_diffs\":%llu,\"missing\":%llu,\"unexpected\":%llu,\"connect_errors\":%llu,"
+					 "\"latency_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},\"lag_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f}}\n",
+				opt_.file, static_cast<long long>(startUs_), opt_.speed, order_.size(), static_cast<unsigned long long>(expected),
+				static_cast<unsigned long long>(responses_), static_cast<unsigned long long>(statusDiffs_),
+				static_cast<unsigned long long>(sizeDiffs_), static_cast<unsigned long long>(missing),
+				static_cast<unsigned long long>(extra_), static_cast<unsigned long long>(connectErrors_),
+				latency->Quantile(0.5) / 1e3, latency->Quantile(0.99) / 1e3, latency->Quantile(0.999) / 1e3, maxLatencyUs_ / 1e3,
+				lag->Quantile(0.5) / 1e3, lag->Quantile(0.99) / 1e3, maxLagUs_ / 1e3);
+		if (out != stdout)
+		{
+			fclose(out);
+		}
+		return statusDiffs_ + sizeDiffs_ + missing + extra_ + connectErrors_ > 0 ? 2 : 0;
+	}
+
+	bool ParseArgs(int argc, char *argv[], Options &opt)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char *arg = argv[i];
+			const char *eq = strchr(arg, '=');
+			string key = eq ? string(arg, eq - arg) : string(arg);
+			const char *val = eq ? eq + 1 : "";
+			if (strncmp(arg, "--", 2) != 0 && !opt.file)
+				opt.file = arg;
+			else if (key == "--host")
+				opt.host = val;
+			else if (key == "--port")
+				opt.port = atoi(val);
+			else if (key == "--speed")
+				opt.speed = atof(val);
+			else if (key == "--max-diffs")
+				opt.maxDiffs = atoi(val);
+			else if (key == "--timeout-ms")
+				opt.timeoutMs = atoi(val);
+			else if (key == "--out")
+				opt.out = val;
+			else
+				return false;
+		}
+		return opt.file && opt.speed >= 0;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Options opt;
+	if (!ParseArgs(argc, argv, opt))
+	{
+		fprintf(stderr, "usage: %s capture.bin [--speed=1] [--host=ip] [--port=N] [--max-diffs=N] [--timeout-ms=N] [--out=file]\n", argv[0]);
+		return 1;
+	}
+	unique_ptr<Replayer> replayer(new Replayer(opt));
+	if (!replayer->Load(opt.file))
+	{
+		return 1;
+	}
+	replayer->Run();
+	return replayer->Report();
+}
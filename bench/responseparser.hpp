@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * 压测和重放工具共用的HTTP响应解析：按Content-Length把收到的字节流切成一个个(可能是流水线的)响应，
+ * 每收完一个响应调用一次onResponse(状态码, 响应的总字节数)，回调返回false表示不该收到这个响应
+ */
+#include <cstdlib>
+#include <string>
+#include <strings.h>
+
+class ResponseParser
+{
+public:
+	static const size_t MAX_HEADER = 65536; // 响应头超过这个长度算出错
+
+	// 数据格式错误或者回调返回false时返回false
+	template <class F>
+	bool Feed(const char *data, size_t len, F &&onResponse)
+	{
+		while (len > 0)
+		{
+			if (bodyLeft_ > 0)
+			{
+				size_t n = bodyLeft_ < len ? bodyLeft_ : len;
+				bodyLeft_ -= n;
+				data += n;
+				len -= n;
+				if (bodyLeft_ == 0 && !onResponse(status_, bytes_))
+				{
+					return false;
+				}
+				continue;
+			}
+			size_t old = head_.size();
+			head_.append(data, len);
+			size_t end = head_.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+			if (end == std::string::npos)
+			{
+				return head_.size() <= MAX_HEADER;
+			}
+			if (head_.compare(0, 5, "HTTP/") != 0)
+			{
+				return false;
+			}
+			size_t used = end + 4 - old;
+			data += used;
+			len -= used;
+			head_.resize(end + 2);
+			size_t sp = head_.find(' ');
+			status_ = sp == std::string::npos ? 0 : atoi(head_.c_str() + sp + 1);
+			bodyLeft_ = 0;
+			for (size_t pos = head_.find("\r\n"); pos != std::string::npos && pos + 2 < head_.size(); pos = head_.find("\r\n", pos + 2))
+			{
+				if (strncasecmp(head_.c_str() + pos + 2, "Content-Length:", 15) == 0)
+				{
+					bodyLeft_ = strtoul(head_.c_str() + pos + 17, nullptr, 10);
+					break;
+				}
+			}
+			bytes_ = end + 4 + bodyLeft_;
+			head_.clear();
+			if (bodyLeft_ == 0 && !onResponse(status_, bytes_))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Reset()
+	{
+		head_.clear();
+		bodyLeft_ = 0;
+	}
+
+private:
+	std::string head_;	  // 还没收完的响应头
+	size_t bodyLeft_ = 0; // 当前响应还差多少字节的正文
+	int status_ = 0;
+	size_t bytes_ = 0;
+};
@@ -0,0 +1,103 @@
+/*
+ * HeapTimer 和 TimingWheel 的对比测试
+ * 用法: ./timer_bench [timeoutMs]
+ * 分别在 10k/100k/1M 个定时器下测量 add/adjust/del 以及到期处理的平均耗时(ns/op)
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include <thread>
+#include <chrono>
+
+#include "heaptimer.h"
+#include "timingwheel.h"
+
+using namespace std;
+
+typedef chrono::steady_clock BenchClock;
+
+static double NsPerOp(BenchClock::time_point start, size_t ops)
+{
+	return chrono::duration<double, nano>(BenchClock::now() - start).count() / ops;
+}
+
+struct Result
+{
+	double add;
+	double adjust;
+	double del;
+	double expire;
+};
+
+template <class Timer>
+static Result Run(size_t n, const vector<int> &order, int timeoutMs, int *fired)
+{
+	Result r;
+	Timer timer;
+
+	auto start = BenchClock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		timer.add(static_cast<int>(i), timeoutMs + static_cast<int>(i % 1000), [fired]
+				  { (*fired)++; });
+	}
+	r.add = NsPerOp(start, n);
+
+	/* 模拟每次读写事件都延长一次超时时间 */
+	start = BenchClock::now();
+	for (size_t i = 0; i < n; i++)
+	{
+		timer.adjust(order[i], timeoutMs);
+	}
+	r.adjust = NsPerOp(start, n);
+
+	/* 删除一半节点 */
+	start = BenchClock::now();
+	for (size_t i = 0; i < n / 2; i++)
+	{
+		timer.doWork(order[i]);
+	}
+	r.del = NsPerOp(start, n / 2);
+
+	/* 剩下的节点全部改成很快到期，等待后统计tick处理到期节点的开销 */
+	for (size_t i = n / 2; i < n; i++)
+	{
+		timer.adjust(order[i], 0);
+	}
+	this_thread::sleep_for(chrono::milliseconds(5));
+	ClockService::Instance()->Update(); // 时间轮使用缓存的时钟，相当于事件循环新的一轮
+	start = BenchClock::now();
+	timer.tick();
+	r.expire = NsPerOp(start, n - n / 2);
+	return r;
+}
+
+int main(int argc, char *argv[])
+{
+	int timeoutMs = argc > 1 ? atoi(argv[1]) : 60000;
+	const size_t sizes[] = {10000, 100000, 1000000};
+
+	printf("%-10s %-12s %12s %12s %12s %12s\n", "timers", "impl", "add(ns)", "adjust(ns)", "del(ns)", "expire(ns)");
+	for (size_t n : sizes)
+	{
+		vector<int> order(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			order[i] = static_cast<int>(i);
+		}
+		shuffle(order.begin(), order.end(), mt19937(42));
+
+		int heapFired = 0, wheelFired = 0;
+		Result heap = Run<HeapTimer>(n, order, timeoutMs, &heapFired);
+		Result wheel = Run<TimingWheel>(n, order, timeoutMs, &wheelFired);
+		printf("%-10zu %-12s %12.1f %12.1f %12.1f %12.1f\n", n, "HeapTimer", heap.add, heap.adjust, heap.del, heap.expire);
+		printf("%-10zu %-12s %12.1f %12.1f %12.1f %12.1f\n", n, "TimingWheel", wheel.add, wheel.adjust, wheel.del, wheel.expire);
+		if (heapFired != wheelFired)
+		{
+			fprintf(stderr, "fired mismatch: heap %d, wheel %d\n", heapFired, wheelFired);
+			return 1;
+		}
+	}
+	return 0;
+}
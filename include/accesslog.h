@@ -0,0 +1,91 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+
+#include "logbuffer.hpp"
+
+// 一条访问记录，二进制格式的访问日志就是这个结构体原样(小端)一条接一条写出
+struct AccessRecord
+{
+	int64_t wallUs;	   // 请求到达的墙上时间(us)
+	uint32_t queueUs;  // 到达 -> 开始处理(线程池排队)
+	uint32_t parseUs;  // 解析请求
+	uint32_t handleUs; // 查数据库、生成响应
+	uint32_t writeUs;  // 生成响应 -> 发送完
+	uint32_t bytes;	   // 发送的字节数
+	uint16_t status;
+	uint16_t port;
+	uint32_t ip; // 网络字节序
+	char method[8];
+	char path[84]; // 超长的路径被截断
+};
+static_assert(sizeof(AccessRecord) == 128, "AccessRecord layout is part of the binary log format");
+
+/*
+ * 访问日志：每个请求发送完以后记一条(方法、路径、状态码、字节数和各阶段耗时)，和运行日志分开写
+ * 采样：错误(状态码>=400)和慢请求(超过slowMs)全部记录，其余按sampleRate抽样
+ * 前端只把定长的AccessRecord拷进缓冲区；写线程批量换出缓冲区，JSON格式在写线程里转换成一行一条，
+ * 二进制格式直接写出，用一次writev
+ */
+class AccessLog
+{
+public:
+	enum Format
+	{
+		OFF,
+		JSON,
+		BINARY
+	};
+
+	static AccessLog *Instance();
+
+	// format: "off" "json" "binary"
+	bool Init(const char *format, const char *path = "./log", double sampleRate = 1.0, int slowMs = 100, int bufferKB = 256);
+
+	bool IsEnabled() const { return format_ != OFF; }
+
+	// 这个请求要不要记录(按状态码、耗时和采样率)
+	bool ShouldLog(int status, int64_t totalUs);
+
+	void Append(const AccessRecord &record);
+
+	// 把一条记录转成一行JSON(带换行)，返回长度
+	static size_t FormatJson(const AccessRecord &record, char *out, size_t cap);
+
+private:
+	typedef std::unique_ptr<LogBuffer> BufferPtr;
+
+	AccessLog();
+	~AccessLog();
+
+	void WriteLoop_();
+	void OpenFile_(); // 按日期打开文件，跨天时换文件
+	void WriteBuffers_(const std::vector<BufferPtr> &buffers);
+
+	static const int FLUSH_INTERVAL_MS = 1000;
+	static const size_t MAX_PENDING_BUFFERS = 16;
+
+	Format format_;
+	double sampleRate_;
+	int64_t slowUs_;
+	size_t bufferSize_;
+	const char *path_;
+
+	int fd_;
+	int toDay_;
+	bool running_;
+	std::atomic<size_t> dropped_; // 写线程来不及写丢掉的记录数
+
+	BufferPtr current_;
+	BufferPtr next_;
+	std::vector<BufferPtr> buffers_;
+	std::unique_ptr<std::thread> writeThread_;
+	std::mutex mtx_;
+	std::condition_variable cond_;
+};
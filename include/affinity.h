@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * CPU亲和性：把事件循环、工作线程和日志线程绑定到固定的CPU上
+ * 线程不再跨核、跨NUMA节点迁移；线程绑定之后再分配自己的缓冲区，按first-touch落在本地节点
+ * 配置字符串：
+ *   "off"或空   不绑定(默认)
+ *   "auto"      每个物理核只取一个逻辑CPU，避开SMT兄弟线程，按节点、物理核的顺序排列
+ *   "0-3,8,10"  按列表的顺序使用这些CPU
+ * 线程按申请的顺序依次拿到列表里的CPU，线程比CPU多时从头循环
+ */
+class CpuAffinity
+{
+public:
+	static CpuAffinity *Instance();
+
+	// 解析配置并读取/sys下的CPU拓扑，配置无效时返回false并保持不绑定
+	bool Init(const char *spec);
+
+	bool IsEnabled() const { return !cpus_.empty(); }
+
+	// 按顺序分配下一个CPU，没有启用时返回-1
+	int NextCpu();
+
+	// 把当前线程绑定到cpu上，cpu小于0时什么也不做
+	static bool BindCurrentThread(int cpu);
+
+	// cpu所在的NUMA节点，读不到时返回0
+	static int NodeOfCpu(int cpu);
+
+	std::string Describe() const; // 用于日志
+
+private:
+	CpuAffinity() : next_(0) {}
+
+	static bool ParseList_(const char *list, std::vector<int> &cpus);
+	static int ReadInt_(const char *path, int defaultValue);
+	void AutoPlan_(const std::vector<int> &allowed);
+
+	std::vector<int> cpus_; // 分配顺序
+	std::atomic<size_t> next_;
+};
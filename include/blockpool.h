@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+
+// 缓冲区的一个块，块头后面紧跟着数据
+struct Block
+{
+	size_t capacity; // 数据区大小
+	size_t readPos;	 // 读的位置
+	size_t writePos; // 写的位置
+
+	char *Data() { return reinterpret_cast<char *>(this + 1); }
+	const char *Data() const { return reinterpret_cast<const char *>(this + 1); }
+	size_t Readable() const { return writePos - readPos; }
+	size_t Writable() const { return capacity - writePos; }
+};
+
+/*
+ * 两级块池：固定大小的块用完先放回当前线程的空闲链表，下次直接复用，不走malloc
+ * 线程本地的空闲块超过MAX_CACHED_BLOCKS时，一批放进所有线程共享的池子；本地没有了再从共享池批量取
+ * 这样循环线程释放的空闲连接的块可以被工作线程拿去用，反过来也一样
+ * 比BLOCK_SIZE大的块单独分配，用完直接释放；共享池超过MAX_SHARED_BLOCKS的部分也直接释放
+ * InUseBytes()是所有线程已经取走还没放回的块的总大小，也就是缓冲区实际占用的内存，用来做全局内存预算
+ */
+class BlockPool
+{
+public:
+	static const size_t BLOCK_SIZE = 4096;
+	static const size_t MAX_CACHED_BLOCKS = 256;	 // 每个线程最多缓存的空闲块
+	static const size_t MAX_SHARED_BLOCKS = 4096; // 共享池最多缓存的空闲块(16MB)
+	static const size_t TRANSFER_BATCH = 32;		 // 线程和共享池之间一次转移的块数
+
+	static Block *Get(size_t capacity = BLOCK_SIZE);
+
+	static void Put(Block *block);
+
+	static size_t CachedBlocks(); // 当前线程空闲的块数
+
+	static size_t SharedBlocks(); // 共享池里空闲的块数
+
+	static size_t InUseBytes(); // 正在被缓冲区使用的块的总大小
+
+private:
+	static Block *Alloc_(size_t capacity);
+};
@@ -8,11 +8,23 @@
 #include <atomic>
 #include <cassert>
 
+#include "blockpool.h"
+
+/*
+ * 链式缓冲区：由若干块串起来，块从线程本地的块池里取
+ * ReadFd用readv直接读进块里，扩容只是在尾部接新块，不会搬动已有的数据
+ * 发送时用ReadIovec把所有块组成iovec一次writev出去，不需要先拼成连续内存
+ * Peek()/BeginWriteConst()要求连续内存，只有数据跨块时才合并成一块(绝大多数请求不超过一块)
+ * 第一个块在第一次写入时才分配；没有数据时可以用Release()把所有块还给块池
+ */
 class Buffer
 {
 public:
 	Buffer(int initBuffSize = 1024);
-	~Buffer() = default;
+	~Buffer();
+
+	Buffer(const Buffer &) = delete;
+	Buffer &operator=(const Buffer &) = delete;
 
 	size_t WritableBytes() const;
 	size_t ReadableBytes() const;
@@ -39,12 +51,29 @@ public:
 	ssize_t ReadFd(int fd, int *Errno);
 	ssize_t WriteFd(int fd, int *Errno);
 
+	// 可读数据(跳过前offset字节)的iovec，最多maxIov个，返回个数
+	int ReadIovec(struct iovec *iov, int maxIov, size_t offset = 0) const;
+
+	size_t BlockCount() const { return blocks_.size(); }
+
+	// 没有可读数据时把所有块还给块池(空闲连接不占内存)，下次写入或ReadFd时重新取
+	void Release();
+
+	// 占用的块内存(字节)，其他线程也可以读，用于统计
+	size_t HeldBytes() const { return heldBytes_.load(std::memory_order_relaxed); }
+
 private:
-	char *BeginPtr_();			   // 获取内存起始位置
-	const char *BeginPtr_() const; // 获取内存起始位置
-	void MakeSpace_(size_t len);   // 创建空间
-
-	std::vector<char> buffer_;			// 具体装数据的vector
-	std::atomic<std::size_t> readPos_;	// 读的位置
-	std::atomic<std::size_t> writePos_; // 写的位置
-};
\ No newline at end of file
+	static const int READ_BLOCKS = 16; // ReadFd一次最多新接的块数(64KB)
+
+	void MakeSpace_(size_t len);	   // 保证尾部有len字节连续空间
+	void Linearize_() const;		   // 数据跨块时合并成一块
+	void PushBlock_(size_t capacity);
+	void PutBlock_(Block *block) const; // 还给块池并更新heldBytes_
+
+	size_t initSize_; // 第一个块的大小
+	size_t readable_; // 所有块里可读数据的总大小
+	int readBlocks_;  // ReadFd下次新接的块数：上次读满了就加倍(最多READ_BLOCKS)，没读满就按上次用到的块数
+	// 第一个块是读端，最后一个块是写端；合并块不改变内容，所以const的Peek()也可以调用
+	mutable std::vector<Block *> blocks_;
+	mutable std::atomic<size_t> heldBytes_;
+};
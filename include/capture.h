@@ -0,0 +1,99 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "logbuffer.hpp"
+
+/*
+ * 抓包文件的格式：文件头后面是一条接一条的记录，每条记录一个定长的头，DATA记录后面紧跟着len字节的原始请求数据
+ * 时间是相对于开始抓包的us，连接编号从1开始，同一个编号就是同一个TCP连接
+ */
+struct CaptureFileHeader
+{
+	char magic[8];	   // "TOYCAP01"
+	int64_t startUs;   // 开始抓包的墙上时间(us)
+};
+
+struct CaptureRecord
+{
+	enum Type : uint16_t
+	{
+		OPEN = 1,	  // 新连接，aux是客户端ip(网络字节序)，code是端口
+		DATA = 2,	  // 从连接上读到的数据，len是字节数
+		RESPONSE = 3, // 一个响应发送完，code是状态码，len是响应的总字节数
+		CLOSE = 4	  // 连接关闭
+	};
+
+	uint64_t timeUs;
+	uint32_t conn;
+	uint32_t len;
+	uint32_t aux;
+	uint16_t type;
+	uint16_t code;
+};
+static_assert(sizeof(CaptureRecord) == 24, "CaptureRecord layout is part of the capture file format");
+
+/*
+ * 流量抓包：把每个连接读到的原始字节连同时间、连接的开始和结束、每个响应的状态码和大小写进一个文件，
+ * 用bench/replay按原来的节奏(或者加速)在同样多的连接上重放，比较状态码和响应大小
+ * 前端在锁里把记录拷进缓冲区，写线程批量写出；为了重放时数据完整，写线程跟不上时前端等待而不是丢弃
+ * 文件超过maxMB以后停止抓包
+ */
+class Capture
+{
+public:
+	static Capture *Instance();
+
+	// path为空或者nullptr表示不抓包
+	bool Init(const char *path, int maxMB = 1024, int bufferKB = 1024);
+
+	bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	// 新连接，返回连接编号(没开启时返回0)
+	uint32_t Open(const sockaddr_in &addr);
+	void Data(uint32_t conn, const struct iovec *iov, int cnt);
+	void Response(uint32_t conn, int status, size_t bytes);
+	void Close(uint32_t conn);
+
+private:
+	typedef std::unique_ptr<LogBuffer> BufferPtr;
+
+	Capture();
+	~Capture();
+
+	uint64_t NowUs_() const;
+	// 调用者持有mtx_，保证当前缓冲区至少有len字节，停止抓包以后返回false
+	bool Reserve_(std::unique_lock<std::mutex> &locker, size_t len);
+	void Append_(uint32_t conn, CaptureRecord::Type type, uint32_t len, uint32_t aux, uint16_t code);
+	void WriteLoop_();
+	void WriteBuffers_(const std::vector<BufferPtr> &buffers);
+
+	static const int FLUSH_INTERVAL_MS = 1000;
+	static const size_t MAX_PENDING_BUFFERS = 16;
+
+	std::atomic<bool> enabled_;
+	std::atomic<uint32_t> nextConn_;
+	int64_t startNs_;
+	size_t bufferSize_;
+	size_t maxBytes_;
+	size_t written_; // 已经交给写线程的字节数，到maxBytes_就停止
+
+	int fd_;
+	bool running_;
+
+	BufferPtr current_;
+	std::vector<BufferPtr> buffers_;
+	std::vector<BufferPtr> spares_;
+	std::unique_ptr<std::thread> writeThread_;
+	std::mutex mtx_;
+	std::condition_variable cond_;		// 叫醒写线程
+	std::condition_variable drained_;	// 写线程写完一批，叫醒等待的前端
+};
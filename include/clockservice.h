@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <ctime>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * 时钟服务：事件循环每轮调用一次Update()，把单调时间和墙上时间缓存起来
+ * 定时器、响应头等热点路径直接读缓存，不再调用clock_gettime/localtime
+ * 精度允许时使用CLOCK_MONOTONIC_COARSE/CLOCK_REALTIME_COARSE(vDSO实现，不陷入内核)
+ * 格式化好的日志时间戳和HTTP-date按秒缓存在每个线程里，跨秒时才重新格式化
+ */
+class ClockService
+{
+public:
+	static ClockService *Instance();
+
+	void Update(); // 事件循环每轮调用一次
+
+	int64_t NowMs() const { return monoMs_.load(std::memory_order_relaxed); }	 // 缓存的单调时间(ms)
+	int64_t WallUs() const { return wallUs_.load(std::memory_order_relaxed); } // 缓存的墙上时间(us)
+
+	// 日志时间戳 "2023-01-01 12:00:00.123456 "，现读粗粒度墙上时间，日志可能来自任何线程
+	int FormatLogTime(char *buf, size_t len, struct tm *t);
+
+	// 现读墙上时间(us)，延迟格式化的日志记录这个值，由写线程用FormatLogTimeAt格式化
+	int64_t ReadWallUs() const;
+	int FormatLogTimeAt(int64_t wallUs, char *buf, size_t len, struct tm *t);
+
+	// "Sun, 06 Nov 1994 08:49:37 GMT"，使用缓存的墙上时间
+	const char *HttpDate();
+
+	static const int LOG_TIME_LEN = 27;
+	static const int HTTP_DATE_LEN = 29;
+
+private:
+	ClockService();
+
+	struct SecondCache
+	{
+		time_t sec;
+		struct tm local;
+		/* 按每个%d最长11个字符留够空间，正常只用到前19、29个字符 */
+		char logTime[72];	// "YYYY-MM-DD HH:MM:SS"
+		char httpDate[80];	// RFC 7231 IMF-fixdate
+	};
+
+	static SecondCache &Cache_(time_t sec);
+
+	clockid_t monoId_;
+	clockid_t wallId_;
+
+	std::atomic<int64_t> monoMs_;
+	std::atomic<int64_t> wallUs_;
+};
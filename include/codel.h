@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * CoDel负载控制：用任务在队列里的停留时间(sojourn)判断是否过载，而不是看队列长度
+ * 一个interval内最小的停留时间都超过target，说明队列一直没有排空，进入过载状态
+ * 过载时不按CoDel原本的控制律逐渐加快丢弃，而是直接丢弃停留超过2*target的任务，
+ * 这样被接受的请求排队时间有上界，线程也不会因为丢得太多而空闲
+ * OnDequeue可以在多个工作线程里同时调用
+ */
+class CoDel
+{
+public:
+	explicit CoDel(int targetMs = 5, int intervalMs = 100);
+
+	// 任务出队时调用，返回true表示这个任务排队太久应该丢弃
+	bool OnDequeue(int64_t sojournNs, int64_t nowNs);
+
+	bool IsOverloaded() const { return overloaded_.load(std::memory_order_relaxed); }
+
+	int64_t SloughNs() const { return targetNs_ * 2; } // 过载时允许的最长排队时间
+
+	int64_t TargetNs() const { return targetNs_; }
+
+private:
+	const int64_t targetNs_;
+	const int64_t intervalNs_;
+
+	std::atomic<int64_t> intervalEndNs_; // 当前统计周期的结束时间
+	std::atomic<int64_t> minDelayNs_;	 // 当前周期内最小的停留时间
+	std::atomic<bool> resetDelay_;		 // 周期切换后由一个线程重置minDelayNs_
+	std::atomic<bool> overloaded_;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <sys/eventfd.h> // eventfd()
+#include <sys/timerfd.h> // timerfd_create()
+
+#include "epoller.h"
+#include "timingwheel.h"
+#include "clockservice.h"
+#include "task.h"
+#include "log.h"
+
+/*
+ * 事件循环：封装Epoller，一个循环只属于一个线程
+ * 其他线程通过RunInLoop/QueueInLoop把任务投递到循环线程执行，用eventfd唤醒
+ * 投递是批量的：循环线程取走任务之前，再多的投递也只写一次eventfd
+ * RunAfter/RunEvery的定时任务由timerfd驱动，连接超时仍然由时间轮管理
+ * 投递的任务是定长的Task，任务队列复用容量，投递不分配堆内存
+ */
+class EventLoop
+{
+public:
+	typedef std::function<void(int fd, uint32_t events)> EventCallBack;
+	typedef uint64_t TimerId;
+
+	explicit EventLoop(int maxEvent = 1024);
+
+	~EventLoop();
+
+	void Loop();
+
+	void Quit();
+
+	void RunInLoop(Task cb);
+
+	void QueueInLoop(Task cb);
+
+	TimerId RunAfter(int delayMs, Task cb);
+
+	TimerId RunEvery(int intervalMs, Task cb);
+
+	void Cancel(TimerId id);
+
+	bool IsInLoopThread() const { return threadId_ == std::this_thread::get_id(); }
+
+	void SetEventCallBack(const EventCallBack &cb) { eventCb_ = cb; }
+
+	Epoller *GetEpoller() { return epoller_.get(); }
+
+	TimingWheel *GetTimer() { return timer_.get(); } // 只能在循环线程中使用
+
+private:
+	struct TimerTask
+	{
+		int64_t expires; // 到期时间(单调时间ms)
+		int interval;	 // 大于0表示周期任务
+		Task cb;
+	};
+
+	static int64_t NowMs_();
+
+	void Wakeup_();
+	void HandleWakeup_();
+	void DoPendingFunctors_();
+
+	TimerId AddTimer_(int64_t expires, int interval, Task cb);
+	void InsertTimer_(TimerId id, TimerTask task);
+	void ResetTimerFd_();
+	void HandleTimerFd_();
+
+	std::atomic<bool> quit_;
+	std::thread::id threadId_;
+
+	std::unique_ptr<Epoller> epoller_;
+	std::unique_ptr<TimingWheel> timer_;
+	EventCallBack eventCb_;
+
+	int wakeupFd_;
+	std::atomic<bool> wakeupPending_; // 已经写过eventfd，循环线程还没处理
+	bool callingPending_;			  // 正在执行投递过来的任务
+	std::mutex mtx_;
+	std::vector<Task> pending_;
+	std::vector<Task> running_; // 和pending_交换，两边都保留容量
+	std::vector<std::pair<TimerId, TimerTask>> pendingTimers_; // 其他线程添加的定时任务
+	std::vector<std::pair<TimerId, TimerTask>> runningTimers_;
+
+	int timerFd_;
+	std::atomic<TimerId> nextTimerId_;
+	std::set<std::pair<int64_t, TimerId>> timerQueue_; // 按到期时间排序
+	std::unordered_map<TimerId, TimerTask> timerTasks_;
+	TimerId runningTimer_; // 正在执行的定时任务，回调里Cancel自己时用来阻止重新调度
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <sys/stat.h>
+
+// 缓存的文件内容，多个连接共享同一份
+struct CachedFile
+{
+	const char *data;
+	struct stat st;
+	int64_t loadMs;						  // 读入(或者确认文件没变)的时间(单调时间ms)
+	std::shared_ptr<const void> storage;  // data所在的内存：单独读入的字符串，或者预热时的整块区域
+};
+
+/*
+ * 小文件缓存：静态资源读一次放在内存里，之后的请求不再stat/open/mmap
+ * Find只查内存，不做任何IO，循环线程可以用它判断一个请求能不能直接在循环线程里响应
+ * 条目超过ttl就当作没有命中，由子线程重新检查，文件修改最多延迟ttl生效；文件没变(inode、大小、修改时间相同)时沿用原来的内容，不重新读
+ * 启动时可以用Warm()预热：小文件一起读进一块连续的内存(可以用大页)，大文件预读进页缓存
+ */
+class FileCache
+{
+public:
+	struct WarmStats
+	{
+		size_t files;		// 读进缓存的文件数
+		size_t bytes;		// 读进缓存的字节数
+		size_t mappedFiles; // 太大不缓存、只预读进页缓存的文件数
+		size_t mappedBytes;
+		const char *memory; // 缓存内容所在的内存："heap" "thp"(透明大页) "hugetlb"
+		int64_t ms;			// 预热用的时间
+	};
+
+	static FileCache *Instance();
+
+	void Init(size_t maxFileSize, size_t maxTotalBytes, int ttlMs);
+
+	// 只查缓存，没有或者过期返回nullptr
+	std::shared_ptr<const CachedFile> Find(const std::string &path);
+
+	// 读文件放进缓存，不是普通文件或者太大返回nullptr；缓存满了照样返回内容，只是不放进缓存
+	std::shared_ptr<const CachedFile> Load(const std::string &path);
+
+	size_t MaxFileSize() const { return maxFileSize_; }
+
+	// 遍历dir下所有的文件：能缓存的读进缓存，hugePages时放进大页(先试hugetlbfs预留的大页，再试透明大页)；
+	// 其他的用MAP_POPULATE和MADV_WILLNEED读进页缓存，之后每个请求的mmap不用等磁盘
+	WarmStats Warm(const std::string &dir, bool hugePages);
+
+	size_t TotalBytes();
+
+private:
+	FileCache();
+
+	// 放进缓存，缓存满了返回false；调用者持有写锁
+	bool Insert_(const std::string &path, const std::shared_ptr<const CachedFile> &file);
+
+	size_t maxFileSize_;   // 能缓存的最大文件
+	size_t maxTotalBytes_; // 缓存的总大小上限
+	int ttlMs_;
+
+	std::shared_mutex mtx_;
+	size_t totalBytes_;
+	std::unordered_map<std::string, std::shared_ptr<const CachedFile>> files_;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * 对数-线性(HDR风格)直方图：小于2^SUB_BITS的值每个值一个桶；更大的值按最高位分组，
+ * 每组再线性分成2^SUB_BITS个桶，相对误差不超过1/2^SUB_BITS(约3%)
+ * 桶的下标用一次clz算出来，记录就是一次relaxed的读加写，只允许一个线程写(每个线程各用一个)
+ * 读的线程把各个线程的直方图加到Snapshot里再算分位数
+ */
+class HdrHistogram
+{
+public:
+	static const int SUB_BITS = 5;
+	static const int SUB_COUNT = 1 << SUB_BITS;
+	static const int MAX_BITS = 27; // 能区分的最大值约2^28(按us约268s)，更大的值记在最后一个桶
+	static const int BUCKETS = (MAX_BITS - SUB_BITS + 2) << SUB_BITS;
+
+	HdrHistogram()
+	{
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			counts_[i].store(0, std::memory_order_relaxed);
+		}
+		total_.store(0, std::memory_order_relaxed);
+		sum_.store(0, std::memory_order_relaxed);
+	}
+
+	HdrHistogram(const HdrHistogram &) = delete;
+	HdrHistogram &operator=(const HdrHistogram &) = delete;
+
+	// 单写者
+	void Record(uint64_t value)
+	{
+		Inc_(counts_[Index(value)], 1);
+		Inc_(total_, 1);
+		Inc_(sum_, value);
+	}
+
+	static int Index(uint64_t value)
+	{
+		const uint64_t max = (static_cast<uint64_t>(1) << (MAX_BITS + 1)) - 1;
+		if (value > max)
+		{
+			value = max;
+		}
+		if (value < static_cast<uint64_t>(SUB_COUNT))
+		{
+			return static_cast<int>(value);
+		}
+		int msb = 63 - __builtin_clzll(value);
+		int shift = msb - SUB_BITS;
+		int mantissa = static_cast<int>(value >> shift) - SUB_COUNT;
+		return ((shift + 1) << SUB_BITS) | mantissa;
+	}
+
+	// 桶代表的值(桶的中点)
+	static uint64_t ValueAt(int index)
+	{
+		if (index < SUB_COUNT)
+		{
+			return index;
+		}
+		int shift = (index >> SUB_BITS) - 1;
+		uint64_t low = static_cast<uint64_t>(SUB_COUNT + (index & (SUB_COUNT - 1))) << shift;
+		return low + ((static_cast<uint64_t>(1) << shift) >> 1);
+	}
+
+	// 多个直方图合并后的结果
+	struct Snapshot
+	{
+		uint64_t counts[BUCKETS];
+		uint64_t total;
+		uint64_t sum;
+
+		Snapshot() { Reset(); }
+
+		void Reset()
+		{
+			memset(counts, 0, sizeof(counts));
+			total = 0;
+			sum = 0;
+		}
+
+		void Add(const HdrHistogram &h)
+		{
+			for (int i = 0; i < BUCKETS; i++)
+			{
+				counts[i] += h.counts_[i].load(std::memory_order_relaxed);
+			}
+			total += h.total_.load(std::memory_order_relaxed);
+			sum += h.sum_.load(std::memory_order_relaxed);
+		}
+
+		void Add(const Snapshot &s)
+		{
+			for (int i = 0; i < BUCKETS; i++)
+			{
+				counts[i] += s.counts[i];
+			}
+			total += s.total;
+			sum += s.sum;
+		}
+
+		// q在0到1之间，没有数据返回0
+		uint64_t Quantile(double q) const
+		{
+			if (total == 0)
+			{
+				return 0;
+			}
+			uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+			rank = rank == 0 ? 1 : (rank > total ? total : rank);
+			uint64_t seen = 0;
+			for (int i = 0; i < BUCKETS; i++)
+			{
+				seen += counts[i];
+				if (seen >= rank)
+				{
+					return ValueAt(i);
+				}
+			}
+			return ValueAt(BUCKETS - 1);
+		}
+	};
+
+private:
+	static void Inc_(std::atomic<uint64_t> &v, uint64_t delta)
+	{
+		v.store(v.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> counts_[BUCKETS];
+	std::atomic<uint64_t> total_;
+	std::atomic<uint64_t> sum_;
+};
@@ -11,6 +11,7 @@
 #include "buffer.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "trace.h"
 
 // Http连接类，其中封装了请求和响应对象
 class HttpConn
@@ -36,11 +37,71 @@ public:
 
 	sockaddr_in GetAddr() const;
 
-	bool process();
+	bool process(); // 解析+验证+生成响应，没有请求数据时返回false
+
+	// process()拆开的三步，调用者可以把需要访问数据库的verify()放到别的线程里
+	bool parse();
+	bool NeedsDb() const
+	{
+		return request_.NeedsVerify();
+	}
+	void verify();
+	void respond();
+
+	// 解析成功、不用查数据库、文件已经在缓存里：可以直接在循环线程里响应
+	bool IsCheap() const;
+
+	bool IsResponseCached() const
+	{
+		return response_.IsCached();
+	}
+
+	// 读缓冲区到了上限(高水位)，不再继续读，等请求处理掉再读
+	bool IsReadFull() const
+	{
+		return readLimit > 0 && readBuff_.ReadableBytes() >= readLimit;
+	}
+
+	// 因为全局内存预算用完而暂停读，只在循环线程中读写
+	bool IsPaused() const
+	{
+		return isPaused_;
+	}
+
+	void SetPaused(bool paused)
+	{
+		isPaused_ = paused;
+	}
+
+	// 连接空闲(等待下一个请求)时释放缓冲区和上一个响应的文件，下次读的时候再取
+	void ReleaseIdle();
+
+	// 请求数据到达(读事件)的时刻，访问日志用它算排队时间，只在循环线程中调用；同时决定这个请求要不要追踪
+	// 请求头分几次读到时只记第一次，之后的读事件不改(请求发送完才清零)
+	void MarkArrival()
+	{
+		if (arriveNs_ == 0)
+		{
+			arriveNs_ = NowNs_();
+			traceId_ = Tracer::Instance()->Sample();
+		}
+	}
+
+	// 当前请求的追踪编号，0表示不追踪
+	uint64_t TraceId() const
+	{
+		return traceId_;
+	}
+
+	// 两个缓冲区占用的内存，用于统计
+	size_t BufferBytes() const
+	{
+		return readBuff_.HeldBytes() + writeBuff_.HeldBytes();
+	}
 
 	int ToWriteBytes()
 	{
-		return iov_[0].iov_len + iov_[1].iov_len;
+		return writeBuff_.ReadableBytes() + fileIov_.iov_len;
 	}
 
 	bool IsKeepAlive() const
@@ -48,8 +109,27 @@ public:
 		return request_.IsKeepAlive();
 	}
 
+	bool IsClosed() const
+	{
+		return isClose_;
+	}
+
+	// 是否已交给子线程处理，只在循环线程中读写
+	bool IsBusy() const
+	{
+		return isBusy_;
+	}
+
+	void SetBusy(bool busy)
+	{
+		isBusy_ = busy;
+	}
+
 	static bool isET;
+	static size_t readLimit;		   // 每个连接读缓冲区的上限，0表示不限制
 	static const char *srcDir;		   // 资源的目录
+	static std::string metricsPath;	   // 输出指标的路径，空表示不提供
+	static std::string tracePath;	   // 导出追踪的路径(只限本机)，POST到加上/on、/off的路径打开和关闭追踪，空表示不提供
 	static std::atomic<int> userCount; // 总共的客户单的连接数
 
 private:
@@ -57,9 +137,59 @@ private:
 	struct sockaddr_in addr_;
 
 	bool isClose_;
+	bool isBusy_;
+	bool isPaused_;
+	bool parseOk_; // 请求是否解析成功
+
+	static const int MAX_IOV = 16; // 一次writev最多的块数
+
+	bool IsMetrics_() const
+	{
+		return parseOk_ && !metricsPath.empty() && request_.path() == metricsPath;
+	}
+
+	// 只接受本机来的请求：导出很重，开关会改全局状态；GET导出，打开和关闭要用POST，其他的按普通文件处理(404)
+	bool IsTrace_() const
+	{
+		if (!parseOk_ || tracePath.empty() || !IsLoopback_())
+		{
+			return false;
+		}
+		const std::string &path = request_.path();
+		if (request_.method() == "POST")
+		{
+			return path == tracePath + "/on" || path == tracePath + "/off";
+		}
+		return request_.method() == "GET" && path == tracePath;
+	}
+
+	bool IsLoopback_() const
+	{
+		return (ntohl(addr_.sin_addr.s_addr) >> 24) == 127;
+	}
+
+	std::string TraceControl_() const; // 处理追踪的路径，返回响应体
+
+	static int64_t NowNs_();
+	void RequestDone_();			// 响应发送完：记录各阶段的延迟，写访问日志，然后清零时间点
+	void RecordLatency_(int64_t now); // 每个请求都记进各阶段的延迟直方图
+	void LogAccess_(int64_t now);	  // 按采样规则记一条访问日志
+	void CaptureRead_(size_t offset); // 抓包：读缓冲区里offset之后是这次新读到的数据
+
+	/* 各阶段的时间点(单调时间ns)，一个请求发送完后清零 */
+	int64_t acceptNs_; // 只有连接上的第一个请求用到
+	int64_t arriveNs_;
+	int64_t parseStartNs_;
+	int64_t parseEndNs_;
+	int64_t handleEndNs_;
+	size_t bytesSent_;
+	int route_; // 解析时的路由，Verify()会把登录、注册的路径改成结果页，统计要用改之前的
+	std::string path_; // 解析时的路径，访问日志记客户端请求的路径
+
+	uint32_t captureConn_; // 抓包时的连接编号，0表示不抓
+	uint64_t traceId_;	   // 当前请求的追踪编号，一个请求发送完后清零
 
-	int iovCnt_;		  // 分散内存的数量
-	struct iovec iov_[2]; // 分散内存
+	struct iovec fileIov_; // 还没发送的文件内容(内存映射或者缓存)，响应头在writeBuff_里
 
 	Buffer readBuff_;  // 读(请求)缓冲区，保存请求数据的内容
 	Buffer writeBuff_; // 写(响应)缓冲区，保存响应数据的内容
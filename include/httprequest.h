@@ -50,6 +50,10 @@ public:
 
 	bool IsKeepAlive() const;
 
+	// 登录、注册请求需要查数据库，解析时只做标记，由调用者决定在哪个线程里执行Verify()
+	bool NeedsVerify() const { return needVerify_; }
+	void Verify();
+
 private:
 	bool ParseRequestLine_(const std::string &line);
 	void ParseHeader_(const std::string &line);
@@ -65,6 +69,8 @@ private:
 	std::string method_, path_, version_, body_;		  // 请求方法，请求路径，协议版本，请求体
 	std::unordered_map<std::string, std::string> header_; // 请求头(键值对形式)
 	std::unordered_map<std::string, std::string> post_;	  // post请求表单数据
+	bool needVerify_;									  // 是否还需要查数据库验证用户
+	bool isLogin_;										  // 登录(true)还是注册(false)
 
 	static const std::unordered_set<std::string> DEFAULT_HTML; // 默认的网页
 	static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
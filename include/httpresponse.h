@@ -8,6 +8,8 @@
 
 #include "buffer.h"
 #include "log.h"
+#include "clockservice.h"
+#include "filecache.h"
 
 class HttpResponse
 {
@@ -17,11 +19,13 @@ public:
 
 	void Init(const std::string &srcDir, std::string &path, bool isKeepAlive = false, int code = -1);
 	void MakeResponse(Buffer &buff);
+	void MakeResponse(Buffer &buff, const std::string &body); // 响应体是生成的内容，不是文件
 	void UnmapFile();
 	char *File();
 	size_t FileLen() const;
 	void ErrorContent(Buffer &buff, std::string message);
 	int Code() const { return code_; }
+	bool IsCached() const { return static_cast<bool>(cached_); } // 响应内容是否来自文件缓存
 
 private:
 	void AddStateLine_(Buffer &buff);
@@ -37,8 +41,9 @@ private:
 	std::string path_;	 // 资源的路径
 	std::string srcDir_; // 资源的目录
 
-	char *mmFile_;			 // 文件内存映射的指针
-	struct stat mmFileStat_; // 文件的状态信息
+	char *mmFile_;							   // 文件内存映射的指针
+	std::shared_ptr<const CachedFile> cached_; // 小文件走缓存，不做内存映射
+	struct stat mmFileStat_;				   // 文件的状态信息
 
 	static const std::unordered_map<std::string, std::string> SUFFIX_TYPE; // 后缀 - 类型
 	static const std::unordered_map<int, std::string> CODE_STATUS;		   // 状态码 - 描述
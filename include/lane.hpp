@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "threadpool.hpp"
+#include "codel.h"
+#include "metrics.h"
+#include "trace.h"
+
+/*
+ * 执行通道(舱壁隔离)：每个通道有自己的线程池、线程数和队列上限
+ * 静态文件和访问数据库的请求走不同的通道，数据库变慢只会拖慢自己的通道
+ * 每个任务记录入队时间，统计排队等待和执行的耗时
+ * 排队时间交给CoDel判断是否过载：过载时排队太久的任务不执行，改为调用提交时给的shed回调；
+ * 入口处也可以用ShouldShed()按预计的排队时间提前拒绝新请求
+ * 给了线程数上限时，由Adapt()周期地按排队时间和线程利用率调整线程数：
+ * 排队时间超过CoDel目标的一半并且线程都忙(比如卡在数据库上)就加线程，连续几个周期都很闲才减一个，
+ * 加和减的利用率阈值隔开一段，减完之后的利用率也够不到加线程的阈值，不会来回抖动
+ */
+class Lane
+{
+public:
+	struct Stats
+	{
+		size_t queued;	  // 正在排队的任务数
+		size_t capacity;  // 队列容量，0表示不限制
+		size_t rejected;  // 队列满被拒绝的任务数
+		size_t shed;	  // 过载被丢弃的任务数(入口和出队)
+		size_t executed;  // 执行完的任务数
+		bool overloaded;  // CoDel是否处于过载状态
+		size_t threads;	  // 当前的线程数
+		double busy;	  // 上一个调整周期的线程利用率
+		double avgWaitUs; // 平均排队时间
+		double avgExecUs; // 平均执行时间
+		double maxWaitUs; // 上次取统计以来最长的排队时间
+	};
+
+	// threadCount同时是线程数的下限；maxThreads不大于threadCount表示线程数固定
+	Lane(const char *name, size_t threadCount, size_t queueCapacity, const std::vector<int> &cpus = {}, size_t maxThreads = 0)
+		: name_(name), minThreads_(threadCount), pool_(threadCount, queueCapacity, cpus, maxThreads),
+		  executed_(0), shed_(0), waitNs_(0), execNs_(0), maxWaitNs_(0), execEwmaNs_(0), resizes_(0), busy_(0),
+		  lastAdaptNs_(NowNs_()), lastExecuted_(0), lastWaitNs_(0), lastExecNs_(0), idleRounds_(0)
+	{
+		RegisterMetrics_();
+	}
+
+	// 不可丢弃的任务(比如已经开始发送的响应)，队列满了返回false
+	template <class F>
+	bool Submit(F task)
+	{
+		int64_t enqueueNs = NowNs_();
+		return pool_.AddTask([this, enqueueNs, task]() mutable
+							 {
+			int64_t startNs = NowNs_();
+			codel_.OnDequeue(startNs - enqueueNs, startNs);
+			Run_(task, enqueueNs, startNs); });
+	}
+
+	// 可丢弃的任务：过载且排队太久时调用shed()代替task()
+	template <class F, class S>
+	bool Submit(F task, S shed)
+	{
+		int64_t enqueueNs = NowNs_();
+		return pool_.AddTask([this, enqueueNs, task, shed]() mutable
+							 {
+			int64_t startNs = NowNs_();
+			if (codel_.OnDequeue(startNs - enqueueNs, startNs))
+			{
+				shed_.fetch_add(1, std::memory_order_relaxed);
+				shed();
+				return;
+			}
+			Run_(task, enqueueNs, startNs); });
+	}
+
+	// 入口准入(提交之前调用)：过载并且按队列长度估计的排队时间超过上限时返回true，同时计入丢弃数
+	bool ShouldShed()
+	{
+		if (!codel_.IsOverloaded())
+		{
+			return false;
+		}
+		int64_t estimateNs = static_cast<int64_t>(pool_.QueueSize()) * execEwmaNs_.load(std::memory_order_relaxed) / static_cast<int64_t>(pool_.ThreadCount());
+		if (estimateNs <= codel_.SloughNs())
+		{
+			return false;
+		}
+		shed_.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	const char *Name() const { return name_; }
+
+	bool IsAdaptive() const { return pool_.MaxThreads() > minThreads_; }
+
+	// 按上次调用以来的排队时间和利用率调整线程数，只在一个线程里周期地调用；返回调整的线程数，正数是加，负数是减
+	int Adapt()
+	{
+		int64_t now = NowNs_();
+		size_t executed = executed_.load(std::memory_order_relaxed);
+		int64_t waitNs = waitNs_.load(std::memory_order_relaxed);
+		int64_t execNs = execNs_.load(std::memory_order_relaxed);
+		size_t threads = pool_.ThreadCount();
+		int64_t elapsed = now - lastAdaptNs_;
+		size_t done = executed - lastExecuted_;
+		double busy = elapsed > 0 ? static_cast<double>(execNs - lastExecNs_) / elapsed / threads : 0;
+		int64_t avgWaitNs = done > 0 ? (waitNs - lastWaitNs_) / static_cast<int64_t>(done) : 0;
+		/* 排着的任务一直没被取走，完成数为0也算排队 */
+		bool waiting = avgWaitNs > codel_.TargetNs() / 2 || (done == 0 && pool_.QueueSize() > 0);
+		lastAdaptNs_ = now;
+		lastExecuted_ = executed;
+		lastWaitNs_ = waitNs;
+		lastExecNs_ = execNs;
+		busy_.store(busy, std::memory_order_relaxed);
+
+		size_t target = threads;
+		if (waiting && busy >= GROW_BUSY)
+		{
+			idleRounds_ = 0;
+			target = std::min(threads + std::max<size_t>(1, threads / 4), pool_.MaxThreads());
+		}
+		else if (busy < SHRINK_BUSY && !waiting && ++idleRounds_ >= SHRINK_ROUNDS)
+		{
+			idleRounds_ = 0;
+			target = threads > minThreads_ ? threads - 1 : threads;
+		}
+		else if (busy >= SHRINK_BUSY || waiting)
+		{
+			idleRounds_ = 0;
+		}
+		if (target == threads)
+		{
+			return 0;
+		}
+		pool_.Resize(target);
+		resizes_.fetch_add(1, std::memory_order_relaxed);
+		return static_cast<int>(target) - static_cast<int>(threads);
+	}
+
+	Stats GetStats()
+	{
+		Stats stats;
+		stats.queued = pool_.QueueSize();
+		stats.capacity = pool_.QueueCapacity();
+		stats.rejected = pool_.RejectedCount();
+		stats.shed = shed_.load(std::memory_order_relaxed);
+		stats.executed = executed_.load(std::memory_order_relaxed);
+		stats.overloaded = codel_.IsOverloaded();
+		stats.threads = pool_.ThreadCount();
+		stats.busy = busy_.load(std::memory_order_relaxed);
+		size_t n = stats.executed > 0 ? stats.executed : 1;
+		stats.avgWaitUs = waitNs_.load(std::memory_order_relaxed) / 1000.0 / n;
+		stats.avgExecUs = execNs_.load(std::memory_order_relaxed) / 1000.0 / n;
+		stats.maxWaitUs = maxWaitNs_.exchange(0, std::memory_order_relaxed) / 1000.0;
+		return stats;
+	}
+
+private:
+	static constexpr double GROW_BUSY = 0.75;	// 利用率到这里并且在排队就加线程
+	static constexpr double SHRINK_BUSY = 0.3;	// 利用率低于这里算空闲
+	static const int SHRINK_ROUNDS = 5;			// 连续空闲这么多个周期才减一个线程
+
+	static int64_t NowNs_()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+
+	// 排队时间直方图按线程计数；其他指标抓取时从现有的统计里读
+	void RegisterMetrics_()
+	{
+		Metrics *metrics = Metrics::Instance();
+		std::string label = std::string("{lane=\"") + name_ + "\"}";
+		waitHist_ = metrics->AddHistogram("toy_lane_wait_seconds" + label, "Time tasks spent queued before running", Metrics::LatencyBuckets());
+		metrics->AddCallback("toy_lane_queued" + label, "Tasks waiting in the lane queue", Metrics::GAUGE, [this]
+							 { return static_cast<double>(pool_.QueueSize()); });
+		metrics->AddCallback("toy_lane_queue_capacity" + label, "Lane queue capacity, 0 means unbounded", Metrics::GAUGE, [this]
+							 { return static_cast<double>(pool_.QueueCapacity()); });
+		metrics->AddCallback("toy_lane_overloaded" + label, "Whether CoDel considers the lane overloaded", Metrics::GAUGE, [this]
+							 { return codel_.IsOverloaded() ? 1.0 : 0.0; });
+		metrics->AddCallback("toy_lane_executed_total" + label, "Tasks executed by the lane", Metrics::COUNTER, [this]
+							 { return static_cast<double>(executed_.load(std::memory_order_relaxed)); });
+		metrics->AddCallback("toy_lane_rejected_total" + label, "Tasks rejected because the queue was full", Metrics::COUNTER, [this]
+							 { return static_cast<double>(pool_.RejectedCount()); });
+		metrics->AddCallback("toy_lane_shed_total" + label, "Tasks shed because of overload", Metrics::COUNTER, [this]
+							 { return static_cast<double>(shed_.load(std::memory_order_relaxed)); });
+		metrics->AddCallback("toy_lane_threads" + label, "Current worker threads in the lane", Metrics::GAUGE, [this]
+							 { return static_cast<double>(pool_.ThreadCount()); });
+		metrics->AddCallback("toy_lane_threads_max" + label, "Upper bound for adaptive lane sizing", Metrics::GAUGE, [this]
+							 { return static_cast<double>(pool_.MaxThreads()); });
+		metrics->AddCallback("toy_lane_busy_ratio" + label, "Fraction of worker time spent running tasks in the last sizing period", Metrics::GAUGE, [this]
+							 { return busy_.load(std::memory_order_relaxed); });
+		metrics->AddCallback("toy_lane_resizes_total" + label, "Times adaptive sizing changed the thread count", Metrics::COUNTER, [this]
+							 { return static_cast<double>(resizes_.load(std::memory_order_relaxed)); });
+	}
+
+	template <class F>
+	void Run_(F &task, int64_t enqueueNs, int64_t startNs)
+	{
+		Tracer::NameThread(name_);
+		int64_t waitNs = startNs - enqueueNs;
+		Metrics::Instance()->Observe(waitHist_, waitNs / 1e9);
+		waitNs_.fetch_add(waitNs, std::memory_order_relaxed);
+		int64_t max = maxWaitNs_.load(std::memory_order_relaxed);
+		while (waitNs > max && !maxWaitNs_.compare_exchange_weak(max, waitNs, std::memory_order_relaxed))
+		{
+		}
+		task();
+		int64_t execNs = NowNs_() - startNs;
+		execNs_.fetch_add(execNs, std::memory_order_relaxed);
+		executed_.fetch_add(1, std::memory_order_relaxed);
+		/* 执行时间的指数滑动平均(1/8)，用来估计排队时间；多个线程同时更新丢一次也无所谓 */
+		int64_t ewma = execEwmaNs_.load(std::memory_order_relaxed);
+		execEwmaNs_.store(ewma + (execNs - ewma) / 8, std::memory_order_relaxed);
+	}
+
+	const char *name_;
+	size_t minThreads_;
+	ThreadPool pool_;
+	CoDel codel_;
+	std::atomic<size_t> executed_;
+	std::atomic<size_t> shed_;
+	std::atomic<int64_t> waitNs_;
+	std::atomic<int64_t> execNs_;
+	std::atomic<int64_t> maxWaitNs_;
+	std::atomic<int64_t> execEwmaNs_; // 执行时间的滑动平均
+	std::atomic<size_t> resizes_;
+	std::atomic<double> busy_;
+	int waitHist_;
+
+	/* 上次Adapt()时的累计值，只在调用Adapt()的线程里用 */
+	int64_t lastAdaptNs_;
+	size_t lastExecuted_;
+	int64_t lastWaitNs_;
+	int64_t lastExecNs_;
+	int idleRounds_;
+};
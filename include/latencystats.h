@@ -0,0 +1,69 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "hdrhistogram.hpp"
+
+/*
+ * 请求各阶段的延迟分布：按(路由, 阶段)各一个HDR直方图，每个线程一份，用到时才分配
+ * 请求发送完以后记录一次，所有请求都记(不采样)，开销是几次clz和relaxed写
+ * 抓取/metrics时合并所有线程，输出每个路由每个阶段的p50/p99/p999(Prometheus summary)，
+ * route="all"是所有路由合在一起的结果
+ */
+class LatencyStats
+{
+public:
+	enum Phase
+	{
+		ACCEPT, // 接受连接 -> 第一个请求的数据到达(只算连接上的第一个请求)
+		QUEUE,	// 数据到达 -> 开始解析(等线程池)
+		PARSE,	// 解析请求
+		HANDLE, // 解析完 -> 生成响应(查数据库、找文件)
+		WRITE,	// 生成响应 -> 发送完
+		TOTAL,	// 数据到达 -> 发送完
+		PHASE_COUNT
+	};
+
+	static const int MAX_ROUTES = 16; // 最后一个是other，不在路由表里的路径都算到这里
+
+	static LatencyStats *Instance();
+
+	// 按请求路径找路由，结果可以缓存下来
+	int RouteOf(const std::string &path) const;
+
+	// 单位us，只在请求所在的线程调用
+	void Record(int route, Phase phase, uint64_t us);
+
+	// 合并所有线程后的分位数，没有数据返回0
+	uint64_t Quantile(int route, Phase phase, double q);
+
+	// 追加Prometheus summary格式的文本
+	void AppendMetrics(std::string &out);
+
+private:
+	struct ThreadHists
+	{
+		std::atomic<HdrHistogram *> hists[MAX_ROUTES][PHASE_COUNT];
+		ThreadHists();
+		~ThreadHists();
+	};
+
+	LatencyStats();
+
+	ThreadHists *Local_();
+	void Retire_(ThreadHists *local);
+	// 把route/phase所有线程的直方图(加上退出线程的)合并到snapshot，调用者持有mtx_
+	void Merge_(int route, int phase, HdrHistogram::Snapshot &snapshot);
+
+	friend struct LatencyHolder;
+
+	std::vector<std::string> routes_; // 路由表，最后一个是other
+
+	std::mutex mtx_;
+	std::vector<ThreadHists *> threads_;
+	std::unique_ptr<HdrHistogram::Snapshot> retired_[MAX_ROUTES][PHASE_COUNT];
+};
@@ -3,61 +3,134 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+#include <atomic>
+#include <condition_variable>
 #include <sys/time.h>
 #include <cstring>
 #include <cstdarg> // vastart va_end
 #include <cassert>
+#include <fcntl.h>	  // open
+#include <unistd.h>	  // close
+#include <sys/uio.h>  // writev
 #include <sys/stat.h> //mkdir
 
-#include "blockqueue.hpp"
-#include "buffer.h"
-
+#include "logbuffer.hpp"
+#include "logring.h"
+#include "clockservice.h"
+
+// 编译期的日志级别，低于这个级别的日志语句直接被编译掉，例如 -DLOG_COMPILE_LEVEL=1 去掉所有DEBUG日志
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+/*
+ * 日志：前端线程在锁外格式化好一行，加锁只做一次memcpy追加到当前缓冲区
+ * 异步模式下是双缓冲：当前缓冲区写满了换备用的，写满的排队；写线程每FLUSH_INTERVAL_MS(或者被flush()叫醒)
+ * 把所有写满的和当前的缓冲区一起换出来，在锁外用一次writev写进文件，写完的缓冲区留作备用
+ * 写线程来不及写、排队的缓冲区太多时丢掉多出来的，并在日志里记一笔
+ * 异步模式下LOG_*宏走Record()：只把格式串、时间戳和参数记进本线程的环(LogRing)，
+ * 写线程每DRAIN_INTERVAL_MS(或者某个环积压超过四分之一时被叫醒)把所有线程的环按时间戳归并，
+ * 在锁外格式化进自己的缓冲区，再加锁一次追加进当前缓冲区
+ */
 class Log
 {
 public:
 	void init(int level, const char *path = "./log",
 			  const char *suffix = ".log",
-			  int maxQueueCapacity = 1024);
+			  int bufferSizeKB = 1024, int writerCpu = -1);
 
 	static Log *Instance();
 	static void FlushLogThread();
 
 	void write(int level, const char *format, ...);
-	void flush();
-
-	int GetLevel();
-	void SetLevel(int level);
+	void flush(); // 异步模式下叫醒写线程马上写
+
+	// 延迟格式化：异步模式下只记录参数，格式化交给写线程；同步模式直接write
+	template <typename... Args>
+	void Record(int level, const char *format, const Args &...args)
+	{
+		if (!isAsync_)
+		{
+			write(level, format, args...);
+			return;
+		}
+		LogRing *ring = LogRing::ForThisThread();
+		size_t size = LogRing::RecordSize(args...);
+		char *dst = ring->Reserve(size);
+		if (!dst)
+		{
+			ring->Drop(); // 环满了，丢掉这一条，不阻塞
+			return;
+		}
+		LogRing::Encode(dst, size, level, format, ClockService::Instance()->ReadWallUs(), args...);
+		if (ring->Commit(size))
+		{
+			/* 环快满了，不等下一轮；不加锁通知，错过了也只是等到下一轮 */
+			drainNow_.store(true, std::memory_order_relaxed);
+			cond_.notify_one();
+		}
+		if (level >= 2)
+		{
+			flush(); // 警告和错误尽快落盘
+		}
+	}
+
+	int GetLevel() { return level_.load(std::memory_order_relaxed); }
+	void SetLevel(int level) { level_.store(level, std::memory_order_relaxed); }
 	bool IsOpen() { return isOpen_; }
 
 private:
+	typedef std::unique_ptr<LogBuffer> BufferPtr;
+
 	Log();
-	void AppendLogLevelTitle_(int level);
+	int AppendLogLevelTitle_(int level, char *buf);
 	virtual ~Log();
 	void AsyncWrite_();
+	void OpenFile_(const struct tm &t, int part); // 打开当天的日志文件，part>0表示当天的第几个分片
+	void RollFile_(size_t lines);				  // 跨天或者行数超过MAX_LINES时换文件
+	void WriteFile_(const std::vector<BufferPtr> &buffers);
+	void AppendLocked_(const char *line, size_t len, size_t lines = 1); // 追加到当前缓冲区，需要持有mtx_
+	bool DrainRings_();	  // 写线程把各线程环里的记录格式化进缓冲区，取到上限还没取完返回true
+	void MergeDrained_(); // 把写线程格式化好的行加锁追加进当前缓冲区
 
 private:
-	static const int LOG_PATH_LEN = 256; // 日志路径的最大长度
-	static const int LOG_NAME_LEN = 256; // 日志名称的最大长度
-	static const int MAX_LINES = 50000;
+	static const int LOG_PATH_LEN = 256;		// 日志路径的最大长度
+	static const int LOG_NAME_LEN = 256;		// 日志名称的最大长度
+	static const int LINE_LEN = 4096;			// 一行日志的最大长度，超出的部分截掉
+	static const int MAX_LINES = 50000;			// 一个日志文件最多的行数
+	static const int FLUSH_INTERVAL_MS = 1000;	// 写线程最长多久写一次
+	static const int DRAIN_INTERVAL_MS = 50;	// 写线程取各线程环里记录的间隔，积压多时会提前叫醒
+	static const size_t MAX_DRAIN_RECORDS = 65536; // 一轮最多取的记录数，避免一直取不去写文件
+	static const size_t MAX_PENDING_BUFFERS = 16; // 排队的缓冲区超过这个数就丢弃
 
 	const char *path_;
 	const char *suffix_;
 
-	int MAX_LINES_;
-
-	int lineCount_;
+	int lineCount_; // 当前文件的行数
 	int toDay_;
+	int part_; // 当天的第几个文件
 
 	bool isOpen_;
 
-	Buffer buff_;
-	int level_;
+	std::atomic<int> level_;
 	bool isAsync_;
-
-	FILE *fp_;
-	std::unique_ptr<BlockDeque<std::string>> deque_;
+	bool running_;
+	int writerCpu_; // 写线程绑定的CPU，-1表示不绑定
+	size_t bufferSize_;
+	size_t dropped_; // 丢弃的行数
+	std::atomic<bool> flushNow_;
+	std::atomic<bool> drainNow_;				  // 有环积压超过水位，写线程马上取
+	std::vector<std::shared_ptr<LogRing>> rings_; // 写线程用
+	BufferPtr drained_;							  // 写线程在锁外格式化环里记录用的缓冲区
+
+	int fd_;
+	BufferPtr current_;				// 前端正在写的缓冲区
+	BufferPtr next_;				// 备用缓冲区
+	std::vector<BufferPtr> buffers_; // 写满了等待写线程写的缓冲区
 	std::unique_ptr<std::thread> writeThread_;
 	std::mutex mtx_;
+	std::condition_variable cond_;
 };
 
 // level = 1
@@ -65,15 +138,17 @@ private:
 // LOG_INFO   1 <= 1  y
 // LOG_WARN   2 <= 1  n
 // LOG_ERROR  3 <= 1  n
-#define LOG_BASE(level, format, ...)                   \
-	do                                                 \
-	{                                                  \
-		Log *log = Log::Instance();                    \
-		if (log->IsOpen() && log->GetLevel() <= level) \
-		{                                              \
-			log->write(level, format, ##__VA_ARGS__);  \
-			log->flush();                              \
-		}                                              \
+#define LOG_BASE(level, format, ...)                       \
+	do                                                     \
+	{                                                      \
+		if (level >= LOG_COMPILE_LEVEL)                    \
+		{                                                  \
+			Log *log = Log::Instance();                    \
+			if (log->IsOpen() && log->GetLevel() <= level) \
+			{                                              \
+				log->Record(level, format, ##__VA_ARGS__); \
+			}                                              \
+		}                                                  \
 	} while (0);
 
 #define LOG_DEBUG(format, ...)             \
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstring>
+#include <cstddef>
+#include <memory>
+
+/*
+ * 日志缓冲区：一块预先分配好的大内存，前端线程把格式化好的日志行直接追加进来
+ * 写满(或者到了刷新时间)后整块交给写线程，写线程写完再重置，循环使用
+ */
+class LogBuffer
+{
+public:
+	explicit LogBuffer(size_t size) : data_(new char[size]), size_(size), len_(0), lines_(0) {}
+
+	LogBuffer(const LogBuffer &) = delete;
+	LogBuffer &operator=(const LogBuffer &) = delete;
+
+	// 调用者先用Avail()确认放得下；lines是这段数据的行数
+	void Append(const char *line, size_t len, size_t lines = 1)
+	{
+		memcpy(data_.get() + len_, line, len);
+		len_ += len;
+		lines_ += lines;
+	}
+
+	const char *Data() const { return data_.get(); }
+	size_t Length() const { return len_; }
+	size_t Avail() const { return size_ - len_; }
+	size_t Lines() const { return lines_; }
+
+	void Reset()
+	{
+		len_ = 0;
+		lines_ = 0;
+	}
+
+private:
+	std::unique_ptr<char[]> data_;
+	size_t size_;
+	size_t len_;   // 已经写入的字节数
+	size_t lines_; // 已经写入的行数，用于按行数切分文件
+};
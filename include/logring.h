@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+ * 延迟格式化的日志记录：前端线程只把格式串指针(字符串字面量，相当于静态id)、时间戳和原始参数
+ * 按二进制写进自己线程的环形缓冲区，不调用vsnprintf；写线程取出记录后再格式化成文本
+ * 每个线程一个单生产者单消费者的环，生产和消费都不加锁；环满了直接丢弃并计数，不阻塞业务线程
+ *
+ * 记录格式: [Header][参数1][参数2]...，每个参数是1字节类型+数据
+ * 整数统一存成64位，字符串把内容拷贝进来(参数可能是临时的缓冲区)
+ */
+class LogRing
+{
+public:
+	struct Header
+	{
+		uint32_t size; // 整条记录的大小(8字节对齐)，0表示环尾部剩下的空间被跳过
+		uint8_t level;
+		uint8_t argc;
+		uint16_t reserved;
+		const char *format;
+		int64_t wallUs;
+	};
+
+	enum ArgType : uint8_t
+	{
+		ARG_INT,
+		ARG_DOUBLE,
+		ARG_STRING,
+		ARG_POINTER
+	};
+
+	static const size_t RING_SIZE = 1 << 18;	// 每个线程的环的大小(256KB)，必须是2的幂
+	static const size_t MAX_STRING_LEN = 1024; // 字符串参数最多拷贝的长度
+
+	explicit LogRing(size_t size = RING_SIZE);
+	~LogRing();
+
+	LogRing(const LogRing &) = delete;
+	LogRing &operator=(const LogRing &) = delete;
+
+	// 当前线程的环，第一次调用时创建并登记，线程退出后写线程取完数据再回收
+	static LogRing *ForThisThread();
+
+	// 所有还活着或者还有数据的环(写线程调用)
+	static void Collect(std::vector<std::shared_ptr<LogRing>> &rings);
+
+	// 生产者：预留len字节(len已经8字节对齐)，空间不够返回nullptr
+	char *Reserve(size_t len);
+	// 返回true表示环里积压超过了四分之一，应该叫醒写线程；取空之前只返回一次
+	bool Commit(size_t len);
+	void Drop() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+
+	// 消费者：取最前面的一条记录，没有返回nullptr
+	const Header *Front();
+	void Pop();
+
+	size_t TakeDropped(); // 消费者：上次调用以来丢弃的记录数
+	bool IsDead() const { return dead_.load(std::memory_order_acquire); }
+	void MarkDead() { dead_.store(true, std::memory_order_release); }
+
+	// 把一条记录格式化成文本(不含时间和级别)，返回写入的长度
+	static size_t FormatArgs(const Header *record, char *out, size_t cap);
+
+	// 编码：先算出记录大小，再写进预留的空间
+	template <typename... Args>
+	static size_t RecordSize(const Args &...args)
+	{
+		size_t size = sizeof(Header);
+		((size += ArgSize_(args)), ...);
+		return (size + 7) & ~static_cast<size_t>(7);
+	}
+
+	template <typename... Args>
+	static void Encode(char *dst, size_t size, int level, const char *format, int64_t wallUs, const Args &...args)
+	{
+		Header header = {static_cast<uint32_t>(size), static_cast<uint8_t>(level), static_cast<uint8_t>(sizeof...(Args)), 0, format, wallUs};
+		memcpy(dst, &header, sizeof(Header));
+		[[maybe_unused]] char *p = dst + sizeof(Header); // 没有参数时用不到
+		(PutArg_(p, args), ...);
+	}
+
+private:
+	template <typename T>
+	static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type ArgSize_(const T &)
+	{
+		return 1 + sizeof(int64_t);
+	}
+	template <typename T>
+	static typename std::enable_if<std::is_floating_point<T>::value, size_t>::type ArgSize_(const T &)
+	{
+		return 1 + sizeof(double);
+	}
+	template <typename T>
+	static size_t ArgSize_(T *const &)
+	{
+		return 1 + sizeof(uint64_t);
+	}
+	static size_t ArgSize_(const char *const &s) { return 1 + sizeof(uint32_t) + StrLen_(s); }
+	static size_t ArgSize_(char *const &s) { return 1 + sizeof(uint32_t) + StrLen_(s); }
+	template <size_t N>
+	static size_t ArgSize_(const char (&s)[N]) { return 1 + sizeof(uint32_t) + StrLen_(s, N); }
+
+	template <typename T>
+	static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type PutArg_(char *&p, const T &v)
+	{
+		int64_t value = static_cast<int64_t>(v);
+		*p++ = ARG_INT;
+		memcpy(p, &value, sizeof(value));
+		p += sizeof(value);
+	}
+	template <typename T>
+	static typename std::enable_if<std::is_floating_point<T>::value>::type PutArg_(char *&p, const T &v)
+	{
+		double value = static_cast<double>(v);
+		*p++ = ARG_DOUBLE;
+		memcpy(p, &value, sizeof(value));
+		p += sizeof(value);
+	}
+	template <typename T>
+	static void PutArg_(char *&p, T *const &v)
+	{
+		uint64_t value = reinterpret_cast<uintptr_t>(v);
+		*p++ = ARG_POINTER;
+		memcpy(p, &value, sizeof(value));
+		p += sizeof(value);
+	}
+	static void PutArg_(char *&p, const char *const &s) { PutString_(p, s); }
+	static void PutArg_(char *&p, char *const &s) { PutString_(p, s); }
+	template <size_t N>
+	static void PutArg_(char *&p, const char (&s)[N]) { PutString_(p, s, N); }
+
+	// 字符数组按数组的长度限制，不会读出数组以外；不用strnlen，指向短字面量的指针会被编译器当成越界读
+	static size_t StrLen_(const char *s, size_t extent = MAX_STRING_LEN)
+	{
+		if (!s)
+		{
+			return 6; // "(null)"
+		}
+		size_t cap = extent < MAX_STRING_LEN ? extent : MAX_STRING_LEN;
+		size_t len = 0;
+		while (len < cap && s[len])
+		{
+			len++;
+		}
+		return len;
+	}
+	static void PutString_(char *&p, const char *s, size_t extent = MAX_STRING_LEN)
+	{
+		uint32_t len = static_cast<uint32_t>(StrLen_(s, extent));
+		*p++ = ARG_STRING;
+		memcpy(p, &len, sizeof(len));
+		p += sizeof(len);
+		memcpy(p, s ? s : "(null)", len);
+		p += len;
+	}
+
+	void Drained_(); // 消费者取空了，清掉wake_
+
+	char *buf_;
+	size_t mask_;
+	size_t reservedHead_; // 生产者预留时的写位置(可能跳过了环尾)
+
+	alignas(64) std::atomic<size_t> head_; // 生产者提交的位置，只增不减
+	size_t cachedTail_;					   // 生产者缓存的消费位置，不够时才重新读tail_
+	alignas(64) std::atomic<size_t> tail_; // 消费者的位置
+	std::atomic<size_t> dropped_;
+	size_t reportedDropped_; // 消费者已经报告过的丢弃数
+	std::atomic<bool> dead_; // 线程已经退出
+	std::atomic<bool> wake_; // 已经因为积压叫过写线程，消费者取空时清掉
+};
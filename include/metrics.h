@@ -0,0 +1,105 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+/*
+ * 指标注册表：计数器和直方图按线程分开计数，每个线程一块按缓存行对齐的槽位，
+ * 只有自己写(单写者，relaxed读加写，不用原子加)，线程之间没有共享的缓存行
+ * 抓取(/metrics)时才把所有线程的槽位加起来，输出Prometheus文本格式
+ * 线程退出时把它的值并进retired_，计数不会丢
+ *
+ * 指标在启动时注册(各模块的文件作用域静态变量，或者构造函数里)，注册返回的id在热点路径上使用
+ * 名字里可以带标签，例如 toy_lane_queued{lane="static"}，同名(大括号之前相同)的指标输出在一起
+ * 读取其他模块状态的指标用回调注册，抓取时调用，回调必须是线程安全的
+ */
+class Metrics
+{
+public:
+	enum Type
+	{
+		COUNTER,
+		GAUGE,
+		HISTOGRAM
+	};
+
+	static const int MAX_METRICS = 256;
+	static const int MAX_SLOTS = 1024; // 每个线程的槽位数(8KB)，直方图每个桶占一个槽位
+
+	static Metrics *Instance();
+
+	int AddCounter(const std::string &name, const char *help);
+	int AddGauge(const std::string &name, const char *help); // 用Set()设置的值，不分线程
+	// bounds是各个桶的上界(升序)，最后自动加一个+Inf的桶
+	int AddHistogram(const std::string &name, const char *help, const std::vector<double> &bounds);
+	// 抓取时调用fn取值，type是COUNTER或者GAUGE
+	int AddCallback(const std::string &name, const char *help, Type type, std::function<double()> fn);
+	// 自己输出整段文本的模块(比如分位数)，抓取时追加在最后
+	void AddCollector(std::function<void(std::string &out)> fn);
+
+	// 热点路径
+	void Add(int id, uint64_t delta = 1)
+	{
+		std::atomic<uint64_t> &slot = Local_()[descs_[id].slot];
+		slot.store(slot.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	void Observe(int id, double value);
+
+	void Set(int id, double value)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		descs_[id].value.store(bits, std::memory_order_relaxed);
+	}
+
+	// Prometheus文本格式(text/plain; version=0.0.4)
+	std::string Scrape();
+
+	// 常用的延迟桶(秒)，50us到1s
+	static std::vector<double> LatencyBuckets();
+
+private:
+	struct Desc
+	{
+		std::string family; // 大括号之前的名字
+		std::string labels; // 大括号里的内容，没有标签为空
+		const char *help;
+		Type type;
+		int slot;			   // 第一个槽位，直方图占bounds.size()+2个(各个桶、+Inf、总和)
+		std::vector<double> bounds;
+		std::function<double()> fn;
+		std::atomic<uint64_t> value; // AddGauge的值(double的位)
+	};
+
+	struct alignas(64) ThreadSlots
+	{
+		std::atomic<uint64_t> v[MAX_SLOTS];
+	};
+
+	Metrics();
+
+	int Register_(const std::string &name, const char *help, Type type, int slots,
+				  const std::vector<double> &bounds = {}, std::function<double()> fn = nullptr);
+	std::atomic<uint64_t> *Local_();
+	void Retire_(ThreadSlots *slots); // 线程退出时调用
+	void Sum_(std::vector<uint64_t> &counts, std::vector<double> &sums); // 调用者持有mtx_
+	static double ToDouble_(uint64_t bits);
+
+	friend struct MetricsHolder;
+
+	Desc descs_[MAX_METRICS];
+	std::atomic<int> count_;
+	int nextSlot_;
+
+	std::mutex mtx_;					 // 保护threads_、retired_和注册
+	std::vector<ThreadSlots *> threads_; // 活着的线程的槽位
+	std::vector<uint64_t> retired_;		 // 退出的线程的计数
+	std::vector<double> retiredSums_;	 // 退出的线程的直方图总和(按槽位)
+	std::vector<std::function<void(std::string &)>> collectors_;
+};
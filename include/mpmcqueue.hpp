@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+
+/*
+ * 有界无锁多生产者多消费者环形队列(Vyukov)
+ * 每个槽位带一个序号：序号等于入队位置表示可写，等于入队位置+1表示可读
+ * 生产者和消费者各自用CAS抢位置，抢到之后只操作自己的槽位，互不干扰
+ * 满了TryPush返回false，空了TryPop返回false，由调用者决定怎么处理
+ */
+template <class T>
+class MpmcQueue
+{
+public:
+	explicit MpmcQueue(size_t capacity) : enqueuePos_(0), dequeuePos_(0)
+	{
+		assert(capacity >= 2 && (capacity & (capacity - 1)) == 0); // 容量必须是2的幂
+		mask_ = capacity - 1;
+		cells_.reset(new Cell[capacity]);
+		for (size_t i = 0; i < capacity; i++)
+		{
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool TryPush(T &&item)
+	{
+		Cell *cell;
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			cell = &cells_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0)
+			{
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				/* 这个槽位上一轮的数据还没被取走，队列满了 */
+				return false;
+			}
+			else
+			{
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = std::move(item);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool TryPop(T &item)
+	{
+		Cell *cell;
+		size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			cell = &cells_[pos & mask_];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0)
+			{
+				if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				/* 队列为空 */
+				return false;
+			}
+			else
+			{
+				pos = dequeuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		item = std::move(cell->data);
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 近似值，只用于统计
+	size_t Size() const
+	{
+		size_t enq = enqueuePos_.load(std::memory_order_relaxed);
+		size_t deq = dequeuePos_.load(std::memory_order_relaxed);
+		return enq > deq ? enq - deq : 0;
+	}
+
+	size_t Capacity() const { return mask_ + 1; }
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	size_t mask_;
+	std::unique_ptr<Cell[]> cells_;
+	alignas(64) std::atomic<size_t> enqueuePos_; // 生产者和消费者的位置放在不同的缓存行
+	alignas(64) std::atomic<size_t> dequeuePos_;
+};
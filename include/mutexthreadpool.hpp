@@ -0,0 +1,78 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <thread>
+#include <functional>
+#include <cassert>
+#include <memory>
+
+// 单个互斥锁+条件变量的线程池(原ThreadPool)，保留下来作为基准测试的对照
+class MutexThreadPool
+{
+public:
+	explicit MutexThreadPool(size_t threadCount = 8) : pool_(std::make_shared<Pool>())
+	{ // explicit防止构造函数进行隐式类型转换
+		assert(threadCount > 0);
+
+		// 创建threadCount个子线程
+		for (size_t i = 0; i < threadCount; i++)
+		{
+			std::thread([pool = pool_]
+						{
+                    std::unique_lock<std::mutex> locker(pool->mtx);
+                    while(true) {
+                        if(!pool->tasks.empty()) {
+                            // 从任务队列中取第一个任务
+                            auto task = std::move(pool->tasks.front());
+                            // 移除掉队列中第一个元素
+                            pool->tasks.pop();
+                            locker.unlock();
+                            task();
+                            locker.lock();  // 这里是对工作队列加锁
+                        } 
+                        else if(pool->isClosed) break;
+                        else pool->cond.wait(locker);   // 如果队列为空，等待
+                    } })
+				.detach(); // 线程分离
+		}
+	}
+
+	MutexThreadPool() = default;
+
+	MutexThreadPool(MutexThreadPool &&) = default;
+
+	~MutexThreadPool()
+	{
+		if (static_cast<bool>(pool_))
+		{
+			{
+				std::lock_guard<std::mutex> locker(pool_->mtx);
+				pool_->isClosed = true;
+			}
+			pool_->cond.notify_all();
+		}
+	}
+
+	template <class F>
+	void AddTask(F &&task)
+	{
+		{
+			std::lock_guard<std::mutex> locker(pool_->mtx);
+			pool_->tasks.emplace(std::forward<F>(task));
+		}
+		pool_->cond.notify_one(); // 唤醒一个等待的线程
+	}
+
+private:
+	// 结构体
+	struct Pool
+	{
+		std::mutex mtx;							 // 互斥锁
+		std::condition_variable cond;			 // 条件变量
+		bool isClosed;							 // 是否关闭
+		std::queue<std::function<void()>> tasks; // 队列（保存的是任务）
+	};
+	std::shared_ptr<Pool> pool_; //  池子
+};
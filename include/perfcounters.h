@@ -0,0 +1,118 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * 硬件性能计数器：每个循环线程和工作线程用perf_event_open打开一组只统计自己(用户态)的计数器，
+ * 周期、指令、缓存未命中、分支预测失败，在请求处理(解析+验证+生成响应)和发送的前后各读一次，差值按阶段累加
+ * 抓取/metrics时汇总所有线程，输出各阶段的计数、IPC和每个请求的平均值
+ * 一组计数器一起调度，被复用(multiplex)时绝对数偏小，但比值(IPC、每条指令的未命中)仍然准确
+ * 默认关闭；内核不允许(kernel.perf_event_paranoid、容器的seccomp)或者硬件不支持时Init返回false，服务照常运行，
+ * 个别线程打不开时这个线程不统计
+ * 每次读是一个read系统调用(约1us)，只在需要时打开
+ */
+class PerfCounters
+{
+public:
+	enum Phase
+	{
+		PROCESS, // 解析、验证、生成响应
+		WRITE,	 // 发送响应
+		PHASE_COUNT
+	};
+
+	enum Event
+	{
+		CYCLES,
+		INSTRUCTIONS,
+		CACHE_MISSES,
+		BRANCH_MISSES,
+		EVENT_COUNT
+	};
+
+	struct Reading
+	{
+		uint64_t v[EVENT_COUNT];
+	};
+
+	static PerfCounters *Instance();
+
+	// 打开时先在当前线程试一次，不能用返回false，原因见Error()
+	bool Init(bool on);
+
+	bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	const std::string &Error() const { return error_; }
+
+	// 读当前线程的计数器，这个线程打不开计数器时返回false
+	bool Read(Reading &reading);
+
+	// 把当前线程begin到end之间的差值记到phase上
+	void Add(Phase phase, const Reading &begin, const Reading &end);
+
+	// 一个请求生成了响应，用来算每个请求的平均值
+	void CountRequest();
+
+private:
+	struct ThreadPerf
+	{
+		int fds[EVENT_COUNT]; // 第一个是组长(周期)，读组长一次读出整组，打不开时是-1
+		bool tried = false; // 打开过(不管成功与否)，失败的线程不再重试
+		/* 只有所属线程写，抓取时其他线程读 */
+		std::atomic<uint64_t> totals[PHASE_COUNT][EVENT_COUNT];
+		std::atomic<uint64_t> requests;
+		ThreadPerf();
+		void Close();
+	};
+
+	PerfCounters();
+
+	ThreadPerf *Local_();
+	static bool Open_(int *fds, std::string *error); // 打开当前线程的一组计数器
+	uint64_t Sum_(Phase phase, Event event);
+	uint64_t Requests_();
+	void RegisterMetrics_();
+
+	std::atomic<bool> enabled_;
+	std::string error_;
+
+	std::mutex mtx_;
+	std::vector<ThreadPerf *> threads_; // 线程退出时只关掉计数器，计数保留
+
+	friend struct PerfHolder;
+};
+
+// 作用域内的计数差值记到phase上，没开启时只是一次relaxed读
+class PerfScope
+{
+public:
+	explicit PerfScope(PerfCounters::Phase phase) : phase_(phase), active_(false)
+	{
+		PerfCounters *perf = PerfCounters::Instance();
+		if (perf->IsEnabled())
+		{
+			active_ = perf->Read(begin_);
+		}
+	}
+
+	~PerfScope()
+	{
+		PerfCounters::Reading end;
+		if (active_ && PerfCounters::Instance()->Read(end))
+		{
+			PerfCounters::Instance()->Add(phase_, begin_, end);
+		}
+	}
+
+	PerfScope(const PerfScope &) = delete;
+	PerfScope &operator=(const PerfScope &) = delete;
+
+private:
+	PerfCounters::Phase phase_;
+	bool active_;
+	PerfCounters::Reading begin_;
+};
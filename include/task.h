@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/*
+ * 定长、只能移动的任务类型，用来代替std::function<void()>
+ * 捕获的内容直接放在对象内部的存储区里，构造和移动都不会分配堆内存
+ * 编译期检查：捕获不能超过STORAGE_SIZE字节，并且必须是平凡可复制的(指针、整数等)
+ * 因此Task本身也是平凡可复制的，可以放进工作窃取队列按字节搬运
+ */
+class Task
+{
+public:
+	static const size_t STORAGE_SIZE = 48; // 加上函数指针正好一个缓存行
+
+	Task() : invoke_(nullptr) {}
+
+	Task(std::nullptr_t) : invoke_(nullptr) {}
+
+	template <class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+	Task(F &&f)
+	{
+		typedef typename std::decay<F>::type Fn;
+		static_assert(sizeof(Fn) <= STORAGE_SIZE, "Task: captures are too large, capture pointers instead");
+		static_assert(alignof(Fn) <= alignof(std::max_align_t), "Task: captures are over-aligned");
+		static_assert(std::is_trivially_copyable<Fn>::value && std::is_trivially_destructible<Fn>::value,
+					  "Task: captures must be trivially copyable (pointers, integers)");
+		::new (static_cast<void *>(storage_)) Fn(std::forward<F>(f));
+		invoke_ = &Invoke_<Fn>;
+	}
+
+	Task(Task &&) = default;
+	Task &operator=(Task &&) = default;
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	void operator()() { invoke_(storage_); }
+
+	explicit operator bool() const { return invoke_ != nullptr; }
+
+private:
+	template <class Fn>
+	static void Invoke_(void *storage)
+	{
+		(*static_cast<Fn *>(storage))();
+	}
+
+	void (*invoke_)(void *);
+	alignas(std::max_align_t) unsigned char storage_[STORAGE_SIZE];
+};
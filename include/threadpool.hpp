@@ -2,39 +2,47 @@
 
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <vector>
 #include <thread>
-#include <functional>
+#include <atomic>
+#include <random>
+#include <memory>
 #include <cassert>
+#include <algorithm>
 
+#include "workstealingdeque.hpp"
+#include "mpmcqueue.hpp"
+#include "affinity.h"
+#include "task.h"
+
+/*
+ * 工作窃取线程池
+ * 每个工作线程有一个无锁双端队列(只放本线程提交的任务)和一个收件箱(放其他线程提交的任务)
+ * 其他线程提交的任务轮流放进各个线程的收件箱，工作线程空闲时随机挑一个线程去窃取
+ * 没有任务时先自旋一会儿再休眠，有线程在自旋时提交任务不会去唤醒休眠的线程，避免频繁的futex调用
+ * 任务类型是定长的Task，提交和分发都不分配堆内存
+ * 指定queueCapacity时，其他线程提交的任务改为放进一个有界的无锁环形队列，满了AddTask返回false(背压)
+ * 指定cpus时第i个线程绑定到cpus[i]；每个线程绑定之后自己创建队列，内存落在本地NUMA节点上
+ * 指定maxThreads时可以用Resize()在运行中调整线程数：队列按上限预先建好，编号超出线程数的线程做完自己队列里的任务后退出，
+ * 退出以后队列里剩下的任务(比如调整前放进收件箱的)其他线程照常可以窃取
+ */
 class ThreadPool
 {
 public:
-	explicit ThreadPool(size_t threadCount = 8) : pool_(std::make_shared<Pool>())
+	// queueCapacity为0表示不限制排队的任务数，否则向上取整到2的幂；cpus为空表示不绑定；maxThreads为0表示线程数固定
+	explicit ThreadPool(size_t threadCount = 8, size_t queueCapacity = 0, const std::vector<int> &cpus = {}, size_t maxThreads = 0)
+		: pool_(std::make_shared<Pool>(threadCount, queueCapacity, cpus, maxThreads))
 	{ // explicit防止构造函数进行隐式类型转换
 		assert(threadCount > 0);
 
 		// 创建threadCount个子线程
 		for (size_t i = 0; i < threadCount; i++)
 		{
-			std::thread([pool = pool_]
-						{
-                    std::unique_lock<std::mutex> locker(pool->mtx);
-                    while(true) {
-                        if(!pool->tasks.empty()) {
-                            // 从任务队列中取第一个任务
-                            auto task = std::move(pool->tasks.front());
-                            // 移除掉队列中第一个元素
-                            pool->tasks.pop();
-                            locker.unlock();
-                            task();
-                            locker.lock();  // 这里是对工作队列加锁
-                        } 
-                        else if(pool->isClosed) break;
-                        else pool->cond.wait(locker);   // 如果队列为空，等待
-                    } })
+			std::thread([pool = pool_, i]
+						{ pool->Run(i, true); })
 				.detach(); // 线程分离
 		}
+		pool_->WaitReady(); // 所有线程都创建好自己的队列之后才能提交任务
 	}
 
 	ThreadPool() = default;
@@ -45,32 +53,402 @@ public:
 	{
 		if (static_cast<bool>(pool_))
 		{
-			{
-				std::lock_guard<std::mutex> locker(pool_->mtx);
-				pool_->isClosed = true;
-			}
-			pool_->cond.notify_all();
+			pool_->Close();
 		}
 	}
 
+	// 有界队列满了返回false，任务没有被提交，由调用者决定拒绝还是稍后重试
 	template <class F>
-	void AddTask(F &&task)
+	bool AddTask(F &&task)
+	{
+		return pool_->Submit(Task(std::forward<F>(task)));
+	}
+
+	// 还没有被取走的任务数
+	size_t QueueSize() const
+	{
+		return pool_->queued.load(std::memory_order_relaxed);
+	}
+
+	// 有界队列的容量，0表示不限制
+	size_t QueueCapacity() const
+	{
+		return pool_->bounded ? pool_->bounded->Capacity() : 0;
+	}
+
+	// 因为队列满被拒绝的任务数
+	size_t RejectedCount() const
+	{
+		return pool_->rejected.load(std::memory_order_relaxed);
+	}
+
+	size_t ThreadCount() const
 	{
+		return pool_->target.load(std::memory_order_relaxed);
+	}
+
+	size_t MaxThreads() const
+	{
+		return pool_->workers.size();
+	}
+
+	// 把线程数调整为count(限制在1到MaxThreads()之间)，返回调整后的线程数；不等多出来的线程退出
+	size_t Resize(size_t count)
+	{
+		Pool &p = *pool_;
+		count = std::max<size_t>(1, std::min(count, p.workers.size()));
+		std::lock_guard<std::mutex> locker(p.parkMtx);
+		p.target.store(count);
+		for (size_t i = 0; i < count; i++)
 		{
-			std::lock_guard<std::mutex> locker(pool_->mtx);
-			pool_->tasks.emplace(std::forward<F>(task));
+			/* 还没退出的线程看到新的线程数会继续工作，已经退出的重新创建 */
+			if (!p.running[i])
+			{
+				p.running[i] = true;
+				std::thread([pool = pool_, i]
+							{ pool->Run(i, false); })
+					.detach();
+			}
 		}
-		pool_->cond.notify_one(); // 唤醒一个等待的线程
+		p.parkCond.notify_all(); // 叫醒休眠的线程，编号超出的退出
+		return count;
 	}
 
 private:
-	// 结构体
+	static const int SPIN_COUNT = 64;			// 休眠之前自旋的次数
+	static const size_t LOCAL_CAPACITY = 1024;	// 每个线程无锁队列的容量
+	static const size_t INBOX_BATCH = 32;		// 一次从收件箱搬到无锁队列的任务数
+
+	// 收件箱：可以扩容的环形队列，容量够用之后不再分配内存
+	struct Inbox
+	{
+		Inbox() : ring(INBOX_BATCH), head(0), count(0) {}
+
+		bool empty() const { return count == 0; }
+
+		void push_back(Task task)
+		{
+			if (count == ring.size())
+			{
+				std::vector<Task> bigger(ring.size() * 2);
+				for (size_t i = 0; i < count; i++)
+				{
+					bigger[i] = std::move(ring[(head + i) % ring.size()]);
+				}
+				ring.swap(bigger);
+				head = 0;
+			}
+			ring[(head + count) % ring.size()] = std::move(task);
+			count++;
+		}
+
+		Task &front() { return ring[head]; }
+
+		void pop_front()
+		{
+			head = (head + 1) % ring.size();
+			count--;
+		}
+
+		std::vector<Task> ring;
+		size_t head;
+		size_t count;
+	};
+
+	struct Worker
+	{
+		explicit Worker(size_t capacity) : local(capacity) {}
+
+		WorkStealingDeque<Task> local; // 本线程提交的任务，其他线程可以窃取
+		alignas(64) std::mutex inboxMtx;
+		Inbox inbox; // 其他线程提交的任务
+	};
+
 	struct Pool
 	{
-		std::mutex mtx;							 // 互斥锁
-		std::condition_variable cond;			 // 条件变量
-		bool isClosed;							 // 是否关闭
-		std::queue<std::function<void()>> tasks; // 队列（保存的是任务）
+		Pool(size_t threadCount, size_t queueCapacity, const std::vector<int> &cpus, size_t maxThreads)
+			: workers(std::max(threadCount, maxThreads)), cpus(cpus), initial(threadCount), ready(0), nextInbox(0),
+			  target(threadCount), running(workers.size(), false), queued(0), rejected(0), spinning(0), sleepers(0), isClosed(false)
+		{
+			/* 之后才会启动的线程的队列在这里建好，工作线程窃取时不用判断队列是否存在 */
+			for (size_t i = threadCount; i < workers.size(); i++)
+			{
+				workers[i].reset(new Worker(LOCAL_CAPACITY));
+			}
+			std::fill(running.begin(), running.begin() + threadCount, true);
+			if (queueCapacity > 0)
+			{
+				size_t capacity = 2;
+				while (capacity < queueCapacity)
+				{
+					capacity <<= 1;
+				}
+				bounded.reset(new MpmcQueue<Task>(capacity));
+			}
+		}
+
+		// 在工作线程里绑定CPU，再创建自己的队列(first-touch)，然后等其他线程也准备好
+		void Start(size_t index)
+		{
+			if (!cpus.empty())
+			{
+				CpuAffinity::BindCurrentThread(cpus[index % cpus.size()]);
+			}
+			Worker *worker = new Worker(LOCAL_CAPACITY);
+			std::unique_lock<std::mutex> locker(parkMtx);
+			workers[index].reset(worker);
+			if (++ready == initial)
+			{
+				parkCond.notify_all();
+			}
+			while (ready < initial)
+			{
+				parkCond.wait(locker);
+			}
+		}
+
+		void WaitReady()
+		{
+			std::unique_lock<std::mutex> locker(parkMtx);
+			while (ready < initial)
+			{
+				parkCond.wait(locker);
+			}
+		}
+
+		// 当前线程所属的线程池和编号，不是工作线程时为nullptr
+		static Pool *&CurrentPool()
+		{
+			static thread_local Pool *pool = nullptr;
+			return pool;
+		}
+
+		static size_t &CurrentIndex()
+		{
+			static thread_local size_t index = 0;
+			return index;
+		}
+
+		bool Submit(Task task)
+		{
+			queued.fetch_add(1);
+			if (CurrentPool() == this && workers[CurrentIndex()]->local.Push(task))
+			{
+				/* 工作线程自己提交的任务放进自己的无锁队列 */
+				WakeOne();
+				return true;
+			}
+			if (bounded)
+			{
+				if (!bounded->TryPush(std::move(task)))
+				{
+					queued.fetch_sub(1);
+					rejected.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				WakeOne();
+				return true;
+			}
+			Worker &worker = *workers[nextInbox.fetch_add(1, std::memory_order_relaxed) % target.load(std::memory_order_relaxed)];
+			{
+				std::lock_guard<std::mutex> locker(worker.inboxMtx);
+				worker.inbox.push_back(std::move(task));
+			}
+			WakeOne();
+			return true;
+		}
+
+		// 有线程在自旋时它会拿到新任务，只有全部在休眠时才唤醒一个
+		void WakeOne()
+		{
+			if (spinning.load() == 0 && sleepers.load() > 0)
+			{
+				std::lock_guard<std::mutex> locker(parkMtx);
+				parkCond.notify_one();
+			}
+		}
+
+		bool TakeTask(size_t index, Task &task, std::minstd_rand &rng)
+		{
+			Worker &self = *workers[index];
+			bool found = self.local.Pop(task);
+			if (!found && bounded)
+			{
+				/* 有界模式下不使用收件箱 */
+				found = bounded->TryPop(task);
+			}
+			else if (!found)
+			{
+				/* 收件箱：取一个，再搬一批到无锁队列里让其他线程也能窃取 */
+				std::lock_guard<std::mutex> locker(self.inboxMtx);
+				if (!self.inbox.empty())
+				{
+					task = std::move(self.inbox.front());
+					self.inbox.pop_front();
+					found = true;
+					for (size_t i = 0; i < INBOX_BATCH && !self.inbox.empty(); i++)
+					{
+						if (!self.local.Push(self.inbox.front()))
+						{
+							break;
+						}
+						self.inbox.pop_front();
+					}
+				}
+			}
+			size_t n = workers.size();
+			size_t start = rng() % n;
+			for (size_t i = 0; !found && i < n; i++)
+			{
+				size_t victim = (start + i) % n;
+				found = victim != index && workers[victim]->local.Steal(task);
+			}
+			for (size_t i = 0; !found && i < n; i++)
+			{
+				/* 被阻塞的线程收件箱里的任务也要能被拿走 */
+				size_t victim = (start + i) % n;
+				if (victim == index)
+				{
+					continue;
+				}
+				Worker &other = *workers[victim];
+				std::unique_lock<std::mutex> locker(other.inboxMtx, std::try_to_lock);
+				if (locker.owns_lock() && !other.inbox.empty())
+				{
+					task = std::move(other.inbox.front());
+					other.inbox.pop_front();
+					found = true;
+				}
+			}
+			if (found)
+			{
+				queued.fetch_sub(1);
+			}
+			return found;
+		}
+
+		// 休眠直到有任务(或者这个线程该退出了)，线程池关闭且没有任务时返回false
+		bool Park(size_t index)
+		{
+			std::unique_lock<std::mutex> locker(parkMtx);
+			sleepers.fetch_add(1);
+			while (queued.load() == 0 && !isClosed && index < target.load())
+			{
+				parkCond.wait(locker);
+			}
+			sleepers.fetch_sub(1);
+			return queued.load() > 0 || !isClosed;
+		}
+
+		// 线程数调小以后编号超出的线程：做完自己队列里剩下的任务再退出，期间线程数又调大了就返回false继续工作
+		bool Retire(size_t index)
+		{
+			Worker &self = *workers[index];
+			Task task;
+			while (true)
+			{
+				bool found = self.local.Pop(task);
+				if (!found)
+				{
+					std::lock_guard<std::mutex> locker(self.inboxMtx);
+					if (!self.inbox.empty())
+					{
+						task = std::move(self.inbox.front());
+						self.inbox.pop_front();
+						found = true;
+					}
+				}
+				if (!found)
+				{
+					break;
+				}
+				queued.fetch_sub(1);
+				task();
+			}
+			std::lock_guard<std::mutex> locker(parkMtx);
+			if (index < target.load())
+			{
+				return false;
+			}
+			running[index] = false;
+			return true;
+		}
+
+		// first: 构造时创建的线程，要建自己的队列；Resize()加的线程用已经建好的队列
+		void Run(size_t index, bool first)
+		{
+			if (first)
+			{
+				Start(index);
+			}
+			else if (!cpus.empty())
+			{
+				CpuAffinity::BindCurrentThread(cpus[index % cpus.size()]);
+			}
+			CurrentPool() = this;
+			CurrentIndex() = index;
+			std::minstd_rand rng(static_cast<unsigned>(index) + 1);
+			Task task;
+			while (true)
+			{
+				if (index >= target.load(std::memory_order_relaxed) && Retire(index))
+				{
+					break;
+				}
+				bool found = TakeTask(index, task, rng);
+				if (!found)
+				{
+					/* 先自旋，再休眠 */
+					spinning.fetch_add(1);
+					for (int i = 0; i < SPIN_COUNT && !found; i++)
+					{
+						std::this_thread::yield();
+						found = TakeTask(index, task, rng);
+					}
+					spinning.fetch_sub(1);
+					if (found && queued.load() > 0)
+					{
+						WakeOne(); // 自旋的线程拿到了任务，如果还有任务就再叫醒一个
+					}
+				}
+				if (found)
+				{
+					task();
+				}
+				else if (!Park(index))
+				{
+					break;
+				}
+			}
+			CurrentPool() = nullptr;
+		}
+
+		void Close()
+		{
+			{
+				std::lock_guard<std::mutex> locker(parkMtx);
+				isClosed = true;
+			}
+			parkCond.notify_all();
+		}
+
+		std::vector<std::unique_ptr<Worker>> workers; // 按线程数上限分配，构造时的线程各自创建自己的
+		std::vector<int> cpus;						  // 每个线程绑定的CPU
+		size_t initial;								  // 构造时创建的线程数
+		size_t ready;								  // 已经创建好队列的线程数，由parkMtx保护
+		std::atomic<size_t> nextInbox; // 轮流选择收件箱
+		std::atomic<size_t> target;	   // 当前的线程数，编号不小于它的线程退出
+		std::vector<bool> running;	   // 每个编号是否有线程在运行，由parkMtx保护
+		std::unique_ptr<MpmcQueue<Task>> bounded; // 有界模式下代替收件箱
+
+		alignas(64) std::atomic<size_t> queued; // 还没被取走的任务数
+		std::atomic<size_t> rejected;			// 队列满被拒绝的任务数
+		alignas(64) std::atomic<int> spinning;	// 正在自旋找任务的线程数
+		std::atomic<int> sleepers;				// 正在休眠的线程数
+
+		std::mutex parkMtx;
+		std::condition_variable parkCond;
+		bool isClosed; // 是否关闭
 	};
 	std::shared_ptr<Pool> pool_; //  池子
 };
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "clockservice.h"
+#include "task.h"
+
+/*
+ * 分层时间轮(hashed hierarchical timing wheel)
+ * 第0层256个槽，第1~3层各64个槽，每个槽代表一个tick(默认1ms)，最远可表示2^26个tick
+ * 节点直接用id(fd)做下标，省掉了unordered_map的查找，add/cancel/adjust都是O(1)
+ * adjust只刷新到期时间，节点所在的槽到期时发现被刷新过，再惰性地重新挂到新的槽上
+ * 当前时间取自ClockService的缓存，由事件循环每轮更新
+ * 回调是定长的Task，存放在节点内部，添加定时器不分配堆内存
+ */
+class TimingWheel
+{
+public:
+	explicit TimingWheel(int tickMs = 1);
+
+	~TimingWheel() { clear(); }
+
+	void adjust(int id, int newExpires);
+
+	void add(int id, int timeOut, Task cb);
+
+	void cancel(int id);
+
+	void doWork(int id);
+
+	void clear();
+
+	void tick();
+
+	int GetNextTick();
+
+	size_t size() const { return count_; }
+
+private:
+	static const int TVR_BITS = 8;
+	static const int TVN_BITS = 6;
+	static const int TVR_SIZE = 1 << TVR_BITS;
+	static const int TVN_SIZE = 1 << TVN_BITS;
+	static const int TVR_MASK = TVR_SIZE - 1;
+	static const int TVN_MASK = TVN_SIZE - 1;
+	static const int LEVELS = 4;
+	static const int64_t MAX_TICKS = (1LL << (TVR_BITS + (LEVELS - 1) * TVN_BITS)) - 1;
+	static const int WORK_SLOT = TVR_SIZE + (LEVELS - 1) * TVN_SIZE; // 临时链表，处理到期槽和降级时使用
+	static const int NO_SLOT = -1;
+
+	struct WheelNode
+	{
+		int64_t expires = 0;   // 真正的到期tick，adjust只修改它
+		int64_t scheduled = 0; // 当前所在槽对应的到期tick
+		int prev = -1;
+		int next = -1;
+		int slot = NO_SLOT; // 所在的槽，NO_SLOT表示不在时间轮上
+		Task cb;
+	};
+
+	int64_t NowMs_() const;
+	int64_t ToTicks_(int timeout) const;
+
+	void Link_(int id);
+	void Unlink_(int id);
+	void MoveToWork_(int slot);
+	void Cascade_(int level);
+	void RunWork_(int64_t tick);
+	void Advance_(int64_t nowTick);
+
+	int tickMs_;
+	int64_t base_; // 下一个要处理的tick
+	size_t count_; // 时间轮上的节点数
+
+	std::vector<WheelNode> nodes_; // 以id(fd)为下标
+	std::vector<int> slots_;	   // 每个槽的链表头，-1表示空
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * 请求追踪：在读、排队、解析、查数据库、生成响应、发送这些阶段打时间段(span)，导出成Chrome trace JSON，
+ * 用Perfetto(ui.perfetto.dev)或chrome://tracing打开，可以看到一个请求在循环线程、工作线程之间的先后和排队的空档
+ * 按请求采样：请求开始时Sample()决定要不要追踪，返回的编号存在连接上，0表示不追踪
+ * 每个线程一个环形缓冲区，满了覆盖最旧的；记录一个span只是写一个槽位，不加锁
+ * 线程退出后缓冲区留给新线程复用，线程池伸缩不会让缓冲区越来越多
+ * 运行时用Enable()打开和关闭(默认关闭)，关闭时Sample()只是一次relaxed读
+ */
+class Tracer
+{
+public:
+	struct Event
+	{
+		int64_t startNs;
+		int64_t endNs;
+		const char *name; // 必须是字符串字面量
+		uint64_t id;	  // 请求编号
+	};
+
+	static const size_t RING_SIZE = 16384; // 每个线程保留最近的span数，必须是2的幂
+
+	// 一个线程的环形缓冲区
+	struct Ring
+	{
+		Event events[RING_SIZE];
+		std::atomic<uint64_t> head; // 写过的总数，只有所属线程写
+		int tid;
+		char name[32];
+	};
+
+	static Tracer *Instance();
+
+	// sampleRate: 打开以后追踪的请求比例
+	void Init(double sampleRate);
+	void Enable(bool on);
+	bool IsEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	// 请求开始时调用，返回请求编号，不追踪时返回0
+	uint64_t Sample();
+
+	void Record(const char *name, uint64_t id, int64_t startNs, int64_t endNs);
+
+	// 给当前线程起个名字，导出时显示在线程那一行
+	static void NameThread(const char *name);
+
+	// 当前线程正在追踪的请求(最外层的TraceSpan设置)，里面的span不用再传编号
+	static uint64_t CurrentId();
+
+	// 导出所有线程缓冲区里的span
+	std::string ExportJson();
+
+	void Clear();
+
+	static int64_t NowNs();
+
+private:
+	Tracer();
+
+	Ring *Local_();
+	void Retire_(Ring *ring); // 线程退出时把缓冲区放进空闲列表
+
+	friend class TraceSpan;
+	friend struct TraceHolder;
+
+	std::atomic<bool> enabled_;
+	std::atomic<uint64_t> nextId_;
+	std::atomic<int64_t> clearedAt_; // 大于0时，开始时间早于它的span不导出
+	double sampleRate_;
+
+	std::mutex mtx_;
+	std::vector<Ring *> rings_;		// 线程退出后也保留，导出时还能看到，直到被新线程复用
+	std::vector<Ring *> freeRings_; // 退出的线程留下的缓冲区，缓冲区总数不超过同时存活的线程数
+};
+
+/* 作用域内的一个span，id为0(不追踪的请求)时什么也不做；有id的span在作用域内成为当前线程的请求 */
+class TraceSpan
+{
+public:
+	TraceSpan(const char *name, uint64_t id) : name_(name), id_(id), prevId_(0), startNs_(0)
+	{
+		if (id_)
+		{
+			Begin_();
+		}
+	}
+
+	// 用当前线程正在追踪的请求
+	explicit TraceSpan(const char *name) : TraceSpan(name, Tracer::CurrentId()) {}
+
+	~TraceSpan()
+	{
+		if (id_)
+		{
+			End_();
+		}
+	}
+
+	bool IsActive() const { return id_ != 0; }
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+	void Begin_();
+	void End_();
+
+	const char *name_;
+	uint64_t id_;
+	uint64_t prevId_;
+	int64_t startNs_;
+};
@@ -9,13 +9,40 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-#include "epoller.h"
+#include "eventloop.h"
 #include "log.h"
-#include "heaptimer.h"
 #include "sqlconnpool.h"
-#include "threadpool.hpp"
+#include "lane.hpp"
 #include "sqlconnRAII.hpp"
 #include "httpconn.h"
+#include "affinity.h"
+#include "accesslog.h"
+#include "capture.h"
+#include "trace.h"
+#include "perfcounters.h"
+
+// 可选的配置，默认值都是关闭或者不限制；按名字赋值，不用数位置
+struct ServerOptions
+{
+	int taskQueSize = 0;			   // 线程池任务队列容量，0表示不限制
+	const char *cpuAffinity = "off";   // CPU绑定："off" "auto" 或 "0-3,6"
+	int dbThreadNum = 0;			   // 数据库通道的线程数，0表示不单独分开
+	int dbQueSize = 0;				   // 数据库通道的队列容量，0表示不限制
+	bool inlineStatic = false;		   // 命中缓存的静态请求在循环线程里处理
+	int memBudgetMB = 0;			   // 缓冲区内存预算，0表示不限制
+	int connBufferKB = 0;			   // 每个连接读缓冲区上限，0表示不限制
+	const char *accessLog = "off";	   // 访问日志："off" "json" "binary"
+	double accessSample = 1.0;		   // 正常请求记进访问日志的比例(错误和慢请求全记)
+	const char *metricsPath = "";	   // Prometheus指标的路径，""表示不提供
+	const char *capturePath = "";	   // 抓包文件，""表示不抓包
+	const char *tracePath = "";		   // 请求追踪的路径(只限本机)，""表示不提供
+	double traceSample = 0.01;		   // 打开追踪以后追踪的请求比例
+	int threadMax = 0;				   // 线程池的线程数上限，不大于线程数表示固定
+	int dbThreadMax = 0;			   // 数据库通道的线程数上限，不大于线程数表示固定
+	bool perfCounters = false;		   // 用perf_event_open统计每个请求的硬件事件
+	bool warmUp = false;			   // 启动时预热静态资源
+	bool hugePages = false;			   // 预热缓存的小文件放进大页
+};
 
 class WebServer
 {
@@ -24,7 +51,8 @@ public:
 		int port, int trigMode, int timeoutMS, bool OptLinger,
 		int sqlPort, const char *sqlUser, const char *sqlPwd,
 		const char *dbName, int connPoolNum, int threadNum,
-		bool openLog, int logLevel, int logQueSize);
+		bool openLog, int logLevel, int logBufferKB,
+		ServerOptions options = ServerOptions());
 
 	~WebServer();
 	void Start();
@@ -34,19 +62,43 @@ private:
 	void InitEventMode_(int trigMode);
 	void AddClient_(int fd, sockaddr_in addr);
 
+	void HandleEvent_(int fd, uint32_t events);
 	void DealListen_();
 	void DealWrite_(HttpConn *client);
 	void DealRead_(HttpConn *client);
 
 	void SendError_(int fd, const char *info);
+	void RejectBusy_(HttpConn *client);
+	void Reject_(HttpConn *client, const char *response, size_t len);
+	void Shed_(HttpConn *client); // 子线程中执行
+	void LogStats_();
+	void AdaptLanes_();
 	void ExtentTime_(HttpConn *client);
 	void CloseConn_(HttpConn *client);
+	void OnTimeout_(HttpConn *client);
+
+	void OnRead_(HttpConn *client);		 // 子线程中执行
+	void OnWrite_(HttpConn *client);	 // 子线程中执行
+	void OnProcess(HttpConn *client);	 // 子线程中执行
+	void OnDbProcess_(HttpConn *client); // 数据库通道的子线程中执行
+
+	void FinishTask_(HttpConn *client, uint32_t events); // 把子线程的结果交回循环线程
 
-	void OnRead_(HttpConn *client);	  // 子线程中执行
-	void OnWrite_(HttpConn *client);  // 子线程中执行
-	void OnProcess(HttpConn *client); // 子线程中执行
+	bool OverBudget_() const;			 // 缓冲区占用的内存是否超过了预算(高水位)
+	void WaitRead_(HttpConn *client);	 // 循环线程中执行，请求不完整，重新注册EPOLLIN或者暂停
+	void ResumePaused_();				 // 循环线程中执行，内存降到低水位以下后恢复暂停的连接
 
-	static const int MAX_FD = 65536; // 最大的文件描述符的个数
+	void ReadInline_(HttpConn *client);	   // 循环线程中执行
+	void ProcessInline_(HttpConn *client); // 循环线程中执行
+	void WriteInline_(HttpConn *client);   // 循环线程中执行
+
+	static const int MAX_FD = 65536;			// 最大的文件描述符的个数
+	static const int BUSY_RETRY_MS = 5;			// 线程池队列满时，写任务重新提交的间隔
+	static const int STATS_INTERVAL_MS = 10000; // 输出线程池统计日志的间隔
+	static const int BUDGET_CHECK_MS = 20;		// 检查能否恢复暂停的连接的间隔
+	static const int ADAPT_INTERVAL_MS = 1000;	// 调整通道线程数的间隔
+	static const int ACCESS_SLOW_MS = 100;		// 超过这个耗时的请求不受采样限制，都记进访问日志
+	static const int CAPTURE_MAX_MB = 1024;		// 抓包文件的大小上限
 
 	static int SetFdNonblock(int fd); // 设置文件描述符非阻塞
 
@@ -57,11 +109,18 @@ private:
 	int listenFd_;	  // 监听的文件描述符
 	char *srcDir_;	  // 资源的目录
 
+	bool inlineStatic_; // 命中缓存的静态请求直接在循环线程里处理
+
+	size_t memHighWater_;			 // 缓冲区内存预算，超过后拒绝新请求、暂停读，0表示不限制
+	size_t memLowWater_;			 // 降到这个值以下才恢复暂停的连接
+	size_t budgetRejected_;			 // 因为内存预算拒绝的请求数
+	std::vector<HttpConn *> paused_; // 暂停读的连接
+
 	uint32_t listenEvent_; // 监听的文件描述符的事件
 	uint32_t connEvent_;   // 连接的文件描述符的事件
 
-	std::unique_ptr<HeapTimer> timer_;		  // 定时器
-	std::unique_ptr<ThreadPool> threadpool_;  // 线程池
-	std::unique_ptr<Epoller> epoller_;		  // epoll对象
+	std::unique_ptr<Lane> staticLane_;		  // 读写和静态文件的执行通道
+	std::unique_ptr<Lane> dbLane_;			  // 登录、注册等访问数据库的执行通道，为空表示不单独分开
+	std::unique_ptr<EventLoop> loop_;		  // 事件循环(epoll对象和定时器)
 	std::unordered_map<int, HttpConn> users_; // 保存的是客户端连接的信息，通过文件描述符进行映射
 };
\ No newline at end of file
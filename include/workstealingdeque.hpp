@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <type_traits>
+
+/*
+ * Chase-Lev 无锁工作窃取双端队列(固定容量)
+ * 只有所属线程可以Push/Pop(LIFO，缓存友好)，其他线程只能从另一端Steal(FIFO)
+ * 元素必须是平凡可复制的：窃取者先复制再用CAS确认，失败时丢弃读到的副本
+ * 元素按字节搬运(memcpy)，只能移动的平凡类型(如Task)也可以放进来
+ */
+template <class T>
+class WorkStealingDeque
+{
+	static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque element must be trivially copyable");
+
+public:
+	explicit WorkStealingDeque(size_t capacity = 1024) : top_(0), bottom_(0)
+	{
+		assert(capacity > 0 && (capacity & (capacity - 1)) == 0); // 容量必须是2的幂
+		mask_ = capacity - 1;
+		buffer_.reset(new T[capacity]);
+	}
+
+	// 只能由所属线程调用，满了返回false
+	bool Push(const T &item)
+	{
+		int64_t b = bottom_.load(std::memory_order_relaxed);
+		int64_t t = top_.load(std::memory_order_acquire);
+		if (b - t > static_cast<int64_t>(mask_))
+		{
+			return false;
+		}
+		std::memcpy(&buffer_[b & mask_], &item, sizeof(T));
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom_.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// 只能由所属线程调用，从bottom端取
+	bool Pop(T &item)
+	{
+		int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+		bottom_.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top_.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			/* 队列为空 */
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+		std::memcpy(&item, &buffer_[b & mask_], sizeof(T));
+		if (t == b)
+		{
+			/* 最后一个元素，和窃取者竞争 */
+			bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	// 任意线程调用，从top端取
+	bool Steal(T &item)
+	{
+		int64_t t = top_.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom_.load(std::memory_order_acquire);
+		if (t >= b)
+		{
+			return false;
+		}
+		std::memcpy(&item, &buffer_[t & mask_], sizeof(T));
+		return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	size_t Size() const
+	{
+		int64_t b = bottom_.load(std::memory_order_relaxed);
+		int64_t t = top_.load(std::memory_order_relaxed);
+		return b > t ? static_cast<size_t>(b - t) : 0;
+	}
+
+	bool Empty() const { return Size() == 0; }
+
+private:
+	alignas(64) std::atomic<int64_t> top_;	  // 窃取端
+	alignas(64) std::atomic<int64_t> bottom_; // 所属线程端
+	size_t mask_;
+	std::unique_ptr<T[]> buffer_;
+};
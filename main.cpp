@@ -6,10 +6,31 @@ int main()
 	/* 守护进程 后台运行 */
 	// daemon(1, 0);
 
+	ServerOptions options;
+	options.taskQueSize = 4096;		  /* 线程池任务队列容量(0表示不限制) */
+	options.cpuAffinity = "off";	  /* CPU绑定("off" "auto" 或 "0-3,6") */
+	options.dbThreadNum = 4;		  /* 数据库通道的线程数(0表示不单独分开) */
+	options.dbQueSize = 256;		  /* 数据库通道的队列容量 */
+	options.inlineStatic = true;	  /* 命中缓存的静态请求在循环线程里处理 */
+	options.memBudgetMB = 256;		  /* 缓冲区内存预算MB */
+	options.connBufferKB = 64;		  /* 每个连接读缓冲区上限KB(0表示不限制) */
+	options.accessLog = "json";		  /* 访问日志("off" "json" "binary") */
+	options.accessSample = 0.01;	  /* 正常请求的采样率(错误和慢请求全记) */
+	options.metricsPath = "/metrics"; /* Prometheus指标的路径(""表示不提供) */
+	options.capturePath = "";		  /* 抓包文件(""表示不抓包，用bench/replay重放) */
+	options.tracePath = "/trace";	  /* 请求追踪的路径(只限本机，POST /trace/on打开，导出给Perfetto看) */
+	options.traceSample = 0.01;		  /* 追踪的请求比例 */
+	options.threadMax = 16;			  /* 线程池的线程数上限(按排队时间在线程数和上限之间自动调整，不大于线程数表示固定) */
+	options.dbThreadMax = 12;		  /* 数据库通道的线程数上限(不超过连接池数量) */
+	options.perfCounters = false;	  /* 用perf_event_open统计每个请求的周期、指令、缓存和分支未命中(没有权限时自动关闭) */
+	options.warmUp = true;			  /* 启动时预热静态资源 */
+	options.hugePages = true;		  /* 缓存的小文件放进大页 */
+
 	WebServer server(
 		1316, 3, 60000, false,				 /* 端口 ET模式 timeoutMs 优雅退出  */
 		3306, "root", "yanzengyi123", "toy", /* Mysql配置 */
-		12, 6, true, 1, 1024);				 /* 连接池数量 线程池的线程数量 日志开关 日志等级 日志异步队列容量 */
+		12, 6, true, 1, 1024,				 /* 连接池数量 线程池的线程数量 日志开关 日志等级 日志缓冲区大小KB(0表示同步写) */
+		options);
 
 	// 启动服务器
 	server.Start();
@@ -0,0 +1,350 @@
+#include "accesslog.h"
+#include "clockservice.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+const int AccessLog::FLUSH_INTERVAL_MS;
+const size_t AccessLog::MAX_PENDING_BUFFERS;
+
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int ACCESS_RECORDS = metrics->AddCounter("toy_access_log_records_total", "Access log records written");
+	const int ACCESS_DROPPED = metrics->AddCounter("toy_access_log_dropped_total", "Access log records dropped because the writer fell behind");
+
+	const size_t JSON_LINE_LEN = 512; // 一条记录转成JSON的最大长度(路径最多84字节，转义后也放得下)
+
+	// 路径里的引号、反斜杠和控制字符要转义
+	size_t EscapeJson(const char *src, size_t srcLen, char *out, size_t cap)
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < srcLen && src[i] && n + 7 < cap; i++)
+		{
+			unsigned char c = static_cast<unsigned char>(src[i]);
+			if (c == '"' || c == '\\')
+			{
+				out[n++] = '\\';
+				out[n++] = c;
+			}
+			else if (c < 0x20)
+			{
+				n += snprintf(out + n, cap - n, "\\u%04x", c);
+			}
+			else
+			{
+				out[n++] = c;
+			}
+		}
+		return n;
+	}
+}
+
+AccessLog::AccessLog()
+{
+	format_ = OFF;
+	sampleRate_ = 1.0;
+	slowUs_ = 0;
+	bufferSize_ = 0;
+	path_ = nullptr;
+	fd_ = -1;
+	toDay_ = 0;
+	running_ = false;
+	dropped_ = 0;
+}
+
+AccessLog::~AccessLog()
+{
+	if (writeThread_ && writeThread_->joinable())
+	{
+		{
+			lock_guard<mutex> locker(mtx_);
+			running_ = false;
+		}
+		cond_.notify_one();
+		writeThread_->join(); // 退出前把剩下的记录写完
+	}
+	if (fd_ >= 0)
+	{
+		close(fd_);
+	}
+}
+
+AccessLog *AccessLog::Instance()
+{
+	static AccessLog inst;
+	return &inst;
+}
+
+bool AccessLog::Init(const char *format, const char *path, double sampleRate, int slowMs, int bufferKB)
+{
+	if (!format || strcmp(format, "off") == 0)
+	{
+		format_ = OFF;
+		return true;
+	}
+	if (strcmp(format, "json") == 0)
+	{
+		format_ = JSON;
+	}
+	else if (strcmp(format, "binary") == 0)
+	{
+		format_ = BINARY;
+	}
+	else
+	{
+		format_ = OFF;
+		return false;
+	}
+	if (writeThread_)
+	{
+		return true; // 只初始化一次
+	}
+	path_ = path;
+	sampleRate_ = sampleRate;
+	slowUs_ = static_cast<int64_t>(slowMs) * 1000;
+	bufferSize_ = static_cast<size_t>(bufferKB > 0 ? bufferKB : 256) << 10;
+	OpenFile_();
+
+	current_.reset(new LogBuffer(bufferSize_));
+	next_.reset(new LogBuffer(bufferSize_));
+	buffers_.reserve(MAX_PENDING_BUFFERS);
+	running_ = true;
+	writeThread_.reset(new thread([this]
+								  { WriteLoop_(); }));
+	return true;
+}
+
+bool AccessLog::ShouldLog(int status, int64_t totalUs)
+{
+	if (format_ == OFF)
+	{
+		return false;
+	}
+	if (status >= 400 || totalUs >= slowUs_)
+	{
+		return true; // 错误和慢请求全部记录
+	}
+	/* 每个线程累加采样率，攒够1记一条：不用随机数，1%就是每100个正常请求记一个 */
+	thread_local double credit = 1.0;
+	credit += sampleRate_;
+	if (credit >= 1.0)
+	{
+		credit -= 1.0;
+		return true;
+	}
+	return false;
+}
+
+void AccessLog::Append(const AccessRecord &record)
+{
+	lock_guard<mutex> locker(mtx_);
+	if (current_->Avail() < sizeof(record))
+	{
+		/* 当前缓冲区满了，排队等写线程，换上备用的 */
+		if (buffers_.size() >= MAX_PENDING_BUFFERS)
+		{
+			dropped_.fetch_add(1, memory_order_relaxed); // 写线程跟不上，丢掉新的记录
+			return;
+		}
+		buffers_.push_back(move(current_));
+		current_ = next_ ? move(next_) : BufferPtr(new LogBuffer(bufferSize_));
+		cond_.notify_one();
+	}
+	current_->Append(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+size_t AccessLog::FormatJson(const AccessRecord &r, char *out, size_t cap)
+{
+	char time[ClockService::LOG_TIME_LEN + 1];
+	ClockService::Instance()->FormatLogTimeAt(r.wallUs, time, sizeof(time), nullptr);
+	time[ClockService::LOG_TIME_LEN - 1] = '\0'; // 去掉末尾的空格
+
+	char ip[INET_ADDRSTRLEN];
+	struct in_addr addr;
+	addr.s_addr = r.ip;
+	inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+
+	char path[sizeof(r.path) * 6 + 1];
+	char method[sizeof(r.method) * 6 + 1];
+	path[EscapeJson(r.path, sizeof(r.path), path, sizeof(path))] = '\0';
+	method[EscapeJson(r.method, sizeof(r.method), method, sizeof(method))] = '\0';
+
+	uint64_t total = static_cast<uint64_t>(r.queueUs) + r.parseUs + r.handleUs + r.writeUs;
+	int n = snprintf(out, cap,
+					 "{\"time\":\"%s\",\"ip\":\"%s\",\"port\":%u,\"method\":\"%s\",\"path\":\"%s\",\"status\":%u,\"bytes\":%u,"
+					 "\"queue_us\":%u,\"parse_us\":%u,\"handle_us\":%u,\"write_us\":%u,\"total_us\":%llu}\n",
+					 time, ip, r.port, method, path, r.status, r.bytes,
+					 r.queueUs, r.parseUs, r.handleUs, r.writeUs, static_cast<unsigned long long>(total));
+	if (n < 0)
+	{
+		return 0;
+	}
+	return static_cast<size_t>(n) < cap ? n : cap - 1;
+}
+
+void AccessLog::OpenFile_()
+{
+	time_t timer = time(nullptr);
+	struct tm t;
+	localtime_r(&timer, &t);
+	if (fd_ >= 0 && t.tm_mday == toDay_)
+	{
+		return;
+	}
+	toDay_ = t.tm_mday;
+	char fileName[256];
+	snprintf(fileName, sizeof(fileName), "%s/access_%04d_%02d_%02d%s", path_,
+			 t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, format_ == JSON ? ".jsonl" : ".bin");
+	if (fd_ >= 0)
+	{
+		close(fd_);
+	}
+	fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd_ < 0)
+	{
+		mkdir(path_, 0777);
+		fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	}
+	if (fd_ < 0)
+	{
+		perror("open access log");
+	}
+}
+
+// JSON格式先在写线程里转换成文本，然后和二进制格式一样一次writev写出
+void AccessLog::WriteBuffers_(const vector<BufferPtr> &buffers)
+{
+	OpenFile_();
+	if (fd_ < 0)
+	{
+		return;
+	}
+	vector<char> text;
+	struct iovec iov[MAX_PENDING_BUFFERS + 1];
+	int cnt = 0;
+	for (const BufferPtr &buffer : buffers)
+	{
+		if (buffer->Length() == 0 || cnt >= static_cast<int>(MAX_PENDING_BUFFERS + 1))
+		{
+			continue;
+		}
+		metrics->Add(ACCESS_RECORDS, buffer->Length() / sizeof(AccessRecord));
+		if (format_ == BINARY)
+		{
+			iov[cnt].iov_base = const_cast<char *>(buffer->Data());
+			iov[cnt].iov_len = buffer->Length();
+			cnt++;
+			continue;
+		}
+		size_t records = buffer->Length() / sizeof(AccessRecord);
+		size_t old = text.size();
+		text.resize(old + records * JSON_LINE_LEN);
+		size_t n = old;
+		for (size_t i = 0; i < records; i++)
+		{
+			AccessRecord record;
+			memcpy(&record, buffer->Data() + i * sizeof(AccessRecord), sizeof(record));
+			n += FormatJson(record, text.data() + n, JSON_LINE_LEN);
+		}
+		text.resize(n);
+	}
+	if (format_ == JSON && !text.empty())
+	{
+		iov[cnt].iov_base = text.data();
+		iov[cnt].iov_len = text.size();
+		cnt++;
+	}
+
+	struct iovec *cur = iov;
+	while (cnt > 0)
+	{
+		ssize_t len = writev(fd_, cur, cnt);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("write access log");
+			return;
+		}
+		while (cnt > 0 && static_cast<size_t>(len) >= cur->iov_len)
+		{
+			len -= cur->iov_len;
+			cur++;
+			cnt--;
+		}
+		if (cnt > 0)
+		{
+			cur->iov_base = static_cast<char *>(cur->iov_base) + len;
+			cur->iov_len -= len;
+		}
+	}
+}
+
+void AccessLog::WriteLoop_()
+{
+	BufferPtr spare1(new LogBuffer(bufferSize_));
+	BufferPtr spare2(new LogBuffer(bufferSize_));
+	vector<BufferPtr> toWrite;
+	toWrite.reserve(MAX_PENDING_BUFFERS + 1);
+	bool running = true;
+	while (running)
+	{
+		{
+			/* 有缓冲区写满了才提前叫醒，否则每隔一段时间批量写一次 */
+			unique_lock<mutex> locker(mtx_);
+			if (buffers_.empty() && running_)
+			{
+				cond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS));
+			}
+			running = running_;
+			if (buffers_.empty() && current_->Length() == 0)
+			{
+				continue;
+			}
+			buffers_.push_back(move(current_));
+			current_ = move(spare1);
+			toWrite.swap(buffers_);
+			if (!next_)
+			{
+				next_ = move(spare2);
+			}
+		}
+
+		WriteBuffers_(toWrite);
+		size_t dropped = dropped_.exchange(0, memory_order_relaxed);
+		if (dropped > 0)
+		{
+			metrics->Add(ACCESS_DROPPED, dropped);
+			LOG_WARN("Access log buffers full, dropped %zu records", dropped);
+		}
+
+		/* 写完的缓冲区留两个当备用，多的释放 */
+		if (!spare1)
+		{
+			spare1 = move(toWrite.back());
+			toWrite.pop_back();
+			spare1->Reset();
+		}
+		if (!spare2 && !toWrite.empty())
+		{
+			spare2 = move(toWrite.back());
+			toWrite.pop_back();
+			spare2->Reset();
+		}
+		toWrite.clear();
+	}
+}
@@ -0,0 +1,228 @@
+#include "affinity.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <dirent.h>
+
+using namespace std;
+
+CpuAffinity *CpuAffinity::Instance()
+{
+	static CpuAffinity affinity;
+	return &affinity;
+}
+
+bool CpuAffinity::Init(const char *spec)
+{
+	cpus_.clear();
+	next_ = 0;
+	if (!spec || spec[0] == '\0' || strcmp(spec, "off") == 0)
+	{
+		return true;
+	}
+
+	/* 只使用进程允许运行的CPU(容器、taskset会限制) */
+	vector<int> allowed;
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+	{
+		return false;
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, &mask))
+		{
+			allowed.push_back(cpu);
+		}
+	}
+
+	if (strcmp(spec, "auto") == 0)
+	{
+		AutoPlan_(allowed);
+	}
+	else
+	{
+		vector<int> list;
+		if (!ParseList_(spec, list))
+		{
+			return false;
+		}
+		for (int cpu : list)
+		{
+			if (find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+			{
+				cpus_.push_back(cpu);
+			}
+		}
+	}
+	return !cpus_.empty();
+}
+
+int CpuAffinity::NextCpu()
+{
+	if (cpus_.empty())
+	{
+		return -1;
+	}
+	return cpus_[next_.fetch_add(1) % cpus_.size()];
+}
+
+bool CpuAffinity::BindCurrentThread(int cpu)
+{
+	if (cpu < 0)
+	{
+		return false;
+	}
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+}
+
+int CpuAffinity::NodeOfCpu(int cpu)
+{
+	// /sys/devices/system/cpu/cpuN/下有一个nodeX的链接
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	DIR *dir = opendir(path);
+	if (!dir)
+	{
+		return 0;
+	}
+	int node = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+		{
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+}
+
+string CpuAffinity::Describe() const
+{
+	if (cpus_.empty())
+	{
+		return "off";
+	}
+	string desc;
+	for (size_t i = 0; i < cpus_.size(); i++)
+	{
+		desc += (i ? "," : "") + to_string(cpus_[i]);
+	}
+	return desc;
+}
+
+// 解析"0-3,8"这样的CPU列表
+bool CpuAffinity::ParseList_(const char *list, vector<int> &cpus)
+{
+	const char *p = list;
+	while (*p)
+	{
+		char *end;
+		long first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+		{
+			return false;
+		}
+		long last = first;
+		p = end;
+		if (*p == '-')
+		{
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+			{
+				return false;
+			}
+			p = end;
+		}
+		for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+		{
+			cpus.push_back(static_cast<int>(cpu));
+		}
+		if (*p == ',')
+		{
+			p++;
+		}
+		else if (*p != '\0')
+		{
+			return false;
+		}
+	}
+	return !cpus.empty();
+}
+
+int CpuAffinity::ReadInt_(const char *path, int defaultValue)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+	{
+		return defaultValue;
+	}
+	int value = defaultValue;
+	if (fscanf(fp, "%d", &value) != 1)
+	{
+		value = defaultValue;
+	}
+	fclose(fp);
+	return value;
+}
+
+// 每个物理核先取一个逻辑CPU，同一节点的排在一起；SMT兄弟线程排在最后，线程比物理核多时才会用到
+void CpuAffinity::AutoPlan_(const vector<int> &allowed)
+{
+	struct CpuInfo
+	{
+		int node, package, core, cpu;
+		bool sibling;
+	};
+	vector<CpuInfo> infos;
+	char path[128];
+	for (int cpu : allowed)
+	{
+		CpuInfo info;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		info.package = ReadInt_(path, 0);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+		info.core = ReadInt_(path, cpu); // 读不到拓扑时把每个CPU当作一个物理核
+		info.node = NodeOfCpu(cpu);
+		info.cpu = cpu;
+		info.sibling = false;
+		for (const CpuInfo &other : infos)
+		{
+			if (other.package == info.package && other.core == info.core)
+			{
+				info.sibling = true;
+				break;
+			}
+		}
+		infos.push_back(info);
+	}
+	sort(infos.begin(), infos.end(), [](const CpuInfo &a, const CpuInfo &b)
+		 {
+		if (a.sibling != b.sibling)
+		{
+			return !a.sibling;
+		}
+		if (a.node != b.node)
+		{
+			return a.node < b.node;
+		}
+		if (a.package != b.package)
+		{
+			return a.package < b.package;
+		}
+		return a.core != b.core ? a.core < b.core : a.cpu < b.cpu; });
+	for (const CpuInfo &info : infos)
+	{
+		cpus_.push_back(info.cpu);
+	}
+}
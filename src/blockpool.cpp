@@ -0,0 +1,157 @@
+#include "blockpool.h"
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+const size_t BlockPool::BLOCK_SIZE;
+const size_t BlockPool::MAX_CACHED_BLOCKS;
+const size_t BlockPool::MAX_SHARED_BLOCKS;
+const size_t BlockPool::TRANSFER_BATCH;
+
+namespace
+{
+	std::atomic<size_t> inUseBytes(0);
+
+	// 所有线程共享的空闲块，线程本地的空闲块多了放过来，不够了从这里批量取
+	// 用new出来的对象并且不释放：进程退出时分离的工作线程可能还在使用
+	std::mutex &SharedMutex()
+	{
+		static std::mutex *mtx = new std::mutex;
+		return *mtx;
+	}
+
+	std::vector<Block *> &SharedList()
+	{
+		static std::vector<Block *> *blocks = new std::vector<Block *>;
+		return *blocks;
+	}
+
+	// 把本地多出来的块放进共享池，共享池满了直接释放
+	void MoveToShared(std::vector<Block *> &local, size_t count)
+	{
+		std::lock_guard<std::mutex> locker(SharedMutex());
+		std::vector<Block *> &shared = SharedList();
+		for (size_t i = 0; i < count && !local.empty(); i++)
+		{
+			Block *block = local.back();
+			local.pop_back();
+			if (shared.size() < BlockPool::MAX_SHARED_BLOCKS)
+			{
+				shared.push_back(block);
+			}
+			else
+			{
+				::operator delete(block);
+			}
+		}
+	}
+
+	// 线程本地的空闲块。用指针而不是对象：线程退出时Reaper把空闲块还给共享池并置空，
+	// 之后才析构的缓冲区(比如单例里的)放回的块直接释放，不会访问已经析构的对象
+	thread_local std::vector<Block *> *freeBlocks = nullptr;
+	thread_local bool exited = false;
+
+	struct Reaper
+	{
+		~Reaper()
+		{
+			if (freeBlocks)
+			{
+				MoveToShared(*freeBlocks, freeBlocks->size());
+				delete freeBlocks;
+				freeBlocks = nullptr;
+			}
+			exited = true;
+		}
+	};
+	thread_local Reaper reaper;
+
+	std::vector<Block *> *LocalBlocks()
+	{
+		if (!freeBlocks && !exited)
+		{
+			(void)&reaper; // 第一次使用时才构造，线程退出时析构
+			freeBlocks = new std::vector<Block *>;
+			freeBlocks->reserve(BlockPool::MAX_CACHED_BLOCKS);
+		}
+		return freeBlocks;
+	}
+}
+
+Block *BlockPool::Alloc_(size_t capacity)
+{
+	Block *block = static_cast<Block *>(::operator new(sizeof(Block) + capacity));
+	block->capacity = capacity;
+	block->readPos = 0;
+	block->writePos = 0;
+	return block;
+}
+
+Block *BlockPool::Get(size_t capacity)
+{
+	inUseBytes.fetch_add(std::max(capacity, BLOCK_SIZE), std::memory_order_relaxed);
+	if (capacity <= BLOCK_SIZE)
+	{
+		std::vector<Block *> *local = LocalBlocks();
+		if (local && local->empty())
+		{
+			/* 本地没有了，从共享池批量取一些 */
+			std::lock_guard<std::mutex> locker(SharedMutex());
+			std::vector<Block *> &shared = SharedList();
+			for (size_t i = 0; i < TRANSFER_BATCH && !shared.empty(); i++)
+			{
+				local->push_back(shared.back());
+				shared.pop_back();
+			}
+		}
+		if (local && !local->empty())
+		{
+			Block *block = local->back();
+			local->pop_back();
+			block->readPos = 0;
+			block->writePos = 0;
+			return block;
+		}
+		capacity = BLOCK_SIZE;
+	}
+	return Alloc_(capacity);
+}
+
+void BlockPool::Put(Block *block)
+{
+	if (!block)
+	{
+		return;
+	}
+	inUseBytes.fetch_sub(block->capacity, std::memory_order_relaxed);
+	std::vector<Block *> *local = LocalBlocks();
+	if (block->capacity != BLOCK_SIZE || !local)
+	{
+		::operator delete(block);
+		return;
+	}
+	local->push_back(block);
+	if (local->size() >= MAX_CACHED_BLOCKS)
+	{
+		MoveToShared(*local, TRANSFER_BATCH);
+	}
+}
+
+size_t BlockPool::CachedBlocks()
+{
+	return freeBlocks ? freeBlocks->size() : 0;
+}
+
+size_t BlockPool::InUseBytes()
+{
+	return inUseBytes.load(std::memory_order_relaxed);
+}
+
+size_t BlockPool::SharedBlocks()
+{
+	std::lock_guard<std::mutex> locker(SharedMutex());
+	return SharedList().size();
+}
@@ -1,34 +1,72 @@
 #include "buffer.h"
 
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+#include <algorithm>
 
-// 可以读的数据的大小  写位置 - 读位置，中间的数据就是可以读的大小
+// 没有块时Peek()/BeginWriteConst()返回的位置
+static const char EMPTY[1] = {0};
+
+Buffer::Buffer(int initBuffSize) : initSize_(initBuffSize > 0 ? initBuffSize : BlockPool::BLOCK_SIZE), readable_(0), readBlocks_(1), heldBytes_(0) {}
+
+Buffer::~Buffer()
+{
+	for (Block *block : blocks_)
+	{
+		PutBlock_(block);
+	}
+}
+
+// 可以读的数据的大小，所有块的可读数据加起来
 size_t Buffer::ReadableBytes() const
 {
-	return writePos_ - readPos_;
+	return readable_;
 }
 
-// 可以写的数据大小，缓冲区的总大小 - 写位置
+// 可以写的数据大小，最后一个块剩下的连续空间
 size_t Buffer::WritableBytes() const
 {
-	return buffer_.size() - writePos_;
+	return blocks_.empty() ? 0 : blocks_.back()->Writable();
 }
 
-// 前面可以用的空间，当前读取到哪个位置，就是前面可以用的空间大小
+// 前面可以用的空间，第一个块里已经读过的部分
 size_t Buffer::PrependableBytes() const
 {
-	return readPos_;
+	return blocks_.empty() ? 0 : blocks_.front()->readPos;
 }
 
 const char *Buffer::Peek() const
 {
-	return BeginPtr_() + readPos_;
+	Linearize_();
+	if (blocks_.empty())
+	{
+		return EMPTY;
+	}
+	return blocks_.front()->Data() + blocks_.front()->readPos;
 }
 
 void Buffer::Retrieve(size_t len)
 {
 	assert(len <= ReadableBytes());
-	readPos_ += len;
+	readable_ -= len;
+	while (len > 0)
+	{
+		Block *front = blocks_.front();
+		size_t n = std::min(len, front->Readable());
+		front->readPos += n;
+		len -= n;
+		if (front->Readable() == 0)
+		{
+			if (blocks_.size() > 1)
+			{
+				/* 读完的块还给块池 */
+				PutBlock_(front);
+				blocks_.erase(blocks_.begin());
+			}
+			else
+			{
+				front->readPos = front->writePos = 0;
+			}
+		}
+	}
 }
 
 // buff.RetrieveUntil(lineEnd + 2);
@@ -40,9 +78,30 @@ void Buffer::RetrieveUntil(const char *end)
 
 void Buffer::RetrieveAll()
 {
-	bzero(&buffer_[0], buffer_.size());
-	readPos_ = 0;
-	writePos_ = 0;
+	/* 只留第一个块，其余的还给块池；只重置位置，不清零内容 */
+	for (size_t i = 1; i < blocks_.size(); i++)
+	{
+		PutBlock_(blocks_[i]);
+	}
+	if (!blocks_.empty())
+	{
+		blocks_.resize(1);
+		blocks_[0]->readPos = blocks_[0]->writePos = 0;
+	}
+	readable_ = 0;
+}
+
+void Buffer::Release()
+{
+	if (readable_ > 0)
+	{
+		return;
+	}
+	for (Block *block : blocks_)
+	{
+		PutBlock_(block);
+	}
+	blocks_.clear();
 }
 
 std::string Buffer::RetrieveAllToStr()
@@ -54,17 +113,28 @@ std::string Buffer::RetrieveAllToStr()
 
 const char *Buffer::BeginWriteConst() const
 {
-	return BeginPtr_() + writePos_;
+	Linearize_();
+	if (blocks_.empty())
+	{
+		return EMPTY;
+	}
+	return blocks_.back()->Data() + blocks_.back()->writePos;
 }
 
 char *Buffer::BeginWrite()
 {
-	return BeginPtr_() + writePos_;
+	if (blocks_.empty())
+	{
+		PushBlock_(initSize_);
+	}
+	return blocks_.back()->Data() + blocks_.back()->writePos;
 }
 
 void Buffer::HasWritten(size_t len)
 {
-	writePos_ += len;
+	assert(len <= WritableBytes());
+	blocks_.back()->writePos += len;
+	readable_ += len;
 }
 
 void Buffer::Append(const std::string &str)
@@ -78,18 +148,30 @@ void Buffer::Append(const void *data, size_t len)
 	Append(static_cast<const char *>(data), len);
 }
 
-//  Append(buff, len - writable);   buff临时数组，len-writable是临时数组中的数据个数
+// 先填满最后一个块，不够再接新块，已有的数据不会被搬动
 void Buffer::Append(const char *str, size_t len)
 {
 	assert(str);
-	EnsureWriteable(len);
-	std::copy(str, str + len, BeginWrite());
-	HasWritten(len);
+	while (len > 0)
+	{
+		if (WritableBytes() == 0)
+		{
+			PushBlock_(blocks_.empty() ? initSize_ : BlockPool::BLOCK_SIZE);
+		}
+		size_t n = std::min(len, WritableBytes());
+		std::copy(str, str + n, BeginWrite());
+		HasWritten(n);
+		str += n;
+		len -= n;
+	}
 }
 
 void Buffer::Append(const Buffer &buff)
 {
-	Append(buff.Peek(), buff.ReadableBytes());
+	for (Block *block : buff.blocks_)
+	{
+		Append(block->Data() + block->readPos, block->Readable());
+	}
 }
 
 void Buffer::EnsureWriteable(size_t len)
@@ -101,74 +183,141 @@ void Buffer::EnsureWriteable(size_t len)
 	assert(WritableBytes() >= len);
 }
 
+// 用readv直接读进块里：先填最后一个块的剩余空间，再从块池里拿新块
+// 新块的个数跟着最近读到的大小走，小请求只拿一块，不用每次都从块池里拿满再还回去
 ssize_t Buffer::ReadFd(int fd, int *saveErrno)
 {
-	// 64KB
-	char buff[65535]; // 临时的数组，保证能够把所有的数据都读出来
-
-	struct iovec iov[2];
-	const size_t writable = WritableBytes();
-
-	/* 分散读，保证数据全部读完 */
-	// iov[0] Buffer内置的数组_buffer，默认大小是1024
-	// iov[1] buff临时数组，大小为65535
-	iov[0].iov_base = BeginPtr_() + writePos_;
-	iov[0].iov_len = writable;
-	iov[1].iov_base = buff;
-	iov[1].iov_len = sizeof(buff);
+	struct iovec iov[READ_BLOCKS + 1];
+	Block *extra[READ_BLOCKS];
+	const int blocks = readBlocks_;
+	int cnt = 0;
+	size_t tailWritable = WritableBytes();
+	if (tailWritable > 0)
+	{
+		iov[cnt].iov_base = BeginWrite();
+		iov[cnt].iov_len = tailWritable;
+		cnt++;
+	}
+	for (int i = 0; i < blocks; i++)
+	{
+		extra[i] = BlockPool::Get();
+		iov[cnt].iov_base = extra[i]->Data();
+		iov[cnt].iov_len = extra[i]->capacity;
+		cnt++;
+	}
 
-	const ssize_t len = readv(fd, iov, 2); // 真正的读操作
+	const ssize_t len = readv(fd, iov, cnt); // 真正的读操作
 	if (len < 0)
 	{
 		*saveErrno = errno;
 	}
-	else if (static_cast<size_t>(len) <= writable)
+	size_t left = len > 0 ? static_cast<size_t>(len) : 0;
+	if (tailWritable > 0)
 	{
-		writePos_ += len;
+		size_t n = std::min(left, tailWritable);
+		HasWritten(n);
+		left -= n;
 	}
-	else
+	int used = 0;
+	for (int i = 0; i < blocks; i++)
 	{
-		writePos_ = buffer_.size();
-		Append(buff, len - writable);
+		if (left == 0)
+		{
+			BlockPool::Put(extra[i]); // 没用上的块还回去
+			continue;
+		}
+		used++;
+		size_t n = std::min(left, extra[i]->capacity);
+		extra[i]->writePos = n;
+		blocks_.push_back(extra[i]);
+		heldBytes_.fetch_add(extra[i]->capacity, std::memory_order_relaxed);
+		readable_ += n;
+		left -= n;
+	}
+	if (len > 0)
+	{
+		bool full = used == blocks && extra[blocks - 1]->writePos == extra[blocks - 1]->capacity;
+		readBlocks_ = full ? std::min(blocks * 2, static_cast<int>(READ_BLOCKS)) : std::max(used, 1);
 	}
 	return len;
 }
 
+// 用writev把所有块一次写出去
 ssize_t Buffer::WriteFd(int fd, int *saveErrno)
 {
-	size_t readSize = ReadableBytes();
-	ssize_t len = write(fd, Peek(), readSize);
+	struct iovec iov[64];
+	int cnt = ReadIovec(iov, 64);
+	ssize_t len = writev(fd, iov, cnt);
 	if (len < 0)
 	{
 		*saveErrno = errno;
 		return len;
 	}
-	readPos_ += len;
+	Retrieve(len);
 	return len;
 }
 
-char *Buffer::BeginPtr_()
+int Buffer::ReadIovec(struct iovec *iov, int maxIov, size_t offset) const
 {
-	return &*buffer_.begin(); // 等价于&buffer[0]
+	int cnt = 0;
+	for (size_t i = 0; i < blocks_.size() && cnt < maxIov; i++)
+	{
+		Block *block = blocks_[i];
+		if (block->Readable() <= offset)
+		{
+			offset -= block->Readable(); // 整块都在offset之前
+			continue;
+		}
+		iov[cnt].iov_base = block->Data() + block->readPos + offset;
+		iov[cnt].iov_len = block->Readable() - offset;
+		offset = 0;
+		cnt++;
+	}
+	return cnt;
+}
+
+void Buffer::PushBlock_(size_t capacity)
+{
+	blocks_.push_back(BlockPool::Get(capacity));
+	heldBytes_.fetch_add(blocks_.back()->capacity, std::memory_order_relaxed);
 }
 
-const char *Buffer::BeginPtr_() const
+void Buffer::PutBlock_(Block *block) const
 {
-	return &*buffer_.begin();
+	heldBytes_.fetch_sub(block->capacity, std::memory_order_relaxed);
+	BlockPool::Put(block);
 }
 
 void Buffer::MakeSpace_(size_t len)
 {
-	if (WritableBytes() + PrependableBytes() < len)
+	Block *back = blocks_.empty() ? nullptr : blocks_.back();
+	if (back && back->Readable() == 0 && back->capacity >= len)
+	{
+		back->readPos = back->writePos = 0;
+		return;
+	}
+	if (back && back->Readable() == 0 && blocks_.size() == 1)
+	{
+		/* 唯一的块是空的，换一个够大的 */
+		PutBlock_(back);
+		blocks_.clear();
+	}
+	PushBlock_(std::max(len, BlockPool::BLOCK_SIZE));
+}
+
+void Buffer::Linearize_() const
+{
+	if (blocks_.size() <= 1)
 	{
-		buffer_.resize(writePos_ + len + 1);
+		return;
 	}
-	else
+	Block *merged = BlockPool::Get(std::max(readable_, BlockPool::BLOCK_SIZE));
+	heldBytes_.fetch_add(merged->capacity, std::memory_order_relaxed);
+	for (Block *block : blocks_)
 	{
-		size_t readable = ReadableBytes();
-		std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
-		readPos_ = 0;
-		writePos_ = readPos_ + readable;
-		assert(readable == ReadableBytes());
+		std::copy(block->Data() + block->readPos, block->Data() + block->writePos, merged->Data() + merged->writePos);
+		merged->writePos += block->Readable();
+		PutBlock_(block);
 	}
-}
\ No newline at end of file
+	blocks_.assign(1, merged);
+}
@@ -0,0 +1,306 @@
+#include "capture.h"
+#include "clockservice.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+const int Capture::FLUSH_INTERVAL_MS;
+const size_t Capture::MAX_PENDING_BUFFERS;
+
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int CAPTURE_BYTES = metrics->AddCounter("toy_capture_bytes_total", "Bytes written to the traffic capture file");
+	const int CAPTURE_WAITS = metrics->AddCounter("toy_capture_waits_total", "Times a connection waited for the capture writer to catch up");
+
+	const size_t MAX_SPARE_BUFFERS = 2;
+}
+
+Capture::Capture()
+{
+	enabled_ = false;
+	nextConn_ = 1;
+	startNs_ = 0;
+	bufferSize_ = 0;
+	maxBytes_ = 0;
+	written_ = 0;
+	fd_ = -1;
+	running_ = false;
+}
+
+Capture::~Capture()
+{
+	if (writeThread_ && writeThread_->joinable())
+	{
+		{
+			lock_guard<mutex> locker(mtx_);
+			running_ = false;
+		}
+		cond_.notify_one();
+		writeThread_->join(); // 退出前把剩下的记录写完
+	}
+	if (fd_ >= 0)
+	{
+		close(fd_);
+	}
+}
+
+Capture *Capture::Instance()
+{
+	static Capture inst;
+	return &inst;
+}
+
+bool Capture::Init(const char *path, int maxMB, int bufferKB)
+{
+	if (!path || !*path)
+	{
+		return true;
+	}
+	if (writeThread_)
+	{
+		return true; // 只初始化一次
+	}
+	fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd_ < 0)
+	{
+		return false;
+	}
+	CaptureFileHeader header;
+	memcpy(header.magic, "TOYCAP01", sizeof(header.magic));
+	header.startUs = ClockService::Instance()->ReadWallUs();
+	if (write(fd_, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)))
+	{
+		close(fd_);
+		fd_ = -1;
+		return false;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	startNs_ = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	bufferSize_ = static_cast<size_t>(bufferKB > 0 ? bufferKB : 1024) << 10;
+	maxBytes_ = static_cast<size_t>(maxMB > 0 ? maxMB : 1024) << 20;
+
+	current_.reset(new LogBuffer(bufferSize_));
+	running_ = true;
+	writeThread_.reset(new thread([this]
+								  { WriteLoop_(); }));
+	enabled_ = true;
+	return true;
+}
+
+uint64_t Capture::NowUs_() const
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec * 1000000000LL + ts.tv_nsec - startNs_) / 1000;
+}
+
+// 当前缓冲区放不下就交给写线程；积压太多时等写线程写完一批；超过文件大小上限返回false并停止抓包
+bool Capture::Reserve_(unique_lock<mutex> &locker, size_t len)
+{
+	if (!enabled_.load(memory_order_relaxed))
+	{
+		return false;
+	}
+	if (written_ + current_->Length() + len > maxBytes_)
+	{
+		enabled_ = false;
+		LOG_WARN("Capture file reached %zuMB, capture stopped", maxBytes_ >> 20);
+		return false;
+	}
+	if (current_->Avail() >= len)
+	{
+		return true;
+	}
+	if (buffers_.size() >= MAX_PENDING_BUFFERS)
+	{
+		metrics->Add(CAPTURE_WAITS);
+		drained_.wait(locker, [this]
+					  { return buffers_.size() < MAX_PENDING_BUFFERS; });
+	}
+	written_ += current_->Length();
+	buffers_.push_back(move(current_));
+	if (!spares_.empty())
+	{
+		current_ = move(spares_.back());
+		spares_.pop_back();
+	}
+	else
+	{
+		current_.reset(new LogBuffer(bufferSize_));
+	}
+	cond_.notify_one();
+	return true;
+}
+
+void Capture::Append_(uint32_t conn, CaptureRecord::Type type, uint32_t len, uint32_t aux, uint16_t code)
+{
+	unique_lock<mutex> locker(mtx_);
+	if (!Reserve_(locker, sizeof(CaptureRecord)))
+	{
+		return;
+	}
+	/* 在锁里取时间，文件里的记录按时间排好序 */
+	CaptureRecord record = {NowUs_(), conn, len, aux, type, code};
+	current_->Append(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+uint32_t Capture::Open(const sockaddr_in &addr)
+{
+	if (!IsEnabled())
+	{
+		return 0;
+	}
+	uint32_t conn = nextConn_.fetch_add(1, memory_order_relaxed);
+	Append_(conn, CaptureRecord::OPEN, 0, addr.sin_addr.s_addr, ntohs(addr.sin_port));
+	return conn;
+}
+
+void Capture::Data(uint32_t conn, const struct iovec *iov, int cnt)
+{
+	if (conn == 0 || !IsEnabled())
+	{
+		return;
+	}
+	size_t total = 0;
+	for (int i = 0; i < cnt; i++)
+	{
+		total += iov[i].iov_len;
+	}
+	/* 比一个缓冲区还大的数据拆成几条记录，重放时按顺序拼起来 */
+	const size_t maxChunk = bufferSize_ - sizeof(CaptureRecord);
+	int idx = 0;
+	size_t off = 0;
+	unique_lock<mutex> locker(mtx_);
+	while (total > 0)
+	{
+		size_t n = min(total, maxChunk);
+		if (!Reserve_(locker, sizeof(CaptureRecord) + n))
+		{
+			return;
+		}
+		CaptureRecord record = {NowUs_(), conn, static_cast<uint32_t>(n), 0, CaptureRecord::DATA, 0};
+		current_->Append(reinterpret_cast<const char *>(&record), sizeof(record));
+		total -= n;
+		while (n > 0)
+		{
+			size_t take = min(n, iov[idx].iov_len - off);
+			current_->Append(static_cast<const char *>(iov[idx].iov_base) + off, take);
+			n -= take;
+			off += take;
+			if (off == iov[idx].iov_len)
+			{
+				idx++;
+				off = 0;
+			}
+		}
+	}
+}
+
+void Capture::Response(uint32_t conn, int status, size_t bytes)
+{
+	if (conn != 0 && IsEnabled())
+	{
+		Append_(conn, CaptureRecord::RESPONSE, static_cast<uint32_t>(bytes), 0, static_cast<uint16_t>(status));
+	}
+}
+
+void Capture::Close(uint32_t conn)
+{
+	if (conn != 0 && IsEnabled())
+	{
+		Append_(conn, CaptureRecord::CLOSE, 0, 0, 0);
+	}
+}
+
+void Capture::WriteBuffers_(const vector<BufferPtr> &buffers)
+{
+	struct iovec iov[MAX_PENDING_BUFFERS + 1];
+	int cnt = 0;
+	for (const BufferPtr &buffer : buffers)
+	{
+		if (buffer->Length() > 0 && cnt < static_cast<int>(MAX_PENDING_BUFFERS + 1))
+		{
+			iov[cnt].iov_base = const_cast<char *>(buffer->Data());
+			iov[cnt].iov_len = buffer->Length();
+			metrics->Add(CAPTURE_BYTES, buffer->Length());
+			cnt++;
+		}
+	}
+
+	struct iovec *cur = iov;
+	while (cnt > 0)
+	{
+		ssize_t len = writev(fd_, cur, cnt);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("write capture file");
+			return;
+		}
+		while (cnt > 0 && static_cast<size_t>(len) >= cur->iov_len)
+		{
+			len -= cur->iov_len;
+			cur++;
+			cnt--;
+		}
+		if (cnt > 0)
+		{
+			cur->iov_base = static_cast<char *>(cur->iov_base) + len;
+			cur->iov_len -= len;
+		}
+	}
+}
+
+void Capture::WriteLoop_()
+{
+	vector<BufferPtr> toWrite;
+	toWrite.reserve(MAX_PENDING_BUFFERS + 1);
+	bool running = true;
+	while (running)
+	{
+		{
+			/* 有缓冲区写满了才提前叫醒，否则每隔一段时间把当前缓冲区写出去 */
+			unique_lock<mutex> locker(mtx_);
+			if (buffers_.empty() && running_)
+			{
+				cond_.wait_for(locker, chrono::milliseconds(FLUSH_INTERVAL_MS));
+			}
+			running = running_;
+			if (current_->Length() > 0)
+			{
+				written_ += current_->Length();
+				buffers_.push_back(move(current_));
+				current_.reset(new LogBuffer(bufferSize_));
+			}
+			toWrite.swap(buffers_);
+		}
+		drained_.notify_all();
+
+		WriteBuffers_(toWrite);
+		lock_guard<mutex> locker(mtx_);
+		for (BufferPtr &buffer : toWrite)
+		{
+			if (spares_.size() < MAX_SPARE_BUFFERS)
+			{
+				buffer->Reset();
+				spares_.push_back(move(buffer));
+			}
+		}
+		toWrite.clear();
+	}
+}
@@ -0,0 +1,104 @@
+#include "clockservice.h"
+
+#include <cstring>
+#include <cstdio>
+
+// 粗粒度时钟的精度不超过这个值才使用(一般是1~4ms)
+static const long COARSE_MAX_RES_NS = 10 * 1000 * 1000;
+
+static clockid_t PickClock(clockid_t coarse, clockid_t precise)
+{
+	struct timespec res;
+	if (clock_getres(coarse, &res) == 0 && res.tv_sec == 0 && res.tv_nsec <= COARSE_MAX_RES_NS)
+	{
+		return coarse;
+	}
+	return precise;
+}
+
+ClockService::ClockService() : monoId_(PickClock(CLOCK_MONOTONIC_COARSE, CLOCK_MONOTONIC)),
+							   wallId_(PickClock(CLOCK_REALTIME_COARSE, CLOCK_REALTIME)),
+							   monoMs_(0), wallUs_(0)
+{
+	Update();
+}
+
+ClockService *ClockService::Instance()
+{
+	static ClockService inst;
+	return &inst;
+}
+
+void ClockService::Update()
+{
+	struct timespec ts;
+	clock_gettime(monoId_, &ts);
+	monoMs_.store(ts.tv_sec * 1000 + ts.tv_nsec / 1000000, std::memory_order_relaxed);
+	clock_gettime(wallId_, &ts);
+	wallUs_.store(ts.tv_sec * 1000000 + ts.tv_nsec / 1000, std::memory_order_relaxed);
+}
+
+// 每个线程一份，跨秒时才调用localtime_r/gmtime_r重新格式化
+ClockService::SecondCache &ClockService::Cache_(time_t sec)
+{
+	static thread_local SecondCache cache = {-1, {}, {}, {}};
+	if (cache.sec != sec)
+	{
+		static const char *WEEK[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+		static const char *MONTH[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+									  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+		struct tm gmt;
+		cache.sec = sec;
+		localtime_r(&sec, &cache.local);
+		gmtime_r(&sec, &gmt);
+		snprintf(cache.logTime, sizeof(cache.logTime), "%04d-%02d-%02d %02d:%02d:%02d",
+				 cache.local.tm_year + 1900, cache.local.tm_mon + 1, cache.local.tm_mday,
+				 cache.local.tm_hour, cache.local.tm_min, cache.local.tm_sec);
+		snprintf(cache.httpDate, sizeof(cache.httpDate), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+				 WEEK[gmt.tm_wday], gmt.tm_mday, MONTH[gmt.tm_mon], gmt.tm_year + 1900,
+				 gmt.tm_hour, gmt.tm_min, gmt.tm_sec);
+	}
+	return cache;
+}
+
+int ClockService::FormatLogTime(char *buf, size_t len, struct tm *t)
+{
+	return FormatLogTimeAt(ReadWallUs(), buf, len, t);
+}
+
+int64_t ClockService::ReadWallUs() const
+{
+	struct timespec ts;
+	clock_gettime(wallId_, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int ClockService::FormatLogTimeAt(int64_t wallUs, char *buf, size_t len, struct tm *t)
+{
+	if (len <= LOG_TIME_LEN)
+	{
+		return 0;
+	}
+	SecondCache &cache = Cache_(wallUs / 1000000);
+	if (t)
+	{
+		*t = cache.local;
+	}
+	memcpy(buf, cache.logTime, 19);
+	/* 微秒部分手动转换，避免snprintf */
+	long usec = wallUs % 1000000;
+	buf[19] = '.';
+	for (int i = 25; i >= 20; i--)
+	{
+		buf[i] = '0' + usec % 10;
+		usec /= 10;
+	}
+	buf[26] = ' ';
+	buf[LOG_TIME_LEN] = '\0';
+	return LOG_TIME_LEN;
+}
+
+const char *ClockService::HttpDate()
+{
+	return Cache_(WallUs() / 1000000).httpDate;
+}
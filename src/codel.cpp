@@ -0,0 +1,29 @@
+#include "codel.h"
+
+CoDel::CoDel(int targetMs, int intervalMs) : targetNs_(targetMs * 1000000LL), intervalNs_(intervalMs * 1000000LL),
+											 intervalEndNs_(0), minDelayNs_(0), resetDelay_(false), overloaded_(false)
+{
+}
+
+bool CoDel::OnDequeue(int64_t sojournNs, int64_t nowNs)
+{
+	/* 周期结束：只有一个线程负责根据上个周期的最小停留时间判断是否过载 */
+	if (nowNs > intervalEndNs_.load(std::memory_order_relaxed) &&
+		!resetDelay_.load(std::memory_order_acquire) && !resetDelay_.exchange(true))
+	{
+		intervalEndNs_.store(nowNs + intervalNs_, std::memory_order_relaxed);
+		overloaded_.store(minDelayNs_.load(std::memory_order_relaxed) > targetNs_, std::memory_order_relaxed);
+	}
+
+	if (resetDelay_.load(std::memory_order_acquire) && resetDelay_.exchange(false))
+	{
+		/* 新周期的第一个样本，不丢弃 */
+		minDelayNs_.store(sojournNs, std::memory_order_relaxed);
+		return false;
+	}
+	int64_t minDelay = minDelayNs_.load(std::memory_order_relaxed);
+	while (sojournNs < minDelay && !minDelayNs_.compare_exchange_weak(minDelay, sojournNs, std::memory_order_relaxed))
+	{
+	}
+	return overloaded_.load(std::memory_order_relaxed) && sojournNs > SloughNs();
+}
@@ -0,0 +1,256 @@
+#include "eventloop.h"
+#include "metrics.h"
+
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int WAIT_CALLS = metrics->AddCounter("toy_epoll_waits_total", "Number of epoll_wait calls in the event loop");
+	const int WAIT_EVENTS = metrics->AddCounter("toy_epoll_events_total", "Number of events returned by epoll_wait");
+	const int CONN_TIMERS = metrics->AddGauge("toy_timer_connections", "Connections tracked by the timing wheel");
+	const int LOOP_TIMERS = metrics->AddGauge("toy_timer_tasks", "Pending RunAfter/RunEvery tasks");
+}
+
+EventLoop::EventLoop(int maxEvent) : quit_(false), threadId_(std::this_thread::get_id()),
+									 epoller_(new Epoller(maxEvent)), timer_(new TimingWheel()),
+									 wakeupPending_(false), callingPending_(false),
+									 nextTimerId_(1), runningTimer_(0)
+{
+	wakeupFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	assert(wakeupFd_ >= 0 && timerFd_ >= 0);
+	epoller_->AddFd(wakeupFd_, EPOLLIN);
+	epoller_->AddFd(timerFd_, EPOLLIN);
+}
+
+EventLoop::~EventLoop()
+{
+	epoller_->DelFd(wakeupFd_);
+	epoller_->DelFd(timerFd_);
+	close(wakeupFd_);
+	close(timerFd_);
+}
+
+void EventLoop::Loop()
+{
+	threadId_ = std::this_thread::get_id();
+	while (!quit_)
+	{
+		// 连接超时由时间轮处理，epoll_wait最多等到时间轮上最近的一个节点到期
+		int timeMS = timer_->GetNextTick();
+		int eventCnt = epoller_->Wait(timeMS);
+		metrics->Add(WAIT_CALLS);
+		metrics->Add(WAIT_EVENTS, eventCnt > 0 ? eventCnt : 0);
+
+		// 每轮只读一次时钟，本轮的定时器、日志、响应头都使用这个缓存时间
+		ClockService::Instance()->Update();
+
+		for (int i = 0; i < eventCnt; i++)
+		{
+			int fd = epoller_->GetEventFd(i);
+			uint32_t events = epoller_->GetEvents(i);
+			if (fd == wakeupFd_)
+			{
+				HandleWakeup_();
+			}
+			else if (fd == timerFd_)
+			{
+				HandleTimerFd_();
+			}
+			else if (eventCb_)
+			{
+				eventCb_(fd, events);
+			}
+		}
+		DoPendingFunctors_();
+		metrics->Set(CONN_TIMERS, static_cast<double>(timer_->size()));
+		metrics->Set(LOOP_TIMERS, static_cast<double>(timerTasks_.size()));
+	}
+}
+
+void EventLoop::Quit()
+{
+	quit_ = true;
+	if (!IsInLoopThread())
+	{
+		Wakeup_();
+	}
+}
+
+// 在循环线程中直接执行，否则投递过去
+void EventLoop::RunInLoop(Task cb)
+{
+	if (IsInLoopThread())
+	{
+		cb();
+	}
+	else
+	{
+		QueueInLoop(std::move(cb));
+	}
+}
+
+void EventLoop::QueueInLoop(Task cb)
+{
+	{
+		std::lock_guard<std::mutex> locker(mtx_);
+		pending_.push_back(std::move(cb));
+	}
+	// 循环线程自己投递的任务本轮结束前就会执行，不需要唤醒
+	if (!IsInLoopThread() || callingPending_)
+	{
+		Wakeup_();
+	}
+}
+
+// 批量唤醒：循环线程处理之前，只写一次eventfd
+void EventLoop::Wakeup_()
+{
+	if (wakeupPending_.exchange(true))
+	{
+		return;
+	}
+	uint64_t one = 1;
+	ssize_t n = ::write(wakeupFd_, &one, sizeof(one));
+	if (n != sizeof(one))
+	{
+		LOG_ERROR("EventLoop wakeup write %d bytes", (int)n);
+	}
+}
+
+void EventLoop::HandleWakeup_()
+{
+	uint64_t count = 0;
+	ssize_t n = ::read(wakeupFd_, &count, sizeof(count));
+	if (n != sizeof(count) && errno != EAGAIN)
+	{
+		LOG_ERROR("EventLoop wakeup read %d bytes", (int)n);
+	}
+}
+
+void EventLoop::DoPendingFunctors_()
+{
+	// 先清除标记再取任务，之后的投递会重新唤醒
+	wakeupPending_.store(false);
+	callingPending_ = true;
+	{
+		std::lock_guard<std::mutex> locker(mtx_);
+		running_.swap(pending_);
+		runningTimers_.swap(pendingTimers_);
+	}
+	for (auto &timer : runningTimers_)
+	{
+		InsertTimer_(timer.first, std::move(timer.second));
+	}
+	runningTimers_.clear();
+	for (Task &functor : running_)
+	{
+		functor();
+	}
+	running_.clear();
+	callingPending_ = false;
+}
+
+int64_t EventLoop::NowMs_()
+{
+	// 定时任务和timerfd对齐，使用精确的单调时钟
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+EventLoop::TimerId EventLoop::RunAfter(int delayMs, Task cb)
+{
+	return AddTimer_(NowMs_() + delayMs, 0, std::move(cb));
+}
+
+EventLoop::TimerId EventLoop::RunEvery(int intervalMs, Task cb)
+{
+	assert(intervalMs > 0);
+	return AddTimer_(NowMs_() + intervalMs, intervalMs, std::move(cb));
+}
+
+EventLoop::TimerId EventLoop::AddTimer_(int64_t expires, int interval, Task cb)
+{
+	TimerId id = nextTimerId_++;
+	TimerTask task = {expires, interval, std::move(cb)};
+	if (IsInLoopThread())
+	{
+		InsertTimer_(id, std::move(task));
+	}
+	else
+	{
+		{
+			std::lock_guard<std::mutex> locker(mtx_);
+			pendingTimers_.emplace_back(id, std::move(task));
+		}
+		Wakeup_();
+	}
+	return id;
+}
+
+void EventLoop::Cancel(TimerId id)
+{
+	RunInLoop([this, id]
+			  {
+		auto it = timerTasks_.find(id);
+		if (it != timerTasks_.end())
+		{
+			timerQueue_.erase({it->second.expires, id});
+			timerTasks_.erase(it);
+			ResetTimerFd_();
+		}
+		else if (id == runningTimer_)
+		{
+			runningTimer_ = 0;
+		} });
+}
+
+void EventLoop::InsertTimer_(TimerId id, TimerTask task)
+{
+	timerQueue_.insert({task.expires, id});
+	timerTasks_[id] = std::move(task);
+	ResetTimerFd_();
+}
+
+// 按最早的定时任务重新设置timerfd
+void EventLoop::ResetTimerFd_()
+{
+	struct itimerspec spec = {};
+	if (!timerQueue_.empty())
+	{
+		int64_t expires = std::max<int64_t>(timerQueue_.begin()->first, 1);
+		spec.it_value.tv_sec = expires / 1000;
+		spec.it_value.tv_nsec = (expires % 1000) * 1000000;
+	}
+	// it_value全0表示停止
+	timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void EventLoop::HandleTimerFd_()
+{
+	uint64_t howmany = 0;
+	ssize_t n = ::read(timerFd_, &howmany, sizeof(howmany));
+	if (n != sizeof(howmany) && errno != EAGAIN)
+	{
+		LOG_ERROR("EventLoop timerfd read %d bytes", (int)n);
+	}
+	int64_t now = NowMs_();
+	while (!timerQueue_.empty() && timerQueue_.begin()->first <= now)
+	{
+		TimerId id = timerQueue_.begin()->second;
+		timerQueue_.erase(timerQueue_.begin());
+		TimerTask task = std::move(timerTasks_[id]);
+		timerTasks_.erase(id);
+
+		runningTimer_ = id;
+		task.cb();
+		if (task.interval > 0 && runningTimer_ == id)
+		{
+			/* 周期任务，回调里没有取消自己就重新调度 */
+			task.expires = now + task.interval;
+			InsertTimer_(id, std::move(task));
+		}
+		runningTimer_ = 0;
+	}
+	ResetTimerFd_();
+}
@@ -0,0 +1,322 @@
+#include "filecache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "clockservice.h"
+#include "metrics.h"
+
+using namespace std;
+
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int CACHE_HITS = metrics->AddCounter("toy_file_cache_lookups_total{result=\"hit\"}", "File cache lookups");
+	const int CACHE_MISSES = metrics->AddCounter("toy_file_cache_lookups_total{result=\"miss\"}", "");
+	const int CACHE_LOADS = metrics->AddCounter("toy_file_cache_loads_total", "Files read from disk into the cache");
+	const int CACHE_REVALIDATED = metrics->AddCounter("toy_file_cache_revalidations_total", "Expired entries kept because the file had not changed");
+	const int CACHE_BYTES = metrics->AddCallback("toy_file_cache_bytes", "Bytes held by the file cache", Metrics::GAUGE, []
+												 { return static_cast<double>(FileCache::Instance()->TotalBytes()); });
+
+	const size_t HUGE_PAGE = 2 << 20;
+	const size_t WARM_ALIGN = 64; // 预热区域里每个文件按缓存行对齐
+
+	bool SameFile(const struct stat &a, const struct stat &b)
+	{
+		return a.st_ino == b.st_ino && a.st_dev == b.st_dev && a.st_size == b.st_size &&
+			   a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+	}
+
+	bool ReadAll(int fd, char *buf, size_t len)
+	{
+		size_t done = 0;
+		while (done < len)
+		{
+			ssize_t n = pread(fd, buf + done, len - done, done);
+			if (n <= 0)
+			{
+				return false;
+			}
+			done += n;
+		}
+		return true;
+	}
+
+	// 递归列出dir下的普通文件，路径按"目录 + / + 名字"拼接：
+	// 资源目录以/结尾，请求路径以/开头，这样拼出来的和响应时查缓存用的键一样
+	void ListFiles(const string &dir, vector<pair<string, struct stat>> &files)
+	{
+		DIR *d = opendir(dir.c_str());
+		if (!d)
+		{
+			return;
+		}
+		while (struct dirent *entry = readdir(d))
+		{
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			{
+				continue;
+			}
+			string path = dir + "/" + entry->d_name;
+			struct stat st;
+			if (stat(path.c_str(), &st) < 0)
+			{
+				continue;
+			}
+			if (S_ISDIR(st.st_mode))
+			{
+				ListFiles(path, files);
+			}
+			else if (S_ISREG(st.st_mode))
+			{
+				files.push_back({path, st});
+			}
+		}
+		closedir(d);
+	}
+
+	// 按大页对齐分配len字节(向上取整到大页)，memory返回用的是哪种内存，失败返回nullptr
+	char *AllocWarm(size_t len, bool hugePages, const char **memory, size_t *mapped)
+	{
+		if (!hugePages)
+		{
+			*memory = "heap";
+			return nullptr;
+		}
+		len = (len + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+		/* hugetlbfs预留的大页(vm.nr_hugepages)，没有预留时失败 */
+		void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			*memory = "hugetlb";
+			*mapped = len;
+			return static_cast<char *>(p);
+		}
+		/* 透明大页：多映射一个大页，截掉头尾，让区域按2MB对齐，缺页时内核才能直接给大页 */
+		p = mmap(nullptr, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+		{
+			*memory = "heap";
+			return nullptr;
+		}
+		uintptr_t start = reinterpret_cast<uintptr_t>(p);
+		uintptr_t aligned = (start + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+		if (aligned > start)
+		{
+			munmap(p, aligned - start);
+		}
+		munmap(reinterpret_cast<void *>(aligned + len), start + HUGE_PAGE - aligned);
+		madvise(reinterpret_cast<void *>(aligned), len, MADV_HUGEPAGE);
+		*memory = "thp";
+		*mapped = len;
+		return reinterpret_cast<char *>(aligned);
+	}
+}
+
+FileCache::FileCache() : maxFileSize_(64 * 1024), maxTotalBytes_(64 * 1024 * 1024), ttlMs_(2000), totalBytes_(0)
+{
+}
+
+FileCache *FileCache::Instance()
+{
+	static FileCache cache;
+	return &cache;
+}
+
+void FileCache::Init(size_t maxFileSize, size_t maxTotalBytes, int ttlMs)
+{
+	unique_lock<shared_mutex> locker(mtx_);
+	maxFileSize_ = maxFileSize;
+	maxTotalBytes_ = maxTotalBytes;
+	ttlMs_ = ttlMs;
+	files_.clear();
+	totalBytes_ = 0;
+}
+
+shared_ptr<const CachedFile> FileCache::Find(const string &path)
+{
+	shared_lock<shared_mutex> locker(mtx_);
+	auto it = files_.find(path);
+	if (it == files_.end() || ClockService::Instance()->NowMs() - it->second->loadMs > ttlMs_)
+	{
+		metrics->Add(CACHE_MISSES);
+		return nullptr;
+	}
+	metrics->Add(CACHE_HITS);
+	return it->second;
+}
+
+shared_ptr<const CachedFile> FileCache::Load(const string &path)
+{
+	int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+	shared_ptr<CachedFile> file = make_shared<CachedFile>();
+	if (fstat(fd, &file->st) < 0 || !S_ISREG(file->st.st_mode) || static_cast<size_t>(file->st.st_size) > maxFileSize_)
+	{
+		close(fd);
+		return nullptr;
+	}
+	file->loadMs = ClockService::Instance()->NowMs();
+	{
+		/* 过期的条目：文件没变就沿用原来的内容(预热时放进大页的也还在大页里) */
+		shared_lock<shared_mutex> locker(mtx_);
+		auto it = files_.find(path);
+		if (it != files_.end() && SameFile(it->second->st, file->st))
+		{
+			file->data = it->second->data;
+			file->storage = it->second->storage;
+		}
+	}
+	if (file->storage)
+	{
+		close(fd);
+		metrics->Add(CACHE_REVALIDATED);
+	}
+	else
+	{
+		shared_ptr<string> content = make_shared<string>(file->st.st_size, '\0');
+		bool ok = ReadAll(fd, &(*content)[0], content->size());
+		close(fd);
+		if (!ok)
+		{
+			return nullptr;
+		}
+		file->data = content->data();
+		file->storage = content;
+		metrics->Add(CACHE_LOADS);
+	}
+
+	unique_lock<shared_mutex> locker(mtx_);
+	Insert_(path, file); // 缓存满了，这次直接用读到的内容，不放进缓存
+	return file;
+}
+
+bool FileCache::Insert_(const string &path, const shared_ptr<const CachedFile> &file)
+{
+	auto it = files_.find(path);
+	size_t oldBytes = it == files_.end() ? 0 : it->second->st.st_size;
+	size_t bytes = file->st.st_size;
+	if (totalBytes_ - oldBytes + bytes > maxTotalBytes_)
+	{
+		return false;
+	}
+	totalBytes_ = totalBytes_ - oldBytes + bytes;
+	files_[path] = file;
+	return true;
+}
+
+FileCache::WarmStats FileCache::Warm(const string &dir, bool hugePages)
+{
+	/* 启动时事件循环还没有运行，缓存的时钟不走，预热的耗时要现读 */
+	auto start = chrono::steady_clock::now();
+	WarmStats stats = {0, 0, 0, 0, "heap", 0};
+	vector<pair<string, struct stat>> files;
+	ListFiles(dir, files);
+
+	/* 能缓存的文件按缓存的总大小挑，小的优先(同样的内存能放下更多的文件) */
+	sort(files.begin(), files.end(), [](const pair<string, struct stat> &a, const pair<string, struct stat> &b)
+		 { return a.second.st_size < b.second.st_size; });
+	size_t budget = maxTotalBytes_ - min(maxTotalBytes_, TotalBytes());
+	size_t arenaLen = 0;
+	size_t small = 0;
+	for (; small < files.size() && static_cast<size_t>(files[small].second.st_size) <= maxFileSize_; small++)
+	{
+		size_t len = files[small].second.st_size;
+		if (stats.bytes + len > budget)
+		{
+			break;
+		}
+		stats.bytes += len;
+		arenaLen += (len + WARM_ALIGN - 1) / WARM_ALIGN * WARM_ALIGN;
+	}
+
+	size_t mapped = 0;
+	char *arena = arenaLen > 0 ? AllocWarm(arenaLen, hugePages, &stats.memory, &mapped) : nullptr;
+	shared_ptr<const void> arenaOwner;
+	if (arena)
+	{
+		arenaOwner.reset(arena, [mapped](const void *p)
+						 { munmap(const_cast<void *>(p), mapped); });
+	}
+	stats.bytes = 0;
+	size_t offset = 0;
+	for (size_t i = 0; i < small; i++)
+	{
+		if (!arena)
+		{
+			shared_ptr<const CachedFile> file = Load(files[i].first);
+			if (file)
+			{
+				stats.files++;
+				stats.bytes += file->st.st_size;
+			}
+			continue;
+		}
+		int fd = open(files[i].first.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			continue;
+		}
+		shared_ptr<CachedFile> file = make_shared<CachedFile>();
+		file->st = files[i].second;
+		file->data = arena + offset;
+		file->storage = arenaOwner;
+		file->loadMs = ClockService::Instance()->NowMs();
+		size_t len = file->st.st_size;
+		bool ok = fstat(fd, &file->st) == 0 && static_cast<size_t>(file->st.st_size) == len && ReadAll(fd, arena + offset, len);
+		close(fd);
+		if (!ok)
+		{
+			continue;
+		}
+		offset += (len + WARM_ALIGN - 1) / WARM_ALIGN * WARM_ALIGN;
+		unique_lock<shared_mutex> locker(mtx_);
+		if (Insert_(files[i].first, file))
+		{
+			stats.files++;
+			stats.bytes += len;
+		}
+	}
+
+	/* 太大不缓存的文件：每个请求还是各自mmap，这里先把内容读进页缓存，之后只有轻微的缺页 */
+	for (size_t i = small; i < files.size(); i++)
+	{
+		size_t len = files[i].second.st_size;
+		int fd = open(files[i].first.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || len == 0)
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			continue;
+		}
+		void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+		{
+			continue;
+		}
+		madvise(p, len, MADV_WILLNEED);
+		munmap(p, len);
+		stats.mappedFiles++;
+		stats.mappedBytes += len;
+	}
+	stats.ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+	return stats;
+}
+
+size_t FileCache::TotalBytes()
+{
+	shared_lock<shared_mutex> locker(mtx_);
+	return totalBytes_;
+}
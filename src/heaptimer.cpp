@@ -3,16 +3,15 @@
 void HeapTimer::siftup_(size_t i)
 {
 	assert(i >= 0 && i < heap_.size());
-	size_t j = (i - 1) / 2; // 定义i的父节点
-	while (j >= 0)
+	while (i > 0) // size_t永远>=0，必须用i>0判断是否到达堆顶
 	{
+		size_t j = (i - 1) / 2; // 定义i的父节点
 		if (heap_[j] < heap_[i])
 		{
 			break;
 		}
 		SwapNode_(i, j);
 		i = j;
-		j = (i - 1) / 2;
 	}
 }
 
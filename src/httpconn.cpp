@@ -1,4 +1,9 @@
 #include "httpconn.h"
+#include "accesslog.h"
+#include "metrics.h"
+#include "latencystats.h"
+#include "capture.h"
+#include "perfcounters.h"
 
 using namespace std;
 
@@ -6,12 +11,30 @@ const char *HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 
 bool HttpConn::isET = true;
+size_t HttpConn::readLimit = 0;
+std::string HttpConn::metricsPath;
+std::string HttpConn::tracePath;
+
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int SENT_BYTES = metrics->AddCounter("toy_http_sent_bytes_total", "Bytes written to client sockets");
+}
 
 HttpConn::HttpConn()
 {
 	fd_ = -1;
 	addr_ = {0};
 	isClose_ = true;
+	isBusy_ = false;
+	isPaused_ = false;
+	parseOk_ = false;
+	fileIov_ = {nullptr, 0};
+	acceptNs_ = arriveNs_ = parseStartNs_ = parseEndNs_ = handleEndNs_ = 0;
+	bytesSent_ = 0;
+	route_ = 0;
+	captureConn_ = 0;
+	traceId_ = 0;
 };
 
 HttpConn::~HttpConn()
@@ -28,18 +51,48 @@ void HttpConn::init(int fd, const sockaddr_in &addr)
 	// 初始化写缓冲和读缓冲
 	writeBuff_.RetrieveAll();
 	readBuff_.RetrieveAll();
+	fileIov_ = {nullptr, 0};
 	isClose_ = false;
+	isBusy_ = false;
+	isPaused_ = false;
+	acceptNs_ = NowNs_();
+	arriveNs_ = parseStartNs_ = parseEndNs_ = handleEndNs_ = 0;
+	bytesSent_ = 0;
+	captureConn_ = Capture::Instance()->Open(addr);
+	traceId_ = 0;
 	LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
+void HttpConn::ReleaseIdle()
+{
+	if (ToWriteBytes() == 0)
+	{
+		response_.UnmapFile();
+		fileIov_ = {nullptr, 0};
+		writeBuff_.Release();
+	}
+	readBuff_.Release(); // 还有没处理的数据时不会释放
+}
+
 void HttpConn::Close()
 {
 	response_.UnmapFile(); // 解除内存映射
+	fileIov_ = {nullptr, 0};
+	readBuff_.RetrieveAll();
+	writeBuff_.RetrieveAll();
+	readBuff_.Release();
+	writeBuff_.Release();
+	isPaused_ = false;
 	if (isClose_ == false)
 	{
 		isClose_ = true;
 		userCount--;
 		close(fd_);
+		if (captureConn_)
+		{
+			Capture::Instance()->Close(captureConn_);
+			captureConn_ = 0;
+		}
 		LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 	}
 }
@@ -66,8 +119,9 @@ int HttpConn::GetPort() const
 
 ssize_t HttpConn::read(int *saveErrno)
 {
-	// 一次性读出所有数据(ET+非阻塞)
+	// 一次性读出所有数据(ET+非阻塞)，读缓冲区到上限就停下，剩下的留在内核里(TCP窗口会让客户端慢下来)
 	ssize_t len = -1;
+	size_t before = readBuff_.ReadableBytes();
 	do
 	{
 		len = readBuff_.ReadFd(fd_, saveErrno);
@@ -75,51 +129,82 @@ ssize_t HttpConn::read(int *saveErrno)
 		{
 			break;
 		}
-	} while (isET);
+	} while (isET && !IsReadFull());
+	if (captureConn_ && readBuff_.ReadableBytes() > before)
+	{
+		CaptureRead_(before);
+	}
 	return len;
 }
 
+void HttpConn::CaptureRead_(size_t offset)
+{
+	struct iovec iov[MAX_IOV];
+	while (offset < readBuff_.ReadableBytes())
+	{
+		int cnt = readBuff_.ReadIovec(iov, MAX_IOV, offset);
+		if (cnt == 0)
+		{
+			break;
+		}
+		Capture::Instance()->Data(captureConn_, iov, cnt);
+		for (int i = 0; i < cnt; i++)
+		{
+			offset += iov[i].iov_len;
+		}
+	}
+}
+
 ssize_t HttpConn::write(int *saveErrno)
 {
+	TraceSpan span("write", traceId_);
+	PerfScope perf(PerfCounters::WRITE);
 	ssize_t len = -1;
 	do
 	{
-		// 分散写数据
-		len = writev(fd_, iov_, iovCnt_);
+		// 分散写数据：响应头所在的各个块，加上文件内容
+		struct iovec iov[MAX_IOV + 1];
+		int cnt = writeBuff_.ReadIovec(iov, MAX_IOV);
+		if (fileIov_.iov_len > 0)
+		{
+			iov[cnt++] = fileIov_;
+		}
+		len = writev(fd_, iov, cnt);
 		if (len <= 0)
 		{
 			*saveErrno = errno;
 			break;
 		}
-		// 这种情况是所有数据都传输结束了
-		if (iov_[0].iov_len + iov_[1].iov_len == 0)
+		// 先消耗缓冲区里的数据，剩下的是文件部分
+		size_t fromBuff = std::min(static_cast<size_t>(len), writeBuff_.ReadableBytes());
+		writeBuff_.Retrieve(fromBuff);
+		fileIov_.iov_base = (uint8_t *)fileIov_.iov_base + (len - fromBuff);
+		fileIov_.iov_len -= (len - fromBuff);
+		bytesSent_ += len;
+		metrics->Add(SENT_BYTES, len);
+		if (ToWriteBytes() == 0)
 		{
+			RequestDone_();
 			break;
 		} /* 传输结束 */
-		// 写到了第二块内存，做相应的处理
-		else if (static_cast<size_t>(len) > iov_[0].iov_len)
-		{
-			iov_[1].iov_base = (uint8_t *)iov_[1].iov_base + (len - iov_[0].iov_len);
-			iov_[1].iov_len -= (len - iov_[0].iov_len);
-			if (iov_[0].iov_len)
-			{
-				writeBuff_.RetrieveAll();
-				iov_[0].iov_len = 0;
-			}
-		}
-		// 还没有写到第二块内存的数据
-		else
-		{
-			iov_[0].iov_base = (uint8_t *)iov_[0].iov_base + len;
-			iov_[0].iov_len -= len;
-			writeBuff_.Retrieve(len);
-		}
 	} while (isET || ToWriteBytes() > 10240);
 	return len;
 }
 
 // 业务逻辑处理
 bool HttpConn::process()
+{
+	if (!parse())
+	{
+		return false;
+	}
+	verify();
+	respond();
+	return true;
+}
+
+// 解析请求，没有请求数据或者请求头还不完整时返回false
+bool HttpConn::parse()
 {
 	// 初始化请求对象
 	request_.Init();
@@ -128,8 +213,54 @@ bool HttpConn::process()
 	{ // 没有请求数据
 		return false;
 	}
-	else if (request_.parse(readBuff_))
-	{ // 解析请求数据
+	/* 请求头还没收完整就先不解析，等数据读够(读缓冲区满了还不完整，由调用者拒绝) */
+	const char END[] = "\r\n\r\n";
+	const char *begin = readBuff_.Peek();
+	const char *end = begin + readBuff_.ReadableBytes();
+	if (search(begin, end, END, END + 4) == end)
+	{
+		return false;
+	}
+	parseStartNs_ = NowNs_();
+	if (arriveNs_ == 0)
+	{
+		arriveNs_ = parseStartNs_; // 同一次读到的下一个请求(流水线)，没有排队时间
+		traceId_ = Tracer::Instance()->Sample();
+	}
+	TraceSpan span("parse", traceId_);
+	PerfScope perf(PerfCounters::PROCESS);
+	parseOk_ = request_.parse(readBuff_); // 解析请求数据
+	path_ = request_.path();
+	route_ = LatencyStats::Instance()->RouteOf(path_);
+	parseEndNs_ = NowNs_();
+	return true;
+}
+
+// 登录、注册请求查数据库，其他请求什么也不做
+void HttpConn::verify()
+{
+	if (parseOk_)
+	{
+		TraceSpan span("verify", traceId_);
+		PerfScope perf(PerfCounters::PROCESS);
+		request_.Verify();
+	}
+}
+
+bool HttpConn::IsCheap() const
+{
+	return parseOk_ && !request_.NeedsVerify() && !IsMetrics_() && !IsTrace_() &&
+		   FileCache::Instance()->Find(std::string(srcDir) + request_.path()) != nullptr;
+}
+
+// 生成响应
+void HttpConn::respond()
+{
+	TraceSpan span("respond", traceId_);
+	PerfScope perf(PerfCounters::PROCESS);
+	PerfCounters::Instance()->CountRequest();
+	if (parseOk_)
+	{
 		LOG_DEBUG("%s", request_.path().c_str());
 		// 解析完请求数据以后，初始化响应对象
 		response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
@@ -140,20 +271,111 @@ bool HttpConn::process()
 		response_.Init(srcDir, request_.path(), false, 400); // 请求报文中有语法错误
 	}
 
+	if (IsMetrics_() || IsTrace_())
+	{
+		/* 指标和追踪不是文件，抓取的时候汇总所有线程的计数或者缓冲区 */
+		response_.MakeResponse(writeBuff_, IsMetrics_() ? Metrics::Instance()->Scrape() : TraceControl_());
+		fileIov_ = {nullptr, 0};
+		handleEndNs_ = NowNs_();
+		return;
+	}
+
 	// 生成响应信息（writeBuff_中保存着响应的一些信息）
 	response_.MakeResponse(writeBuff_);
-	/* 响应头 */
-	iov_[0].iov_base = const_cast<char *>(writeBuff_.Peek());
-	iov_[0].iov_len = writeBuff_.ReadableBytes();
-	iovCnt_ = 1;
-
+	/* 响应头留在writeBuff_的块里，发送时直接组成iovec */
+	fileIov_ = {nullptr, 0};
 	/* 文件 */
 	if (response_.FileLen() > 0 && response_.File())
 	{
-		iov_[1].iov_base = response_.File();
-		iov_[1].iov_len = response_.FileLen();
-		iovCnt_ = 2;
+		fileIov_.iov_base = response_.File();
+		fileIov_.iov_len = response_.FileLen();
+	}
+	handleEndNs_ = NowNs_();
+	LOG_DEBUG("filesize:%d, to %d", response_.FileLen(), ToWriteBytes());
+}
+
+string HttpConn::TraceControl_() const
+{
+	Tracer *tracer = Tracer::Instance();
+	const string &path = request_.path();
+	if (path == tracePath + "/on")
+	{
+		/* 重新打开时丢掉上一轮的span，导出的只有这一轮 */
+		tracer->Clear();
+		tracer->Enable(true);
+		return "tracing on\n";
+	}
+	if (path == tracePath + "/off")
+	{
+		tracer->Enable(false);
+		return "tracing off\n";
+	}
+	return tracer->ExportJson();
+}
+
+int64_t HttpConn::NowNs_()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void HttpConn::RequestDone_()
+{
+	if (handleEndNs_ > 0)
+	{
+		int64_t now = NowNs_();
+		RecordLatency_(now);
+		LogAccess_(now);
+	}
+	if (captureConn_)
+	{
+		Capture::Instance()->Response(captureConn_, response_.Code(), bytesSent_);
+	}
+	/* 下一个请求重新计时 */
+	arriveNs_ = parseStartNs_ = parseEndNs_ = handleEndNs_ = 0;
+	traceId_ = 0;
+	bytesSent_ = 0;
+}
+
+void HttpConn::RecordLatency_(int64_t now)
+{
+	LatencyStats *stats = LatencyStats::Instance();
+	int route = route_;
+	if (acceptNs_ > 0)
+	{
+		stats->Record(route, LatencyStats::ACCEPT, (arriveNs_ - acceptNs_) / 1000);
+		acceptNs_ = 0;
+	}
+	stats->Record(route, LatencyStats::QUEUE, (parseStartNs_ - arriveNs_) / 1000);
+	stats->Record(route, LatencyStats::PARSE, (parseEndNs_ - parseStartNs_) / 1000);
+	stats->Record(route, LatencyStats::HANDLE, (handleEndNs_ - parseEndNs_) / 1000);
+	stats->Record(route, LatencyStats::WRITE, (now - handleEndNs_) / 1000);
+	stats->Record(route, LatencyStats::TOTAL, (now - arriveNs_) / 1000);
+}
+
+void HttpConn::LogAccess_(int64_t now)
+{
+	AccessLog *log = AccessLog::Instance();
+	if (log->IsEnabled())
+	{
+		int status = response_.Code();
+		if (log->ShouldLog(status, (now - arriveNs_) / 1000))
+		{
+			AccessRecord record;
+			memset(&record, 0, sizeof(record));
+			record.wallUs = ClockService::Instance()->ReadWallUs() - (now - arriveNs_) / 1000;
+			record.queueUs = static_cast<uint32_t>((parseStartNs_ - arriveNs_) / 1000);
+			record.parseUs = static_cast<uint32_t>((parseEndNs_ - parseStartNs_) / 1000);
+			record.handleUs = static_cast<uint32_t>((handleEndNs_ - parseEndNs_) / 1000);
+			record.writeUs = static_cast<uint32_t>((now - handleEndNs_) / 1000);
+			record.bytes = static_cast<uint32_t>(bytesSent_);
+			record.status = static_cast<uint16_t>(status);
+			record.port = ntohs(addr_.sin_port);
+			record.ip = addr_.sin_addr.s_addr;
+			strncpy(record.method, request_.method().c_str(), sizeof(record.method) - 1);
+			strncpy(record.path, path_.c_str(), sizeof(record.path) - 1);
+			log->Append(record);
+		}
 	}
-	LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen(), iovCnt_, ToWriteBytes());
-	return true;
 }
\ No newline at end of file
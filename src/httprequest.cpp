@@ -1,4 +1,5 @@
 #include "httprequest.h"
+#include "trace.h"
 using namespace std;
 
 const unordered_set<string> HttpRequest::DEFAULT_HTML{
@@ -22,6 +23,8 @@ void HttpRequest::Init()
 	state_ = REQUEST_LINE; // 初始状态是请求首行
 	header_.clear();
 	post_.clear();
+	needVerify_ = false;
+	isLogin_ = false;
 }
 
 bool HttpRequest::IsKeepAlive() const
@@ -169,20 +172,31 @@ void HttpRequest::ParsePost_()
 			LOG_DEBUG("Tag:%d", tag);
 			if (tag == 0 || tag == 1)
 			{
-				bool isLogin = (tag == 1);
-				if (UserVerify(post_["username"], post_["password"], isLogin))
-				{
-					path_ = "/welcome.html";
-				}
-				else
-				{
-					path_ = "/error.html";
-				}
+				needVerify_ = true;
+				isLogin_ = (tag == 1);
 			}
 		}
 	}
 }
 
+// 查数据库验证用户，根据结果改写要返回的页面
+void HttpRequest::Verify()
+{
+	if (!needVerify_)
+	{
+		return;
+	}
+	needVerify_ = false;
+	if (UserVerify(post_["username"], post_["password"], isLogin_))
+	{
+		path_ = "/welcome.html";
+	}
+	else
+	{
+		path_ = "/error.html";
+	}
+}
+
 void HttpRequest::ParseFromUrlencoded_()
 {
 	if (body_.size() == 0)
@@ -239,9 +253,16 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
 	{
 		return false;
 	}
+	TraceSpan span("UserVerify");
 	LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
 	MYSQL *sql;
-	SqlConnRAII(&sql, SqlConnPool::Instance());
+	/* 连接要拿到函数结束才还；等连接的时间(连接池空了会在这里等)单独记一个span */
+	int64_t acquireNs = span.IsActive() ? Tracer::NowNs() : 0;
+	SqlConnRAII conn(&sql, SqlConnPool::Instance());
+	if (acquireNs)
+	{
+		Tracer::Instance()->Record("sql_acquire", Tracer::CurrentId(), acquireNs, Tracer::NowNs());
+	}
 	assert(sql);
 
 	bool flag = false;
@@ -258,12 +279,15 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
 	snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
 	LOG_DEBUG("%s", order);
 
-	if (mysql_query(sql, order))
 	{
-		mysql_free_result(res);
-		return false;
+		TraceSpan query("sql_query");
+		if (mysql_query(sql, order))
+		{
+			mysql_free_result(res);
+			return false;
+		}
+		res = mysql_store_result(sql);
 	}
-	res = mysql_store_result(sql);
 	j = mysql_num_fields(res);
 	fields = mysql_fetch_fields(res);
 
@@ -306,7 +330,6 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
 		}
 		flag = true;
 	}
-	SqlConnPool::Instance()->FreeConn(sql);
 	LOG_DEBUG("UserVerify success!!");
 	return flag;
 }
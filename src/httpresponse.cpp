@@ -1,7 +1,40 @@
 #include "httpresponse.h"
+#include "metrics.h"
+#include "trace.h"
 
 using namespace std;
 
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int RESP_200 = metrics->AddCounter("toy_http_responses_total{code=\"200\"}", "Responses generated, by status code");
+	const int RESP_400 = metrics->AddCounter("toy_http_responses_total{code=\"400\"}", "");
+	const int RESP_403 = metrics->AddCounter("toy_http_responses_total{code=\"403\"}", "");
+	const int RESP_404 = metrics->AddCounter("toy_http_responses_total{code=\"404\"}", "");
+	const int BODY_CACHED = metrics->AddCounter("toy_static_bodies_total{source=\"cache\"}", "Static file bodies served, by where the content came from");
+	const int BODY_MMAP = metrics->AddCounter("toy_static_bodies_total{source=\"mmap\"}", "");
+	const int BODY_BYTES = metrics->AddCounter("toy_static_body_bytes_total", "Static file bytes put into responses");
+
+	void CountCode(int code)
+	{
+		switch (code)
+		{
+		case 200:
+			metrics->Add(RESP_200);
+			break;
+		case 403:
+			metrics->Add(RESP_403);
+			break;
+		case 404:
+			metrics->Add(RESP_404);
+			break;
+		default:
+			metrics->Add(RESP_400);
+			break;
+		}
+	}
+}
+
 // 文件后缀 对应的 MIME-TYPE类型，用在响应头Content-Type中
 const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
 	{".html", "text/html"},
@@ -58,7 +91,7 @@ void HttpResponse::Init(const string &srcDir, string &path, bool isKeepAlive, in
 {
 	assert(srcDir != "");
 
-	if (mmFile_)
+	if (mmFile_ || cached_)
 	{
 		UnmapFile();
 	}
@@ -73,10 +106,16 @@ void HttpResponse::Init(const string &srcDir, string &path, bool isKeepAlive, in
 
 void HttpResponse::MakeResponse(Buffer &buff)
 {
+	TraceSpan span("MakeResponse");
 	/* 判断请求的资源文件 */
 	// index.html
 	// /home/nowcoder/WebServer-master/resources/index.html
-	if (stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode))
+	cached_ = FileCache::Instance()->Find(srcDir_ + path_);
+	if (cached_)
+	{
+		mmFileStat_ = cached_->st; // 命中缓存，不用stat
+	}
+	if ((!cached_ && stat((srcDir_ + path_).data(), &mmFileStat_) < 0) || S_ISDIR(mmFileStat_.st_mode))
 	{
 		code_ = 404; // 服务器上无法找到请求的资源
 	}
@@ -92,11 +131,28 @@ void HttpResponse::MakeResponse(Buffer &buff)
 	AddStateLine_(buff);
 	AddHeader_(buff);
 	AddContent_(buff);
+	CountCode(code_);
+}
+
+// 响应体不是文件(比如/metrics)，直接放在缓冲区里
+void HttpResponse::MakeResponse(Buffer &buff, const string &body)
+{
+	UnmapFile();
+	mmFileStat_ = {0};
+	if (code_ == -1)
+	{
+		code_ = 200;
+	}
+	AddStateLine_(buff);
+	AddHeader_(buff);
+	buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+	buff.Append(body);
+	CountCode(code_);
 }
 
 char *HttpResponse::File()
 {
-	return mmFile_;
+	return cached_ ? const_cast<char *>(cached_->data) : mmFile_;
 }
 
 size_t HttpResponse::FileLen() const
@@ -109,6 +165,7 @@ void HttpResponse::ErrorHtml_()
 	if (CODE_PATH.count(code_) == 1)
 	{
 		path_ = CODE_PATH.find(code_)->second;
+		cached_.reset();
 		stat((srcDir_ + path_).data(), &mmFileStat_);
 	}
 }
@@ -143,11 +200,29 @@ void HttpResponse::AddHeader_(Buffer &buff)
 		buff.Append("close\r\n");
 	}
 	buff.Append("Content-type: " + GetFileType_() + "\r\n");
+	buff.Append("Date: ");
+	buff.Append(ClockService::Instance()->HttpDate(), ClockService::HTTP_DATE_LEN);
+	buff.Append("\r\n", 2);
 }
 
 // 添加响应体
 void HttpResponse::AddContent_(Buffer &buff)
 {
+	/* 小文件放进缓存，之后的请求直接用缓存里的内容 */
+	FileCache *cache = FileCache::Instance();
+	if (!cached_ && static_cast<size_t>(mmFileStat_.st_size) <= cache->MaxFileSize())
+	{
+		cached_ = cache->Load(srcDir_ + path_);
+	}
+	if (cached_)
+	{
+		mmFileStat_ = cached_->st;
+		metrics->Add(BODY_CACHED);
+		metrics->Add(BODY_BYTES, mmFileStat_.st_size);
+		buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+		return;
+	}
+
 	int srcFd = open((srcDir_ + path_).data(), O_RDONLY); // 得到资源文件的文件描述符
 	if (srcFd < 0)
 	{
@@ -166,12 +241,15 @@ void HttpResponse::AddContent_(Buffer &buff)
 	}
 	mmFile_ = (char *)mmRet;
 	close(srcFd);
+	metrics->Add(BODY_MMAP);
+	metrics->Add(BODY_BYTES, mmFileStat_.st_size);
 	buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
 }
 
 // 解除内存映射
 void HttpResponse::UnmapFile()
 {
+	cached_.reset();
 	if (mmFile_)
 	{
 		munmap(mmFile_, mmFileStat_.st_size);
@@ -0,0 +1,214 @@
+#include "latencystats.h"
+#include "metrics.h"
+
+#include <cstdio>
+
+using namespace std;
+
+const int LatencyStats::MAX_ROUTES;
+
+// 线程退出时把直方图并进retired_
+struct LatencyHolder
+{
+	LatencyStats::ThreadHists *local = nullptr;
+	bool exited = false;
+	~LatencyHolder()
+	{
+		exited = true;
+		if (local)
+		{
+			LatencyStats::Instance()->Retire_(local);
+			local = nullptr;
+		}
+	}
+};
+
+namespace
+{
+	thread_local LatencyHolder holder;
+
+	const char *PHASE_NAME[] = {"accept", "queue", "parse", "handle", "write", "total"};
+	const double QUANTILES[] = {0.5, 0.99, 0.999};
+	const char *QUANTILE_NAME[] = {"0.5", "0.99", "0.999"};
+}
+
+LatencyStats::ThreadHists::ThreadHists()
+{
+	for (int r = 0; r < MAX_ROUTES; r++)
+	{
+		for (int p = 0; p < PHASE_COUNT; p++)
+		{
+			hists[r][p].store(nullptr, memory_order_relaxed);
+		}
+	}
+}
+
+LatencyStats::ThreadHists::~ThreadHists()
+{
+	for (int r = 0; r < MAX_ROUTES; r++)
+	{
+		for (int p = 0; p < PHASE_COUNT; p++)
+		{
+			delete hists[r][p].load(memory_order_relaxed);
+		}
+	}
+}
+
+// 页面都是静态文件，路由表就是这几个固定的页面，其他路径(图片、样式、404)算作other
+LatencyStats::LatencyStats() : routes_({"/index.html", "/login.html", "/register.html", "/welcome.html",
+										"/picture.html", "/video.html", "/metrics", "other"})
+{
+	/* 第一次记录时才创建，之前没有数据，不输出也没关系 */
+	Metrics::Instance()->AddCollector([this](string &out)
+									  { AppendMetrics(out); });
+}
+
+// 用new出来的对象并且不释放：进程退出时分离的线程可能还在记录
+LatencyStats *LatencyStats::Instance()
+{
+	static LatencyStats *inst = new LatencyStats;
+	return inst;
+}
+
+int LatencyStats::RouteOf(const string &path) const
+{
+	int other = static_cast<int>(routes_.size()) - 1;
+	for (int i = 0; i < other; i++)
+	{
+		if (routes_[i] == path)
+		{
+			return i;
+		}
+	}
+	return other;
+}
+
+LatencyStats::ThreadHists *LatencyStats::Local_()
+{
+	if (!holder.local)
+	{
+		if (holder.exited)
+		{
+			return nullptr; // 线程正在退出，不再记录
+		}
+		holder.local = new ThreadHists();
+		lock_guard<mutex> locker(mtx_);
+		threads_.push_back(holder.local);
+	}
+	return holder.local;
+}
+
+void LatencyStats::Record(int route, Phase phase, uint64_t us)
+{
+	ThreadHists *local = Local_();
+	if (!local)
+	{
+		return;
+	}
+	HdrHistogram *hist = local->hists[route][phase].load(memory_order_relaxed);
+	if (!hist)
+	{
+		/* 第一次用到这个(路由, 阶段)才分配，release保证读的线程看到初始化好的直方图 */
+		hist = new HdrHistogram();
+		local->hists[route][phase].store(hist, memory_order_release);
+	}
+	hist->Record(us);
+}
+
+void LatencyStats::Retire_(ThreadHists *local)
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		for (size_t i = 0; i < threads_.size(); i++)
+		{
+			if (threads_[i] == local)
+			{
+				threads_[i] = threads_.back();
+				threads_.pop_back();
+				break;
+			}
+		}
+		for (int r = 0; r < MAX_ROUTES; r++)
+		{
+			for (int p = 0; p < PHASE_COUNT; p++)
+			{
+				HdrHistogram *hist = local->hists[r][p].load(memory_order_acquire);
+				if (hist)
+				{
+					if (!retired_[r][p])
+					{
+						retired_[r][p].reset(new HdrHistogram::Snapshot());
+					}
+					retired_[r][p]->Add(*hist);
+				}
+			}
+		}
+	}
+	delete local;
+}
+
+void LatencyStats::Merge_(int route, int phase, HdrHistogram::Snapshot &snapshot)
+{
+	snapshot.Reset();
+	if (retired_[route][phase])
+	{
+		snapshot.Add(*retired_[route][phase]);
+	}
+	for (ThreadHists *local : threads_)
+	{
+		HdrHistogram *hist = local->hists[route][phase].load(memory_order_acquire);
+		if (hist)
+		{
+			snapshot.Add(*hist);
+		}
+	}
+}
+
+uint64_t LatencyStats::Quantile(int route, Phase phase, double q)
+{
+	unique_ptr<HdrHistogram::Snapshot> snapshot(new HdrHistogram::Snapshot());
+	lock_guard<mutex> locker(mtx_);
+	Merge_(route, phase, *snapshot);
+	return snapshot->Quantile(q);
+}
+
+void LatencyStats::AppendMetrics(string &out)
+{
+	out += "# HELP toy_request_phase_seconds Request latency by route and phase (HDR histogram quantiles)\n";
+	out += "# TYPE toy_request_phase_seconds summary\n";
+	unique_ptr<HdrHistogram::Snapshot> snapshot(new HdrHistogram::Snapshot());
+	unique_ptr<HdrHistogram::Snapshot[]> all(new HdrHistogram::Snapshot[PHASE_COUNT]);
+	char line[256];
+	lock_guard<mutex> locker(mtx_);
+	for (int r = 0; r <= static_cast<int>(routes_.size()); r++)
+	{
+		/* 最后一轮输出所有路由合并的结果 */
+		bool isAll = r == static_cast<int>(routes_.size());
+		const char *route = isAll ? "all" : routes_[r].c_str();
+		for (int p = 0; p < PHASE_COUNT; p++)
+		{
+			HdrHistogram::Snapshot &s = isAll ? all[p] : *snapshot;
+			if (!isAll)
+			{
+				Merge_(r, p, s);
+				all[p].Add(s);
+			}
+			if (s.total == 0)
+			{
+				continue;
+			}
+			for (size_t i = 0; i < sizeof(QUANTILES) / sizeof(QUANTILES[0]); i++)
+			{
+				snprintf(line, sizeof(line), "toy_request_phase_seconds{route=\"%s\",phase=\"%s\",quantile=\"%s\"} %.6f\n",
+						 route, PHASE_NAME[p], QUANTILE_NAME[i], s.Quantile(QUANTILES[i]) / 1e6);
+				out += line;
+			}
+			snprintf(line, sizeof(line), "toy_request_phase_seconds_sum{route=\"%s\",phase=\"%s\"} %.6f\n",
+					 route, PHASE_NAME[p], s.sum / 1e6);
+			out += line;
+			snprintf(line, sizeof(line), "toy_request_phase_seconds_count{route=\"%s\",phase=\"%s\"} %llu\n",
+					 route, PHASE_NAME[p], static_cast<unsigned long long>(s.total));
+			out += line;
+		}
+	}
+}
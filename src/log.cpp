@@ -1,71 +1,66 @@
 #include "log.h"
+#include "affinity.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <chrono>
 
 using namespace std;
 
+const int Log::FLUSH_INTERVAL_MS;
+const int Log::DRAIN_INTERVAL_MS;
+const size_t Log::MAX_DRAIN_RECORDS;
+const size_t Log::MAX_PENDING_BUFFERS;
+
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int LOG_LINES = metrics->AddCounter("toy_log_lines_total", "Log lines written to the file by the async writer");
+	const int LOG_BYTES = metrics->AddCounter("toy_log_written_bytes_total", "Log bytes written to the file by the async writer");
+	const int LOG_DROPPED = metrics->AddCounter("toy_log_dropped_total", "Log lines or records dropped because the writer fell behind");
+	const int LOG_PENDING = metrics->AddGauge("toy_log_pending_buffers", "Full log buffers handed to the writer in its last batch");
+}
+
 Log::Log()
 {
 	lineCount_ = 0;
+	isOpen_ = false;
+	level_ = 1;
 	isAsync_ = false;
+	running_ = false;
+	writerCpu_ = -1;
+	bufferSize_ = 0;
+	dropped_ = 0;
+	flushNow_ = false;
+	drainNow_ = false;
 	writeThread_ = nullptr;
-	deque_ = nullptr;
 	toDay_ = 0;
-	fp_ = nullptr;
+	part_ = 0;
+	fd_ = -1;
 }
 
 Log::~Log()
 {
 	if (writeThread_ && writeThread_->joinable())
 	{
-		while (!deque_->empty())
 		{
-			deque_->flush();
-		};
-		deque_->Close();
-		writeThread_->join();
+			lock_guard<mutex> locker(mtx_);
+			running_ = false;
+		}
+		cond_.notify_one();
+		writeThread_->join(); // 写线程退出前会把剩下的缓冲区写完
 	}
-	if (fp_)
+	if (fd_ >= 0)
 	{
-		lock_guard<mutex> locker(mtx_);
-		flush();
-		fclose(fp_);
+		close(fd_);
 	}
 }
 
-int Log::GetLevel()
-{
-	lock_guard<mutex> locker(mtx_);
-	return level_;
-}
-
-void Log::SetLevel(int level)
-{
-	lock_guard<mutex> locker(mtx_);
-	level_ = level;
-}
-
 void Log::init(int level = 1, const char *path, const char *suffix,
-			   int maxQueueSize)
+			   int bufferSizeKB, int writerCpu)
 {
-	isOpen_ = true;
 	level_ = level;
-	if (maxQueueSize > 0)
-	{
-		isAsync_ = true;
-		if (!deque_)
-		{
-			unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-			deque_ = move(newDeque);
-
-			std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
-			writeThread_ = move(NewThread); // 写线程
-		}
-	}
-	else
-	{
-		isAsync_ = false;
-	}
-
-	lineCount_ = 0;
+	writerCpu_ = writerCpu;
 
 	time_t timer = time(nullptr);
 	struct tm *sysTime = localtime(&timer);
@@ -73,134 +68,370 @@ void Log::init(int level = 1, const char *path, const char *suffix,
 
 	path_ = path;
 	suffix_ = suffix;
-	char fileName[LOG_NAME_LEN] = {0};
-	snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
-			 path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-	toDay_ = t.tm_mday;
 
 	{
 		lock_guard<mutex> locker(mtx_);
-		buff_.RetrieveAll();
-		if (fp_)
-		{
-			flush();
-			fclose(fp_);
-		}
+		lineCount_ = 0;
+		part_ = 0;
+		toDay_ = t.tm_mday;
+		OpenFile_(t, 0);
+	}
 
-		fp_ = fopen(fileName, "a");
-		if (fp_ == nullptr)
+	if (bufferSizeKB > 0)
+	{
+		isAsync_ = true;
+		if (!writeThread_)
 		{
-			mkdir(path_, 0777);
-			fp_ = fopen(fileName, "a");
+			bufferSize_ = static_cast<size_t>(bufferSizeKB) << 10;
+			current_.reset(new LogBuffer(bufferSize_));
+			next_.reset(new LogBuffer(bufferSize_));
+			drained_.reset(new LogBuffer(bufferSize_));
+			buffers_.reserve(MAX_PENDING_BUFFERS);
+			running_ = true;
+
+			std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
+			writeThread_ = move(NewThread); // 写线程
 		}
-		assert(fp_ != nullptr);
 	}
+	else
+	{
+		isAsync_ = false;
+	}
+	isOpen_ = true;
 }
 
 void Log::write(int level, const char *format, ...)
 {
-	struct timeval now = {0, 0};
-	gettimeofday(&now, nullptr);
-	time_t tSec = now.tv_sec;
-	struct tm *sysTime = localtime(&tSec);
-	struct tm t = *sysTime;
-	va_list vaList;
+	/* 时间戳由时钟服务按秒缓存，这里不再调用gettimeofday和localtime；整行在锁外格式化 */
+	struct tm t;
+	char line[LINE_LEN];
+	int n = ClockService::Instance()->FormatLogTime(line, ClockService::LOG_TIME_LEN + 1, &t);
+	n += AppendLogLevelTitle_(level, line + n);
 
-	/* 日志日期 日志行数 */
-	if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_ % MAX_LINES == 0)))
-	{
-		unique_lock<mutex> locker(mtx_);
-		locker.unlock();
+	va_list vaList;
+	va_start(vaList, format);
+	int m = vsnprintf(line + n, LINE_LEN - n - 1, format, vaList);
+	va_end(vaList);
 
-		char newFile[LOG_NAME_LEN];
-		char tail[36] = {0};
-		snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+	n += std::max(0, std::min(m, LINE_LEN - n - 2)); // 超长的行被截断
+	line[n++] = '\n';
 
-		if (toDay_ != t.tm_mday)
-		{
-			snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-			toDay_ = t.tm_mday;
-			lineCount_ = 0;
-		}
-		else
+	lock_guard<mutex> locker(mtx_);
+	if (!isAsync_)
+	{
+		/* 同步模式直接写文件 */
+		RollFile_(1);
+		if (::write(fd_, line, n) < 0)
 		{
-			snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_ / MAX_LINES), suffix_);
+			perror("write log");
 		}
-
-		locker.lock();
-		flush();
-		fclose(fp_);
-		fp_ = fopen(newFile, "a");
-		assert(fp_ != nullptr);
+		return;
 	}
-
+	AppendLocked_(line, n);
+	if (level >= 2 || buffers_.size() == 1)
 	{
-		unique_lock<mutex> locker(mtx_);
-		lineCount_++;
-		int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-						 t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-						 t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
-
-		buff_.HasWritten(n);
-		AppendLogLevelTitle_(level);
-
-		va_start(vaList, format);
-		int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-		va_end(vaList);
-
-		buff_.HasWritten(m);
-		buff_.Append("\n\0", 2);
+		cond_.notify_one(); // 有缓冲区写满了，或者是警告和错误，叫醒写线程
+	}
+}
 
-		if (isAsync_ && deque_ && !deque_->full())
-		{
-			deque_->push_back(buff_.RetrieveAllToStr());
-		}
-		else
-		{
-			fputs(buff_.Peek(), fp_);
-		}
-		buff_.RetrieveAll();
+void Log::AppendLocked_(const char *line, size_t len, size_t lines)
+{
+	if (current_->Avail() < len)
+	{
+		/* 当前缓冲区写满了，排队等写线程，换上备用的 */
+		buffers_.push_back(move(current_));
+		current_ = next_ ? move(next_) : BufferPtr(new LogBuffer(bufferSize_));
 	}
+	current_->Append(line, len, lines);
 }
 
-void Log::AppendLogLevelTitle_(int level)
+int Log::AppendLogLevelTitle_(int level, char *buf)
 {
 	switch (level)
 	{
 	case 0:
-		buff_.Append("[debug]: ", 9);
+		memcpy(buf, "[debug]: ", 9);
 		break;
 	case 1:
-		buff_.Append("[info] : ", 9);
+		memcpy(buf, "[info] : ", 9);
 		break;
 	case 2:
-		buff_.Append("[warn] : ", 9);
+		memcpy(buf, "[warn] : ", 9);
 		break;
 	case 3:
-		buff_.Append("[error]: ", 9);
+		memcpy(buf, "[error]: ", 9);
 		break;
 	default:
-		buff_.Append("[info] : ", 9);
+		memcpy(buf, "[info] : ", 9);
 		break;
 	}
+	return 9;
 }
 
 void Log::flush()
 {
 	if (isAsync_)
 	{
-		deque_->flush();
+		flushNow_.store(true, memory_order_relaxed);
+		cond_.notify_one();
 	}
-	fflush(fp_);
 }
 
-void Log::AsyncWrite_()
+void Log::OpenFile_(const struct tm &t, int part)
+{
+	char fileName[LOG_NAME_LEN];
+	char tail[36] = {0};
+	snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+	if (part == 0)
+	{
+		snprintf(fileName, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
+	}
+	else
+	{
+		snprintf(fileName, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, part, suffix_);
+	}
+
+	if (fd_ >= 0)
+	{
+		close(fd_);
+	}
+	fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd_ < 0)
+	{
+		mkdir(path_, 0777);
+		fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	}
+	assert(fd_ >= 0);
+}
+
+// 同步模式在锁里调用，异步模式只在写线程里调用
+void Log::RollFile_(size_t lines)
+{
+	struct tm t;
+	char timeStr[ClockService::LOG_TIME_LEN + 1];
+	ClockService::Instance()->FormatLogTime(timeStr, sizeof(timeStr), &t);
+	if (toDay_ != t.tm_mday)
+	{
+		toDay_ = t.tm_mday;
+		lineCount_ = 0;
+		part_ = 0;
+		OpenFile_(t, 0);
+	}
+	else if (lineCount_ > 0 && lineCount_ + static_cast<int>(lines) > MAX_LINES)
+	{
+		lineCount_ = 0;
+		OpenFile_(t, ++part_);
+	}
+	lineCount_ += lines;
+}
+
+// 一次writev把所有缓冲区写出去，没写完的接着写
+void Log::WriteFile_(const vector<BufferPtr> &buffers)
+{
+	struct iovec iov[MAX_PENDING_BUFFERS + 1];
+	int cnt = 0;
+	size_t lines = 0;
+	for (const BufferPtr &buffer : buffers)
+	{
+		if (buffer->Length() > 0 && cnt < static_cast<int>(MAX_PENDING_BUFFERS + 1))
+		{
+			iov[cnt].iov_base = const_cast<char *>(buffer->Data());
+			iov[cnt].iov_len = buffer->Length();
+			lines += buffer->Lines();
+			cnt++;
+		}
+	}
+	if (cnt == 0)
+	{
+		return;
+	}
+	RollFile_(lines);
+	metrics->Add(LOG_LINES, lines);
+	for (int i = 0; i < cnt; i++)
+	{
+		metrics->Add(LOG_BYTES, iov[i].iov_len);
+	}
+	struct iovec *cur = iov;
+	while (cnt > 0)
+	{
+		ssize_t len = writev(fd_, cur, cnt);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("write log");
+			return;
+		}
+		while (cnt > 0 && static_cast<size_t>(len) >= cur->iov_len)
+		{
+			len -= cur->iov_len;
+			cur++;
+			cnt--;
+		}
+		if (cnt > 0)
+		{
+			cur->iov_base = static_cast<char *>(cur->iov_base) + len;
+			cur->iov_len -= len;
+		}
+	}
+}
+
+// 按时间戳把各线程环里的记录归并，在锁外格式化成文本，攒满drained_或者取完了才加锁追加到当前缓冲区
+bool Log::DrainRings_()
+{
+	LogRing::Collect(rings_);
+	char line[LINE_LEN];
+	size_t dropped = 0;
+	bool more = true;
+	for (size_t i = 0; i < MAX_DRAIN_RECORDS; i++)
+	{
+		LogRing *oldest = nullptr;
+		const LogRing::Header *record = nullptr;
+		for (const shared_ptr<LogRing> &ring : rings_)
+		{
+			const LogRing::Header *front = ring->Front();
+			if (front && (!record || front->wallUs < record->wallUs))
+			{
+				oldest = ring.get();
+				record = front;
+			}
+		}
+		if (!record)
+		{
+			more = false;
+			break;
+		}
+		int n = ClockService::Instance()->FormatLogTimeAt(record->wallUs, line, ClockService::LOG_TIME_LEN + 1, nullptr);
+		n += AppendLogLevelTitle_(record->level, line + n);
+		n += LogRing::FormatArgs(record, line + n, LINE_LEN - n - 1);
+		line[n++] = '\n';
+		oldest->Pop();
+		if (drained_->Avail() < static_cast<size_t>(n))
+		{
+			MergeDrained_();
+		}
+		drained_->Append(line, n);
+	}
+	for (const shared_ptr<LogRing> &ring : rings_)
+	{
+		dropped += ring->TakeDropped();
+	}
+	if (dropped > 0)
+	{
+		dropped_ += dropped;
+		metrics->Add(LOG_DROPPED, dropped);
+		int n = ClockService::Instance()->FormatLogTime(line, ClockService::LOG_TIME_LEN + 1, nullptr);
+		n += snprintf(line + n, LINE_LEN - n, "[warn] : Log ring full, dropped %zu records, %zu in total\n", dropped, dropped_);
+		if (drained_->Avail() < static_cast<size_t>(n))
+		{
+			MergeDrained_();
+		}
+		drained_->Append(line, n);
+	}
+	MergeDrained_();
+	return more;
+}
+
+void Log::MergeDrained_()
 {
-	string str = "";
-	while (deque_->pop(str))
+	if (drained_->Length() == 0)
+	{
+		return;
+	}
 	{
 		lock_guard<mutex> locker(mtx_);
-		fputs(str.c_str(), fp_);
+		AppendLocked_(drained_->Data(), drained_->Length(), drained_->Lines());
+	}
+	drained_->Reset();
+}
+
+void Log::AsyncWrite_()
+{
+	/* 写线程自己的两个备用缓冲区，用来和前端交换，稳定运行时不再分配内存 */
+	BufferPtr spare1(new LogBuffer(bufferSize_));
+	BufferPtr spare2(new LogBuffer(bufferSize_));
+	vector<BufferPtr> toWrite;
+	toWrite.reserve(MAX_PENDING_BUFFERS);
+	chrono::steady_clock::time_point lastWrite = chrono::steady_clock::now();
+	bool running = true;
+	while (running)
+	{
+		{
+			unique_lock<mutex> locker(mtx_);
+			if (buffers_.empty() && running_ && !flushNow_.load(memory_order_relaxed) &&
+				!drainNow_.load(memory_order_relaxed))
+			{
+				cond_.wait_for(locker, chrono::milliseconds(DRAIN_INTERVAL_MS));
+			}
+			running = running_;
+		}
+
+		/* 先清标志再取，取的过程中又积压的会再叫一次；这一轮没取完就不睡，接着取 */
+		drainNow_.store(false, memory_order_relaxed);
+		if (DrainRings_())
+		{
+			drainNow_.store(true, memory_order_relaxed);
+		}
+
+		/* 有缓冲区写满了、有人要求马上写、到了刷新时间或者要退出了，才写文件 */
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		{
+			lock_guard<mutex> locker(mtx_);
+			if (running && buffers_.empty() && !flushNow_.load(memory_order_relaxed) &&
+				now - lastWrite < chrono::milliseconds(FLUSH_INTERVAL_MS))
+			{
+				continue;
+			}
+			flushNow_.store(false, memory_order_relaxed);
+			buffers_.push_back(move(current_));
+			current_ = move(spare1);
+			toWrite.swap(buffers_);
+			if (!next_)
+			{
+				next_ = move(spare2);
+			}
+		}
+		lastWrite = now;
+		metrics->Set(LOG_PENDING, static_cast<double>(toWrite.size()));
+
+		if (toWrite.size() > MAX_PENDING_BUFFERS)
+		{
+			/* 写得比产生得慢，只保留最早的两个缓冲区，其余丢掉 */
+			size_t lines = 0;
+			for (size_t i = 2; i < toWrite.size(); i++)
+			{
+				lines += toWrite[i]->Lines();
+			}
+			toWrite.resize(2);
+			dropped_ += lines;
+			metrics->Add(LOG_DROPPED, lines);
+			char notice[128];
+			int n = ClockService::Instance()->FormatLogTime(notice, ClockService::LOG_TIME_LEN + 1, nullptr);
+			n += snprintf(notice + n, sizeof(notice) - n, "[warn] : Dropped %zu log lines, %zu in total\n", lines, dropped_);
+			if (::write(fd_, notice, n) < 0)
+			{
+				perror("write log");
+			}
+		}
+
+		WriteFile_(toWrite);
+
+		/* 写完的缓冲区留两个当备用，多的释放 */
+		if (!spare1)
+		{
+			spare1 = move(toWrite.back());
+			toWrite.pop_back();
+			spare1->Reset();
+		}
+		if (!spare2 && !toWrite.empty())
+		{
+			spare2 = move(toWrite.back());
+			toWrite.pop_back();
+			spare2->Reset();
+		}
+		toWrite.clear();
 	}
 }
 
@@ -212,5 +443,6 @@ Log *Log::Instance()
 
 void Log::FlushLogThread()
 {
+	CpuAffinity::BindCurrentThread(Log::Instance()->writerCpu_);
 	Log::Instance()->AsyncWrite_();
-}
\ No newline at end of file
+}
@@ -0,0 +1,262 @@
+#include "logring.h"
+
+#include <mutex>
+#include <cstdio>
+#include <cassert>
+
+const size_t LogRing::RING_SIZE;
+const size_t LogRing::MAX_STRING_LEN;
+
+namespace
+{
+	// 登记的所有环，用new出来的对象并且不释放：进程退出时分离的线程可能还在写日志
+	std::mutex &RegistryMutex()
+	{
+		static std::mutex *mtx = new std::mutex;
+		return *mtx;
+	}
+
+	std::vector<std::shared_ptr<LogRing>> &Registry()
+	{
+		static std::vector<std::shared_ptr<LogRing>> *rings = new std::vector<std::shared_ptr<LogRing>>;
+		return *rings;
+	}
+
+	// 线程退出时只做标记，环里剩下的记录由写线程取完后再回收
+	struct RingHolder
+	{
+		std::shared_ptr<LogRing> ring;
+		~RingHolder()
+		{
+			if (ring)
+			{
+				ring->MarkDead();
+			}
+		}
+	};
+	thread_local RingHolder holder;
+}
+
+LogRing::LogRing(size_t size) : buf_(new char[size]), mask_(size - 1), reservedHead_(0),
+								head_(0), cachedTail_(0), tail_(0), dropped_(0), reportedDropped_(0), dead_(false), wake_(false)
+{
+	assert((size & (size - 1)) == 0);
+}
+
+LogRing::~LogRing()
+{
+	delete[] buf_;
+}
+
+LogRing *LogRing::ForThisThread()
+{
+	if (!holder.ring)
+	{
+		holder.ring = std::make_shared<LogRing>();
+		std::lock_guard<std::mutex> locker(RegistryMutex());
+		Registry().push_back(holder.ring);
+	}
+	return holder.ring.get();
+}
+
+void LogRing::Collect(std::vector<std::shared_ptr<LogRing>> &rings)
+{
+	std::lock_guard<std::mutex> locker(RegistryMutex());
+	std::vector<std::shared_ptr<LogRing>> &all = Registry();
+	rings.clear();
+	for (size_t i = 0; i < all.size();)
+	{
+		/* 线程退出并且数据已经取完的环可以回收了 */
+		if (all[i]->IsDead() && !all[i]->Front())
+		{
+			all[i] = all.back();
+			all.pop_back();
+			continue;
+		}
+		rings.push_back(all[i]);
+		i++;
+	}
+}
+
+char *LogRing::Reserve(size_t len)
+{
+	size_t head = head_.load(std::memory_order_relaxed);
+	size_t contiguous = mask_ + 1 - (head & mask_);
+	size_t skip = len > contiguous ? contiguous : 0; // 尾部放不下就跳到环的开头
+	if (head + skip + len - cachedTail_ > mask_ + 1)
+	{
+		cachedTail_ = tail_.load(std::memory_order_acquire);
+		if (head + skip + len - cachedTail_ > mask_ + 1)
+		{
+			return nullptr;
+		}
+	}
+	if (skip)
+	{
+		/* 记录都是8字节对齐的，尾部剩下的空间至少能放下一个size字段 */
+		uint32_t zero = 0;
+		memcpy(buf_ + (head & mask_), &zero, sizeof(zero));
+	}
+	reservedHead_ = head + skip;
+	return buf_ + (reservedHead_ & mask_);
+}
+
+bool LogRing::Commit(size_t len)
+{
+	size_t head = reservedHead_ + len;
+	head_.store(head, std::memory_order_release);
+	/* 缓存的消费位置可能是旧的，超过水位时才重新读一次 */
+	size_t highWater = (mask_ + 1) / 4;
+	if (head - cachedTail_ < highWater)
+	{
+		return false;
+	}
+	cachedTail_ = tail_.load(std::memory_order_acquire);
+	return head - cachedTail_ >= highWater && !wake_.exchange(true, std::memory_order_relaxed);
+}
+
+const LogRing::Header *LogRing::Front()
+{
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	size_t head = head_.load(std::memory_order_acquire);
+	if (tail == head)
+	{
+		Drained_();
+		return nullptr;
+	}
+	const Header *record = reinterpret_cast<const Header *>(buf_ + (tail & mask_));
+	if (record->size == 0)
+	{
+		/* 跳过环尾的空白 */
+		tail += mask_ + 1 - (tail & mask_);
+		tail_.store(tail, std::memory_order_release);
+		if (tail == head)
+		{
+			Drained_();
+			return nullptr;
+		}
+		record = reinterpret_cast<const Header *>(buf_ + (tail & mask_));
+	}
+	return record;
+}
+
+// 取空了，下次积压超过水位时可以再叫醒写线程
+void LogRing::Drained_()
+{
+	if (wake_.load(std::memory_order_relaxed))
+	{
+		wake_.store(false, std::memory_order_relaxed);
+	}
+}
+
+void LogRing::Pop()
+{
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	const Header *record = reinterpret_cast<const Header *>(buf_ + (tail & mask_));
+	tail_.store(tail + record->size, std::memory_order_release);
+}
+
+size_t LogRing::TakeDropped()
+{
+	size_t dropped = dropped_.load(std::memory_order_relaxed);
+	size_t delta = dropped - reportedDropped_;
+	reportedDropped_ = dropped;
+	return delta;
+}
+
+// 按格式串逐个转换说明符格式化：长度修饰符统一换成ll，配合64位存储的整数
+size_t LogRing::FormatArgs(const Header *record, char *out, size_t cap)
+{
+	const char *fmt = record->format;
+	const char *arg = reinterpret_cast<const char *>(record + 1);
+	int argLeft = record->argc;
+	size_t n = 0;
+	while (*fmt && n + 1 < cap)
+	{
+		if (*fmt != '%')
+		{
+			out[n++] = *fmt++;
+			continue;
+		}
+		if (fmt[1] == '%')
+		{
+			out[n++] = '%';
+			fmt += 2;
+			continue;
+		}
+
+		/* 拆出一个转换说明: % 标志 宽度 精度 长度 转换字符 */
+		char spec[32];
+		size_t len = 0;
+		spec[len++] = *fmt++;
+		while (*fmt && strchr("-+ #0123456789.", *fmt) && len < sizeof(spec) - 4)
+		{
+			spec[len++] = *fmt++;
+		}
+		while (*fmt && strchr("hlLqjzt", *fmt))
+		{
+			fmt++; // 原来的长度修饰符丢掉
+		}
+		char conv = *fmt ? *fmt++ : 's';
+		if (argLeft-- <= 0)
+		{
+			break; // 参数比说明符少
+		}
+
+		int m = 0;
+		uint8_t type = static_cast<uint8_t>(*arg++);
+		if (type == ARG_STRING)
+		{
+			uint32_t strLen;
+			memcpy(&strLen, arg, sizeof(strLen));
+			arg += sizeof(strLen);
+			char str[MAX_STRING_LEN + 1]; // 记录里的字符串没有结尾的'\0'
+			memcpy(str, arg, strLen);
+			str[strLen] = '\0';
+			spec[len++] = 's';
+			spec[len] = '\0';
+			m = snprintf(out + n, cap - n, spec, str);
+			arg += strLen;
+		}
+		else
+		{
+			uint64_t bits;
+			memcpy(&bits, arg, sizeof(bits));
+			arg += sizeof(bits);
+			if (type == ARG_DOUBLE)
+			{
+				double value;
+				memcpy(&value, &bits, sizeof(value));
+				spec[len++] = strchr("eEfFgGaA", conv) ? conv : 'g';
+				spec[len] = '\0';
+				m = snprintf(out + n, cap - n, spec, value);
+			}
+			else if (type == ARG_POINTER || conv == 'p')
+			{
+				spec[len++] = 'p';
+				spec[len] = '\0';
+				m = snprintf(out + n, cap - n, spec, reinterpret_cast<void *>(bits));
+			}
+			else if (conv == 'c')
+			{
+				spec[len++] = 'c';
+				spec[len] = '\0';
+				m = snprintf(out + n, cap - n, spec, static_cast<int>(bits));
+			}
+			else
+			{
+				spec[len++] = 'l';
+				spec[len++] = 'l';
+				spec[len++] = strchr("diuoxX", conv) ? conv : 'd';
+				spec[len] = '\0';
+				m = snprintf(out + n, cap - n, spec, static_cast<long long>(bits));
+			}
+		}
+		if (m > 0)
+		{
+			n += static_cast<size_t>(m) < cap - n ? m : cap - n - 1;
+		}
+	}
+	out[n] = '\0';
+	return n;
+}
@@ -0,0 +1,302 @@
+#include "metrics.h"
+
+#include <cassert>
+#include <cstdio>
+#include <unordered_map>
+
+using namespace std;
+
+const int Metrics::MAX_METRICS;
+const int Metrics::MAX_SLOTS;
+
+// 线程退出时把槽位的值并进注册表
+struct MetricsHolder
+{
+	Metrics::ThreadSlots *slots = nullptr;
+	bool exited = false;
+	~MetricsHolder()
+	{
+		exited = true;
+		if (slots)
+		{
+			Metrics::Instance()->Retire_(slots);
+			slots = nullptr;
+		}
+	}
+};
+
+namespace
+{
+	thread_local MetricsHolder holder;
+
+	void AppendValue(string &out, const string &name, const string &labels, double value)
+	{
+		char buf[64];
+		out += name;
+		if (!labels.empty())
+		{
+			out += '{';
+			out += labels;
+			out += '}';
+		}
+		snprintf(buf, sizeof(buf), " %.10g\n", value);
+		out += buf;
+	}
+}
+
+Metrics::Metrics() : count_(0), nextSlot_(0)
+{
+}
+
+// 用new出来的对象并且不释放：进程退出时分离的线程可能还在计数
+Metrics *Metrics::Instance()
+{
+	static Metrics *inst = new Metrics;
+	return inst;
+}
+
+vector<double> Metrics::LatencyBuckets()
+{
+	return {0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1};
+}
+
+int Metrics::Register_(const string &name, const char *help, Type type, int slots,
+						const vector<double> &bounds, function<double()> fn)
+{
+	lock_guard<mutex> locker(mtx_);
+	int id = count_.load(memory_order_relaxed);
+	assert(id < MAX_METRICS && nextSlot_ + slots <= MAX_SLOTS);
+	if (id >= MAX_METRICS || nextSlot_ + slots > MAX_SLOTS)
+	{
+		return -1;
+	}
+	Desc &desc = descs_[id];
+	size_t brace = name.find('{');
+	desc.family = name.substr(0, brace);
+	desc.labels = brace == string::npos ? "" : name.substr(brace + 1, name.size() - brace - 2);
+	desc.help = help;
+	desc.type = type;
+	desc.slot = fn ? -1 : nextSlot_;
+	desc.bounds = bounds;
+	desc.fn = move(fn);
+	desc.value.store(0, memory_order_relaxed);
+	nextSlot_ += slots;
+	count_.store(id + 1, memory_order_release);
+	return id;
+}
+
+int Metrics::AddCounter(const string &name, const char *help)
+{
+	return Register_(name, help, COUNTER, 1);
+}
+
+int Metrics::AddGauge(const string &name, const char *help)
+{
+	return Register_(name, help, GAUGE, 0);
+}
+
+int Metrics::AddHistogram(const string &name, const char *help, const vector<double> &bounds)
+{
+	return Register_(name, help, HISTOGRAM, static_cast<int>(bounds.size()) + 2, bounds);
+}
+
+int Metrics::AddCallback(const string &name, const char *help, Type type, function<double()> fn)
+{
+	return Register_(name, help, type, 0, {}, move(fn));
+}
+
+void Metrics::AddCollector(function<void(string &)> fn)
+{
+	lock_guard<mutex> locker(mtx_);
+	collectors_.push_back(move(fn));
+}
+
+atomic<uint64_t> *Metrics::Local_()
+{
+	if (!holder.slots)
+	{
+		if (holder.exited)
+		{
+			/* 线程退出之后(其他线程局部对象析构时)还有计数，记到这里，不保证准确 */
+			static ThreadSlots *sink = new ThreadSlots();
+			return sink->v;
+		}
+		holder.slots = new ThreadSlots();
+		lock_guard<mutex> locker(mtx_);
+		threads_.push_back(holder.slots);
+	}
+	return holder.slots->v;
+}
+
+void Metrics::Observe(int id, double value)
+{
+	const Desc &desc = descs_[id];
+	size_t i = 0;
+	while (i < desc.bounds.size() && value > desc.bounds[i])
+	{
+		i++;
+	}
+	atomic<uint64_t> *slots = Local_() + desc.slot;
+	slots[i].store(slots[i].load(memory_order_relaxed) + 1, memory_order_relaxed);
+	/* 总和按double的位存在最后一个槽位里，只有本线程写 */
+	atomic<uint64_t> &sum = slots[desc.bounds.size() + 1];
+	double total = ToDouble_(sum.load(memory_order_relaxed)) + value;
+	uint64_t bits;
+	memcpy(&bits, &total, sizeof(bits));
+	sum.store(bits, memory_order_relaxed);
+}
+
+double Metrics::ToDouble_(uint64_t bits)
+{
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+void Metrics::Retire_(ThreadSlots *slots)
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		for (size_t i = 0; i < threads_.size(); i++)
+		{
+			if (threads_[i] == slots)
+			{
+				threads_[i] = threads_.back();
+				threads_.pop_back();
+				break;
+			}
+		}
+		retired_.resize(MAX_SLOTS, 0);
+		retiredSums_.resize(MAX_SLOTS, 0);
+		int n = count_.load(memory_order_acquire);
+		for (int id = 0; id < n; id++)
+		{
+			const Desc &desc = descs_[id];
+			if (desc.type == COUNTER && desc.slot >= 0)
+			{
+				retired_[desc.slot] += slots->v[desc.slot].load(memory_order_relaxed);
+			}
+			else if (desc.type == HISTOGRAM)
+			{
+				size_t buckets = desc.bounds.size() + 1;
+				for (size_t i = 0; i < buckets; i++)
+				{
+					retired_[desc.slot + i] += slots->v[desc.slot + i].load(memory_order_relaxed);
+				}
+				retiredSums_[desc.slot + buckets] += ToDouble_(slots->v[desc.slot + buckets].load(memory_order_relaxed));
+			}
+		}
+	}
+	delete slots;
+}
+
+void Metrics::Sum_(vector<uint64_t> &counts, vector<double> &sums)
+{
+	counts = retired_;
+	sums = retiredSums_;
+	counts.resize(MAX_SLOTS, 0);
+	sums.resize(MAX_SLOTS, 0);
+	int n = count_.load(memory_order_acquire);
+	for (ThreadSlots *slots : threads_)
+	{
+		for (int id = 0; id < n; id++)
+		{
+			const Desc &desc = descs_[id];
+			if (desc.type == COUNTER && desc.slot >= 0)
+			{
+				counts[desc.slot] += slots->v[desc.slot].load(memory_order_relaxed);
+			}
+			else if (desc.type == HISTOGRAM)
+			{
+				size_t buckets = desc.bounds.size() + 1;
+				for (size_t i = 0; i < buckets; i++)
+				{
+					counts[desc.slot + i] += slots->v[desc.slot + i].load(memory_order_relaxed);
+				}
+				sums[desc.slot + buckets] += ToDouble_(slots->v[desc.slot + buckets].load(memory_order_relaxed));
+			}
+		}
+	}
+}
+
+string Metrics::Scrape()
+{
+	vector<uint64_t> counts;
+	vector<double> sums;
+	vector<function<void(string &)>> collectors;
+	{
+		lock_guard<mutex> locker(mtx_);
+		Sum_(counts, sums);
+		collectors = collectors_;
+	}
+	int n = count_.load(memory_order_acquire);
+
+	/* 同名的指标放在一起输出，按第一次注册的顺序 */
+	unordered_map<string, int> firstSeen;
+	for (int id = 0; id < n; id++)
+	{
+		firstSeen.emplace(descs_[id].family, id);
+	}
+	vector<vector<int>> groups(n);
+	for (int id = 0; id < n; id++)
+	{
+		groups[firstSeen[descs_[id].family]].push_back(id);
+	}
+
+	static const char *TYPE_NAME[] = {"counter", "gauge", "histogram"};
+	string out;
+	out.reserve(16384);
+	for (const vector<int> &group : groups)
+	{
+		if (group.empty())
+		{
+			continue;
+		}
+		const Desc &first = descs_[group[0]];
+		out += "# HELP " + first.family + " " + first.help + "\n";
+		out += "# TYPE " + first.family + " " + TYPE_NAME[first.type] + "\n";
+		for (int id : group)
+		{
+			const Desc &desc = descs_[id];
+			if (desc.fn)
+			{
+				AppendValue(out, desc.family, desc.labels, desc.fn());
+			}
+			else if (desc.type == COUNTER)
+			{
+				AppendValue(out, desc.family, desc.labels, static_cast<double>(counts[desc.slot]));
+			}
+			else if (desc.type == GAUGE)
+			{
+				AppendValue(out, desc.family, desc.labels, ToDouble_(desc.value.load(memory_order_relaxed)));
+			}
+			else
+			{
+				/* 直方图的桶是累计的 */
+				string prefix = desc.labels.empty() ? "" : desc.labels + ",";
+				uint64_t cumulative = 0;
+				char le[32];
+				for (size_t i = 0; i <= desc.bounds.size(); i++)
+				{
+					cumulative += counts[desc.slot + i];
+					if (i < desc.bounds.size())
+					{
+						snprintf(le, sizeof(le), "%g", desc.bounds[i]);
+					}
+					else
+					{
+						strcpy(le, "+Inf");
+					}
+					AppendValue(out, desc.family + "_bucket", prefix + "le=\"" + le + "\"", static_cast<double>(cumulative));
+				}
+				AppendValue(out, desc.family + "_sum", desc.labels, sums[desc.slot + desc.bounds.size() + 1]);
+				AppendValue(out, desc.family + "_count", desc.labels, static_cast<double>(cumulative));
+			}
+		}
+	}
+	for (const function<void(string &)> &collector : collectors)
+	{
+		collector(out);
+	}
+	return out;
+}
@@ -0,0 +1,228 @@
+#include "perfcounters.h"
+#include "metrics.h"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+using namespace std;
+
+// 线程退出时关掉它的计数器
+struct PerfHolder
+{
+	PerfCounters::ThreadPerf *local = nullptr;
+	~PerfHolder()
+	{
+		if (local)
+		{
+			local->Close();
+		}
+	}
+};
+
+namespace
+{
+	thread_local PerfHolder holder;
+
+	const char *PHASE_NAME[] = {"process", "write"};
+	const char *EVENT_NAME[] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+	const uint64_t EVENT_CONFIG[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+									 PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+	int PerfEventOpen(struct perf_event_attr *attr, int groupFd)
+	{
+		return static_cast<int>(syscall(SYS_perf_event_open, attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC));
+	}
+}
+
+PerfCounters::ThreadPerf::ThreadPerf() : requests(0)
+{
+	fill(fds, fds + EVENT_COUNT, -1);
+	for (int p = 0; p < PHASE_COUNT; p++)
+	{
+		for (int e = 0; e < EVENT_COUNT; e++)
+		{
+			totals[p][e].store(0, memory_order_relaxed);
+		}
+	}
+}
+
+void PerfCounters::ThreadPerf::Close()
+{
+	for (int &fd : fds)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+}
+
+PerfCounters::PerfCounters() : enabled_(false)
+{
+}
+
+// 用new出来的对象并且不释放：进程退出时分离的线程可能还在计数
+PerfCounters *PerfCounters::Instance()
+{
+	static PerfCounters *inst = new PerfCounters;
+	return inst;
+}
+
+bool PerfCounters::Init(bool on)
+{
+	if (!on)
+	{
+		return true;
+	}
+	/* 先在当前线程试一次，不行就整个关掉，不让每个线程都失败一遍 */
+	ThreadPerf *local = Local_();
+	local->tried = true;
+	if (!Open_(local->fds, &error_))
+	{
+		return false;
+	}
+	RegisterMetrics_();
+	enabled_.store(true, memory_order_relaxed);
+	return true;
+}
+
+bool PerfCounters::Open_(int *fds, string *error)
+{
+	for (int e = 0; e < EVENT_COUNT; e++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = EVENT_CONFIG[e];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.disabled = e == 0 ? 1 : 0; // 组长先关着，整组建好再一起打开
+		attr.exclude_kernel = 1;		// 只统计用户态，kernel.perf_event_paranoid=2时也能打开
+		attr.exclude_hv = 1;
+		fds[e] = PerfEventOpen(&attr, fds[0]);
+		if (fds[e] < 0)
+		{
+			if (error)
+			{
+				*error = string("perf_event_open(") + EVENT_NAME[e] + "): " + strerror(errno);
+			}
+			for (int i = 0; i < e; i++)
+			{
+				close(fds[i]);
+				fds[i] = -1;
+			}
+			return false;
+		}
+	}
+	ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+
+PerfCounters::ThreadPerf *PerfCounters::Local_()
+{
+	if (!holder.local)
+	{
+		holder.local = new ThreadPerf;
+		lock_guard<mutex> locker(mtx_);
+		threads_.push_back(holder.local);
+	}
+	return holder.local;
+}
+
+bool PerfCounters::Read(Reading &reading)
+{
+	ThreadPerf *local = Local_();
+	if (!local->tried)
+	{
+		local->tried = true;
+		Open_(local->fds, nullptr);
+	}
+	if (local->fds[0] < 0)
+	{
+		return false;
+	}
+	/* PERF_FORMAT_GROUP: 计数器个数，后面按加入组的顺序是各个值 */
+	uint64_t buf[1 + EVENT_COUNT];
+	if (read(local->fds[0], buf, sizeof(buf)) != static_cast<ssize_t>(sizeof(buf)) || buf[0] != EVENT_COUNT)
+	{
+		return false;
+	}
+	memcpy(reading.v, buf + 1, sizeof(reading.v));
+	return true;
+}
+
+void PerfCounters::Add(Phase phase, const Reading &begin, const Reading &end)
+{
+	ThreadPerf *local = Local_();
+	for (int e = 0; e < EVENT_COUNT; e++)
+	{
+		atomic<uint64_t> &slot = local->totals[phase][e];
+		slot.store(slot.load(memory_order_relaxed) + (end.v[e] - begin.v[e]), memory_order_relaxed);
+	}
+}
+
+void PerfCounters::CountRequest()
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+	ThreadPerf *local = Local_();
+	local->requests.store(local->requests.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+uint64_t PerfCounters::Sum_(Phase phase, Event event)
+{
+	lock_guard<mutex> locker(mtx_);
+	uint64_t sum = 0;
+	for (ThreadPerf *thread : threads_)
+	{
+		sum += thread->totals[phase][event].load(memory_order_relaxed);
+	}
+	return sum;
+}
+
+uint64_t PerfCounters::Requests_()
+{
+	lock_guard<mutex> locker(mtx_);
+	uint64_t sum = 0;
+	for (ThreadPerf *thread : threads_)
+	{
+		sum += thread->requests.load(memory_order_relaxed);
+	}
+	return sum;
+}
+
+// 只有打开成功才注册，关闭时/metrics里没有这些指标；平均值是启动以来的，最近一段时间的用计数器的rate()算
+void PerfCounters::RegisterMetrics_()
+{
+	Metrics *metrics = Metrics::Instance();
+	metrics->AddCallback("toy_perf_requests_total", "Requests measured with hardware counters", Metrics::COUNTER, [this]
+						 { return static_cast<double>(Requests_()); });
+	for (int p = 0; p < PHASE_COUNT; p++)
+	{
+		Phase phase = static_cast<Phase>(p);
+		for (int e = 0; e < EVENT_COUNT; e++)
+		{
+			Event event = static_cast<Event>(e);
+			string labels = string("{phase=\"") + PHASE_NAME[p] + "\",event=\"" + EVENT_NAME[e] + "\"}";
+			metrics->AddCallback("toy_perf_events_total" + labels, "User-space hardware events counted per request phase", Metrics::COUNTER, [this, phase, event]
+								 { return static_cast<double>(Sum_(phase, event)); });
+			metrics->AddCallback("toy_perf_events_per_request" + labels, "Average hardware events per request since start", Metrics::GAUGE, [this, phase, event]
+								 {
+				uint64_t requests = Requests_();
+				return requests > 0 ? static_cast<double>(Sum_(phase, event)) / requests : 0.0; });
+		}
+		metrics->AddCallback(string("toy_perf_ipc{phase=\"") + PHASE_NAME[p] + "\"}", "Instructions per cycle since start", Metrics::GAUGE, [this, phase]
+							 {
+			uint64_t cycles = Sum_(phase, CYCLES);
+			return cycles > 0 ? static_cast<double>(Sum_(phase, INSTRUCTIONS)) / cycles : 0.0; });
+	}
+}
@@ -1,6 +1,17 @@
 #include "sqlconnpool.h"
+#include "metrics.h"
+#include <chrono>
 using namespace std;
 
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int SQL_BUSY = metrics->AddCounter("toy_sql_pool_busy_total", "GetConn calls that found no connection in the pool");
+	const int SQL_WAIT = metrics->AddHistogram("toy_sql_pool_wait_seconds", "Time spent waiting for a SQL connection", Metrics::LatencyBuckets());
+	const int SQL_FREE = metrics->AddCallback("toy_sql_pool_free_connections", "Idle SQL connections", Metrics::GAUGE, []
+											  { return static_cast<double>(SqlConnPool::Instance()->GetFreeConnCount()); });
+}
+
 SqlConnPool::SqlConnPool()
 {
 	useCount_ = 0;
@@ -46,9 +57,12 @@ MYSQL *SqlConnPool::GetConn()
 	if (connQue_.empty())
 	{
 		LOG_WARN("SqlConnPool busy!");
+		metrics->Add(SQL_BUSY);
 		return nullptr;
 	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
 	sem_wait(&semId_);
+	metrics->Observe(SQL_WAIT, chrono::duration<double>(chrono::steady_clock::now() - start).count());
 	{
 		lock_guard<mutex> locker(mtx_);
 		sql = connQue_.front();
@@ -0,0 +1,249 @@
+#include "timingwheel.h"
+
+TimingWheel::TimingWheel(int tickMs) : tickMs_(tickMs), count_(0), slots_(WORK_SLOT + 1, -1)
+{
+	assert(tickMs_ > 0);
+	base_ = NowMs_() / tickMs_;
+	nodes_.reserve(64);
+}
+
+int64_t TimingWheel::NowMs_() const
+{
+	return ClockService::Instance()->NowMs();
+}
+
+int64_t TimingWheel::ToTicks_(int timeout) const
+{
+	return (timeout + tickMs_ - 1) / tickMs_; // 向上取整，保证不会提前超时
+}
+
+// 按到期时间把节点挂到对应层的槽上
+void TimingWheel::Link_(int id)
+{
+	WheelNode &node = nodes_[id];
+	int64_t expires = std::max(node.expires, base_);
+	int64_t delta = expires - base_;
+	int slot;
+	if (delta < TVR_SIZE)
+	{
+		slot = expires & TVR_MASK;
+	}
+	else if (delta < (1LL << (TVR_BITS + TVN_BITS)))
+	{
+		slot = TVR_SIZE + ((expires >> TVR_BITS) & TVN_MASK);
+	}
+	else if (delta < (1LL << (TVR_BITS + 2 * TVN_BITS)))
+	{
+		slot = TVR_SIZE + TVN_SIZE + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+	}
+	else
+	{
+		if (delta > MAX_TICKS)
+		{
+			expires = base_ + MAX_TICKS; // 超出范围就先挂在最远处，到时再重新调度
+		}
+		slot = TVR_SIZE + 2 * TVN_SIZE + ((expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+	}
+	node.scheduled = expires;
+	node.slot = slot;
+	node.prev = -1;
+	node.next = slots_[slot];
+	if (node.next != -1)
+	{
+		nodes_[node.next].prev = id;
+	}
+	slots_[slot] = id;
+}
+
+void TimingWheel::Unlink_(int id)
+{
+	WheelNode &node = nodes_[id];
+	assert(node.slot != NO_SLOT);
+	if (node.prev != -1)
+	{
+		nodes_[node.prev].next = node.next;
+	}
+	else
+	{
+		slots_[node.slot] = node.next;
+	}
+	if (node.next != -1)
+	{
+		nodes_[node.next].prev = node.prev;
+	}
+	node.prev = node.next = -1;
+	node.slot = NO_SLOT;
+}
+
+// 把整个槽的链表转移到临时链表上，回调里cancel其他节点时链表依然完整
+void TimingWheel::MoveToWork_(int slot)
+{
+	assert(slots_[WORK_SLOT] == -1);
+	int head = slots_[slot];
+	slots_[slot] = -1;
+	slots_[WORK_SLOT] = head;
+	for (int i = head; i != -1; i = nodes_[i].next)
+	{
+		nodes_[i].slot = WORK_SLOT;
+	}
+}
+
+// 上层的一个槽降级到下面的层
+void TimingWheel::Cascade_(int level)
+{
+	int shift = TVR_BITS + (level - 1) * TVN_BITS;
+	int index = (base_ >> shift) & TVN_MASK;
+	MoveToWork_(TVR_SIZE + (level - 1) * TVN_SIZE + index);
+	while (slots_[WORK_SLOT] != -1)
+	{
+		int id = slots_[WORK_SLOT];
+		Unlink_(id);
+		Link_(id);
+	}
+	if (index == 0 && level < LEVELS - 1)
+	{
+		Cascade_(level + 1);
+	}
+}
+
+void TimingWheel::RunWork_(int64_t tick)
+{
+	while (slots_[WORK_SLOT] != -1)
+	{
+		int id = slots_[WORK_SLOT];
+		Unlink_(id);
+		if (nodes_[id].expires > tick)
+		{
+			/* 被adjust刷新过，惰性地重新调度 */
+			Link_(id);
+			continue;
+		}
+		count_--;
+		// 先把回调移出来，回调中对同一个id重新add也是安全的
+		Task cb = std::move(nodes_[id].cb);
+		nodes_[id].cb = nullptr;
+		if (cb)
+		{
+			cb();
+		}
+	}
+}
+
+void TimingWheel::Advance_(int64_t nowTick)
+{
+	while (base_ <= nowTick)
+	{
+		if (count_ == 0)
+		{
+			base_ = nowTick + 1; // 时间轮上没有节点，直接跳过空转
+			return;
+		}
+		int index = base_ & TVR_MASK;
+		if (index == 0)
+		{
+			Cascade_(1);
+		}
+		int64_t tick = base_++; // 先推进，回调中新加的定时器至少落在下一个tick
+		MoveToWork_(index);
+		RunWork_(tick);
+	}
+}
+
+void TimingWheel::add(int id, int timeout, Task cb)
+{
+	assert(id >= 0);
+	if (static_cast<size_t>(id) >= nodes_.size())
+	{
+		nodes_.resize(std::max(static_cast<size_t>(id) + 1, nodes_.size() * 2));
+	}
+	WheelNode &node = nodes_[id];
+	if (node.slot != NO_SLOT)
+	{
+		Unlink_(id);
+	}
+	else
+	{
+		count_++;
+	}
+	node.expires = NowMs_() / tickMs_ + ToTicks_(timeout);
+	node.cb = std::move(cb);
+	Link_(id);
+}
+
+void TimingWheel::adjust(int id, int timeout)
+{
+	if (static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slot == NO_SLOT)
+	{
+		return;
+	}
+	WheelNode &node = nodes_[id];
+	node.expires = NowMs_() / tickMs_ + ToTicks_(timeout);
+	if (node.expires < node.scheduled)
+	{
+		/* 超时时间变短了，只能立即挪到更早的槽 */
+		Unlink_(id);
+		Link_(id);
+	}
+}
+
+void TimingWheel::cancel(int id)
+{
+	if (static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slot == NO_SLOT)
+	{
+		return;
+	}
+	Unlink_(id);
+	nodes_[id].cb = nullptr;
+	count_--;
+}
+
+void TimingWheel::doWork(int id)
+{
+	/* 删除指定id结点，并触发回调函数 */
+	if (static_cast<size_t>(id) >= nodes_.size() || nodes_[id].slot == NO_SLOT)
+	{
+		return;
+	}
+	Task cb = std::move(nodes_[id].cb);
+	cancel(id);
+	if (cb)
+	{
+		cb();
+	}
+}
+
+void TimingWheel::clear()
+{
+	nodes_.clear();
+	std::fill(slots_.begin(), slots_.end(), -1);
+	count_ = 0;
+}
+
+void TimingWheel::tick()
+{
+	Advance_(NowMs_() / tickMs_);
+}
+
+int TimingWheel::GetNextTick()
+{
+	int64_t now = NowMs_();
+	Advance_(now / tickMs_);
+	if (count_ == 0)
+	{
+		return -1;
+	}
+	/* 只扫描第0层到下一次降级为止，上层的节点最晚在降级时处理 */
+	/* base_正好在降级点上时，上层节点还没降下来，必须先在base_醒来一次 */
+	int64_t limit = (base_ & TVR_MASK) == 0 ? 0 : TVR_SIZE - (base_ & TVR_MASK);
+	int64_t next = base_ + limit;
+	for (int64_t i = 0; i < limit; i++)
+	{
+		if (slots_[(base_ + i) & TVR_MASK] != -1)
+		{
+			next = base_ + i;
+			break;
+		}
+	}
+	int64_t res = next * tickMs_ - now;
+	return res < 0 ? 0 : static_cast<int>(res);
+}
@@ -0,0 +1,261 @@
+#include "trace.h"
+
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+const size_t Tracer::RING_SIZE;
+
+// 线程退出时把缓冲区还回去
+struct TraceHolder
+{
+	Tracer::Ring *local = nullptr;
+	bool exited = false;
+	~TraceHolder()
+	{
+		exited = true;
+		if (local)
+		{
+			Tracer::Instance()->Retire_(local);
+			local = nullptr;
+		}
+	}
+};
+
+namespace
+{
+	thread_local TraceHolder holder;
+	thread_local char threadName[32] = {0};
+	thread_local uint64_t currentId = 0;
+
+	struct Exported
+	{
+		Tracer::Event event;
+		int tid;
+	};
+
+	// 名字是代码里的字面量和线程名，只需要去掉会破坏JSON的字符
+	void AppendName(string &out, const char *name)
+	{
+		for (const char *p = name; *p; p++)
+		{
+			if (*p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20)
+			{
+				out += *p;
+			}
+		}
+	}
+}
+
+Tracer::Tracer() : enabled_(false), nextId_(1), clearedAt_(0), sampleRate_(1.0)
+{
+}
+
+// 用new出来的对象并且不释放：进程退出时分离的线程可能还在记录
+Tracer *Tracer::Instance()
+{
+	static Tracer *inst = new Tracer;
+	return inst;
+}
+
+int64_t Tracer::NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void Tracer::Init(double sampleRate)
+{
+	sampleRate_ = sampleRate > 0 ? min(sampleRate, 1.0) : 1.0;
+}
+
+void Tracer::Enable(bool on)
+{
+	enabled_.store(on, memory_order_relaxed);
+}
+
+uint64_t Tracer::Sample()
+{
+	if (!enabled_.load(memory_order_relaxed))
+	{
+		return 0;
+	}
+	/* 和访问日志一样按线程累加采样率，不用随机数 */
+	thread_local double credit = 1.0;
+	credit += sampleRate_;
+	if (credit < 1.0)
+	{
+		return 0;
+	}
+	credit -= 1.0;
+	return nextId_.fetch_add(1, memory_order_relaxed);
+}
+
+Tracer::Ring *Tracer::Local_()
+{
+	if (!holder.local)
+	{
+		if (holder.exited)
+		{
+			return nullptr; // 线程正在退出，不再记录
+		}
+		/* 复用退出的线程留下的缓冲区，它的span跟着丢掉；在锁里重置，导出不会看到一半 */
+		lock_guard<mutex> locker(mtx_);
+		Ring *ring = nullptr;
+		if (!freeRings_.empty())
+		{
+			ring = freeRings_.back();
+			freeRings_.pop_back();
+		}
+		else
+		{
+			ring = new Ring();
+			rings_.push_back(ring);
+		}
+		ring->head.store(0, memory_order_relaxed);
+		ring->tid = static_cast<int>(syscall(SYS_gettid));
+		memset(ring->name, 0, sizeof(ring->name));
+		if (threadName[0])
+		{
+			snprintf(ring->name, sizeof(ring->name), "%s", threadName);
+		}
+		else
+		{
+			snprintf(ring->name, sizeof(ring->name), "thread-%d", ring->tid);
+		}
+		holder.local = ring;
+	}
+	return holder.local;
+}
+
+void Tracer::Retire_(Ring *ring)
+{
+	lock_guard<mutex> locker(mtx_);
+	freeRings_.push_back(ring);
+}
+
+void Tracer::Record(const char *name, uint64_t id, int64_t startNs, int64_t endNs)
+{
+	Ring *ring = Local_();
+	if (!ring)
+	{
+		return;
+	}
+	uint64_t head = ring->head.load(memory_order_relaxed);
+	ring->events[head & (RING_SIZE - 1)] = {startNs, endNs, name, id};
+	ring->head.store(head + 1, memory_order_release);
+}
+
+void Tracer::NameThread(const char *name)
+{
+	if (threadName[0])
+	{
+		return;
+	}
+	strncpy(threadName, name, sizeof(threadName) - 1);
+	if (holder.local)
+	{
+		snprintf(holder.local->name, sizeof(holder.local->name), "%s", threadName);
+	}
+}
+
+uint64_t Tracer::CurrentId()
+{
+	return currentId;
+}
+
+void Tracer::Clear()
+{
+	clearedAt_.store(NowNs(), memory_order_relaxed);
+}
+
+string Tracer::ExportJson()
+{
+	vector<Exported> all;
+	vector<pair<int, string>> threads;
+	int64_t clearedAt = clearedAt_.load(memory_order_relaxed);
+	{
+		lock_guard<mutex> locker(mtx_);
+		for (Ring *ring : rings_)
+		{
+			/* 写线程可能同时在覆盖最旧的槽位：拷完再读一次head，拷贝期间被覆盖的丢掉 */
+			uint64_t head = ring->head.load(memory_order_acquire);
+			uint64_t from = head > RING_SIZE ? head - RING_SIZE : 0;
+			size_t base = all.size();
+			for (uint64_t i = from; i < head; i++)
+			{
+				all.push_back({ring->events[i & (RING_SIZE - 1)], ring->tid});
+			}
+			uint64_t after = ring->head.load(memory_order_acquire);
+			uint64_t valid = after > RING_SIZE ? after - RING_SIZE : 0;
+			if (valid > from)
+			{
+				size_t drop = min<uint64_t>(valid - from, all.size() - base);
+				all.erase(all.begin() + base, all.begin() + base + drop);
+			}
+			threads.push_back({ring->tid, ring->name});
+		}
+	}
+	all.erase(remove_if(all.begin(), all.end(), [clearedAt](const Exported &e)
+						{ return e.event.startNs < clearedAt; }),
+			  all.end());
+	/* 同一个请求的span按开始时间排在一起，方便连线 */
+	sort(all.begin(), all.end(), [](const Exported &a, const Exported &b)
+		 { return a.event.id != b.event.id ? a.event.id < b.event.id : a.event.startNs < b.event.startNs; });
+
+	int pid = getpid();
+	char line[256];
+	string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	snprintf(line, sizeof(line), "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"toyserver\"}}", pid);
+	out += line;
+	for (const auto &thread : threads)
+	{
+		snprintf(line, sizeof(line), ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"", pid, thread.first);
+		out += line;
+		AppendName(out, thread.second.c_str());
+		out += "\"}}";
+	}
+	uint64_t flowId = 0;
+	for (size_t i = 0; i < all.size(); i++)
+	{
+		const Event &e = all[i].event;
+		out += ",\n{\"ph\":\"X\",\"cat\":\"request\",\"name\":\"";
+		AppendName(out, e.name);
+		snprintf(line, sizeof(line), "\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%llu}}",
+				 pid, all[i].tid, e.startNs / 1e3, (e.endNs - e.startNs) / 1e3, static_cast<unsigned long long>(e.id));
+		out += line;
+		/* 请求换了线程(比如循环线程交给工作线程)就画一条箭头，箭头的长度就是排队的时间 */
+		if (i > 0 && all[i - 1].event.id == e.id && all[i - 1].tid != all[i].tid)
+		{
+			const Exported &prev = all[i - 1];
+			flowId++;
+			snprintf(line, sizeof(line), ",\n{\"ph\":\"s\",\"cat\":\"request\",\"name\":\"handoff\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+					 static_cast<unsigned long long>(flowId), pid, prev.tid, prev.event.startNs / 1e3);
+			out += line;
+			snprintf(line, sizeof(line), ",\n{\"ph\":\"f\",\"bp\":\"e\",\"cat\":\"request\",\"name\":\"handoff\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+					 static_cast<unsigned long long>(flowId), pid, all[i].tid, e.startNs / 1e3);
+			out += line;
+		}
+	}
+	out += "\n]}\n";
+	return out;
+}
+
+void TraceSpan::Begin_()
+{
+	prevId_ = currentId;
+	currentId = id_;
+	startNs_ = Tracer::NowNs();
+}
+
+void TraceSpan::End_()
+{
+	Tracer::Instance()->Record(name_, id_, startNs_, Tracer::NowNs());
+	currentId = prevId_;
+}
@@ -2,13 +2,76 @@
 
 using namespace std;
 
+const int WebServer::ACCESS_SLOW_MS;
+const int WebServer::CAPTURE_MAX_MB;
+
+namespace
+{
+	Metrics *metrics = Metrics::Instance();
+	const int ACCEPTED = metrics->AddCounter("toy_accepted_connections_total", "Connections accepted");
+	const int ACCEPT_FULL = metrics->AddCounter("toy_accept_rejected_total", "Connections refused because the fd table was full");
+	const int REJECTED_OVERLOAD = metrics->AddCounter("toy_rejected_requests_total{reason=\"overload\"}", "Requests answered with an error before processing");
+	const int REJECTED_BUDGET = metrics->AddCounter("toy_rejected_requests_total{reason=\"memory_budget\"}", "");
+	const int REJECTED_TOO_LARGE = metrics->AddCounter("toy_rejected_requests_total{reason=\"too_large\"}", "");
+	const int PAUSED = metrics->AddGauge("toy_paused_connections", "Connections not read because the buffer memory budget is used up");
+	const int CONNECTIONS = metrics->AddCallback("toy_connections", "Open client connections", Metrics::GAUGE, []
+												 { return static_cast<double>(HttpConn::userCount.load()); });
+	const int BUFFER_BYTES = metrics->AddCallback("toy_buffer_memory_bytes", "Memory held by connection buffers", Metrics::GAUGE, []
+												  { return static_cast<double>(BlockPool::InUseBytes()); });
+	const int SHARED_BLOCKS = metrics->AddCallback("toy_buffer_shared_free_blocks", "Free blocks in the shared block pool", Metrics::GAUGE, []
+												   { return static_cast<double>(BlockPool::SharedBlocks()); });
+}
+
+// 过载时的响应，预先拼好，在循环线程里直接发送
+static const char BUSY_RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\n"
+									"Retry-After: 1\r\n"
+									"Content-Length: 0\r\n"
+									"Connection: close\r\n\r\n";
+
+// 请求超过了每个连接读缓冲区的上限
+static const char TOO_LARGE_RESPONSE[] = "HTTP/1.1 413 Payload Too Large\r\n"
+										 "Content-Length: 0\r\n"
+										 "Connection: close\r\n\r\n";
+
 WebServer::WebServer(
 	int port, int trigMode, int timeoutMS, bool OptLinger,
 	int sqlPort, const char *sqlUser, const char *sqlPwd,
 	const char *dbName, int connPoolNum, int threadNum,
-	bool openLog, int logLevel, int logQueSize) : port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-												  timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+	bool openLog, int logLevel, int logBufferKB,
+	ServerOptions options) : port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false), inlineStatic_(options.inlineStatic),
+							 memHighWater_(static_cast<size_t>(options.memBudgetMB) << 20), memLowWater_(memHighWater_ / 4 * 3), budgetRejected_(0)
 {
+	// 做验证的线程在UserVerify里一直拿着一个数据库连接，线程数超过连接池时GetConn拿不到连接；
+	// 有数据库通道时只有它做验证，没有时是静态通道
+	int &verifyThreads = options.dbThreadNum > 0 ? options.dbThreadNum : threadNum;
+	int &verifyMax = options.dbThreadNum > 0 ? options.dbThreadMax : options.threadMax;
+	bool verifyCapped = verifyThreads > connPoolNum || verifyMax > connPoolNum;
+	verifyThreads = min(verifyThreads, connPoolNum);
+	verifyMax = min(verifyMax, connPoolNum);
+
+	// 先把当前线程(之后运行事件循环)绑定好，再创建事件循环和线程池，内存按first-touch落在本地节点
+	CpuAffinity *affinity = CpuAffinity::Instance();
+	bool affinityOk = affinity->Init(options.cpuAffinity);
+	int loopCpu = affinity->NextCpu();
+	CpuAffinity::BindCurrentThread(loopCpu);
+	vector<int> workerCpus;
+	for (int i = 0; i < threadNum && affinity->IsEnabled(); i++)
+	{
+		workerCpus.push_back(affinity->NextCpu());
+	}
+	vector<int> dbCpus;
+	for (int i = 0; i < options.dbThreadNum && affinity->IsEnabled(); i++)
+	{
+		dbCpus.push_back(affinity->NextCpu());
+	}
+	int logCpu = affinity->NextCpu();
+	staticLane_.reset(new Lane("static", threadNum, options.taskQueSize, workerCpus, options.threadMax));
+	if (options.dbThreadNum > 0)
+	{
+		dbLane_.reset(new Lane("db", options.dbThreadNum, options.dbQueSize, dbCpus, options.dbThreadMax));
+	}
+	loop_.reset(new EventLoop());
+
 	// /home/nowcoder/WebServer-master/
 	srcDir_ = getcwd(nullptr, 256); // 获取当前的工作路径
 	assert(srcDir_);
@@ -18,12 +81,14 @@ WebServer::WebServer(
 	// 当前所有连接数
 	HttpConn::userCount = 0;
 	HttpConn::srcDir = srcDir_;
+	HttpConn::readLimit = static_cast<size_t>(options.connBufferKB) << 10;
 
 	// 初始化数据库连接池
 	SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
 
 	// 初始化事件的模式
 	InitEventMode_(trigMode);
+	loop_->SetEventCallBack(std::bind(&WebServer::HandleEvent_, this, std::placeholders::_1, std::placeholders::_2));
 
 	// 初始化网络通信相关的一些内容
 	if (!InitSocket_())
@@ -31,10 +96,25 @@ WebServer::WebServer(
 		isClose_ = true;
 	}
 
+	// 访问日志和运行日志分开，关掉运行日志也可以单独打开
+	bool accessLogOk = AccessLog::Instance()->Init(options.accessLog, "./log", options.accessSample, ACCESS_SLOW_MS);
+	HttpConn::metricsPath = options.metricsPath ? options.metricsPath : "";
+	bool captureOk = Capture::Instance()->Init(options.capturePath, CAPTURE_MAX_MB);
+	HttpConn::tracePath = options.tracePath ? options.tracePath : "";
+	Tracer::Instance()->Init(options.traceSample);
+	bool perfOk = PerfCounters::Instance()->Init(options.perfCounters);
+
+	// 开始接受请求之前把静态资源读进缓存和页缓存，重启后的第一批请求不用等磁盘和缺页
+	FileCache::WarmStats warm = {};
+	if (options.warmUp)
+	{
+		warm = FileCache::Instance()->Warm(srcDir_, options.hugePages);
+	}
+
 	if (openLog)
 	{
 		// 初始化日志信息
-		Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
+		Log::Instance()->init(logLevel, "./log", ".log", logBufferKB, logCpu);
 		if (isClose_)
 		{
 			LOG_ERROR("========== Server init error!==========");
@@ -48,8 +128,76 @@ WebServer::WebServer(
 					 (connEvent_ & EPOLLET ? "ET" : "LT"));
 			LOG_INFO("LogSys level: %d", logLevel);
 			LOG_INFO("srcDir: %s", HttpConn::srcDir);
-			LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+			LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d, queue capacity: %d", connPoolNum, threadNum, options.taskQueSize);
+			LOG_INFO("DB lane threads: %d, queue capacity: %d", options.dbThreadNum, options.dbQueSize);
+			if (verifyCapped)
+			{
+				LOG_WARN("%s lane threads capped to the %d SQL connections", dbLane_ ? "DB" : "Static", connPoolNum);
+			}
+			if (options.threadMax > threadNum || (dbLane_ && options.dbThreadMax > options.dbThreadNum))
+			{
+				LOG_INFO("Adaptive lane threads: static %d-%d, db %d-%d", threadNum, max(threadNum, options.threadMax), options.dbThreadNum, max(options.dbThreadNum, options.dbThreadMax));
+			}
+			LOG_INFO("Inline static responses: %s", inlineStatic_ ? "on" : "off");
+			LOG_INFO("Buffer memory budget: %dMB, per-connection read limit: %dKB", options.memBudgetMB, options.connBufferKB);
+			if (!accessLogOk)
+			{
+				LOG_WARN("Invalid access log format \"%s\", access log is off", options.accessLog);
+			}
+			else if (AccessLog::Instance()->IsEnabled())
+			{
+				LOG_INFO("Access log: %s, sample rate %g, errors and requests over %dms always logged", options.accessLog, options.accessSample, ACCESS_SLOW_MS);
+			}
+			LOG_INFO("Metrics path: %s", HttpConn::metricsPath.empty() ? "off" : HttpConn::metricsPath.c_str());
+			if (!captureOk)
+			{
+				LOG_WARN("Cannot open capture file \"%s\", capture is off", options.capturePath);
+			}
+			else if (Capture::Instance()->IsEnabled())
+			{
+				LOG_INFO("Capturing traffic to %s (up to %dMB)", options.capturePath, CAPTURE_MAX_MB);
+			}
+			if (!HttpConn::tracePath.empty())
+			{
+				LOG_INFO("Trace path: %s (loopback only, POST %s/on, %s/off), sample rate %g", HttpConn::tracePath.c_str(),
+						 HttpConn::tracePath.c_str(), HttpConn::tracePath.c_str(), options.traceSample);
+			}
+			if (options.warmUp)
+			{
+				LOG_INFO("Warm-up: %zu files %zuKB cached (%s), %zu files %zuKB prefaulted, %lldms",
+						 warm.files, warm.bytes >> 10, warm.memory, warm.mappedFiles, warm.mappedBytes >> 10, (long long)warm.ms);
+			}
+			if (!perfOk)
+			{
+				LOG_WARN("Hardware counters unavailable (%s), check kernel.perf_event_paranoid and whether the CPU exposes a PMU", PerfCounters::Instance()->Error().c_str());
+			}
+			else if (PerfCounters::Instance()->IsEnabled())
+			{
+				LOG_INFO("Hardware counters: on");
+			}
+			if (!affinityOk)
+			{
+				LOG_WARN("Invalid cpu affinity \"%s\", threads are not pinned", options.cpuAffinity);
+			}
+			else if (affinity->IsEnabled())
+			{
+				LOG_INFO("CPU affinity: %s, loop cpu %d (node %d), log cpu %d",
+						 affinity->Describe().c_str(), loopCpu, CpuAffinity::NodeOfCpu(loopCpu), logCpu);
+			}
 		}
+		// 定期把线程池的排队深度和拒绝数写进日志
+		loop_->RunEvery(STATS_INTERVAL_MS, [this]
+						{ LogStats_(); });
+	}
+	if (staticLane_->IsAdaptive() || (dbLane_ && dbLane_->IsAdaptive()))
+	{
+		loop_->RunEvery(ADAPT_INTERVAL_MS, [this]
+						{ AdaptLanes_(); });
+	}
+	if (memHighWater_ > 0)
+	{
+		loop_->RunEvery(BUDGET_CHECK_MS, [this]
+						{ ResumePaused_(); });
 	}
 }
 
@@ -91,64 +239,48 @@ void WebServer::InitEventMode_(int trigMode)
 // 启动服务器
 void WebServer::Start()
 {
-	int timeMS = -1; /* epoll wait timeout == -1 无事件将阻塞 */
 	if (!isClose_)
 	{
 		LOG_INFO("========== Server start ==========");
-	}
-	while (!isClose_)
-	{
-
 		// 如果设置了超时时间，例如60s,则只要一个连接60秒没有读写操作，则关闭
-		if (timeoutMS_ > 0)
-		{
-			// 通过定时器GetNextTick(),清除超时的节点，然后获取最先要超时的连接的超时的时间
-			timeMS = timer_->GetNextTick();
-		}
-
-		// timeMS是最先要超时的连接的超时的时间，传递到epoll_wait()函数中
-		// 当timeMS时间内有事件发生，epoll_wait()返回，否则等到了timeMS时间后才返回
-		// 这样做的目的是为了让epoll_wait()调用次数变少，提高效率
-		int eventCnt = epoller_->Wait(timeMS);
-
-		// 循环处理每一个事件
-		for (int i = 0; i < eventCnt; i++)
-		{
-			/* 处理事件 */
-			int fd = epoller_->GetEventFd(i);		  // 获取事件对应的fd
-			uint32_t events = epoller_->GetEvents(i); // 获取事件的类型
+		// 事件循环用时间轮上最先要超时的时间作为epoll_wait()的超时时间
+		Tracer::NameThread("loop");
+		loop_->Loop();
+	}
+}
 
-			// 监听的文件描述符有事件，说明有新的连接进来
-			if (fd == listenFd_)
-			{
-				DealListen_(); // 处理监听的操作，接受客户端连接(可能存在有多个客户端连接进来)
-			}				   // 这是在主线程中完成的
+// 处理一个就绪的事件(循环线程)
+void WebServer::HandleEvent_(int fd, uint32_t events)
+{
+	// 监听的文件描述符有事件，说明有新的连接进来
+	if (fd == listenFd_)
+	{
+		DealListen_(); // 处理监听的操作，接受客户端连接(可能存在有多个客户端连接进来)
+	}
 
-			// 错误的一些情况
-			else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
-			{
-				assert(users_.count(fd) > 0);
-				CloseConn_(&users_[fd]); // 关闭连接
-			}
+	// 错误的一些情况
+	else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+	{
+		assert(users_.count(fd) > 0);
+		CloseConn_(&users_[fd]); // 关闭连接
+	}
 
-			// 有数据到达(数据到达TCP的读缓冲区，需要我们去处理读操作)
-			else if (events & EPOLLIN)
-			{
-				assert(users_.count(fd) > 0);
-				DealRead_(&users_[fd]); // 处理读操作
-			}
+	// 有数据到达(数据到达TCP的读缓冲区，需要我们去处理读操作)
+	else if (events & EPOLLIN)
+	{
+		assert(users_.count(fd) > 0);
+		DealRead_(&users_[fd]); // 处理读操作
+	}
 
-			// 可发送数据(往TCP写缓冲区中写数据，需要我们去处理写操作)  注意: 只要TCP写缓冲区还有空余空间，其EPOLLOUT事件就会被触发
-			else if (events & EPOLLOUT)
-			{
-				assert(users_.count(fd) > 0);
-				DealWrite_(&users_[fd]); // 处理写操作
-			}
-			else
-			{
-				LOG_ERROR("Unexpected event");
-			}
-		}
+	// 可发送数据(往TCP写缓冲区中写数据，需要我们去处理写操作)  注意: 只要TCP写缓冲区还有空余空间，其EPOLLOUT事件就会被触发
+	else if (events & EPOLLOUT)
+	{
+		assert(users_.count(fd) > 0);
+		DealWrite_(&users_[fd]); // 处理写操作
+	}
+	else
+	{
+		LOG_ERROR("Unexpected event");
 	}
 }
 
@@ -164,15 +296,124 @@ void WebServer::SendError_(int fd, const char *info)
 	close(fd);
 }
 
-// 关闭连接（从epoll中删除，解除响应对象中的内存映射，用户数递减，关闭文件描述符）
+// 过载(队列满或者CoDel丢弃)，直接在循环线程里回复503并关闭连接
+void WebServer::RejectBusy_(HttpConn *client)
+{
+	metrics->Add(REJECTED_OVERLOAD);
+	Reject_(client, BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1);
+}
+
+// 在循环线程里回复预先拼好的错误响应并关闭连接
+void WebServer::Reject_(HttpConn *client, const char *response, size_t len)
+{
+	assert(client);
+	assert(loop_->IsInLoopThread());
+	int fd = client->GetFd();
+	/* 先把请求读掉，否则带着未读数据close会发RST，客户端可能收不到503 */
+	char discard[4096];
+	while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+	{
+	}
+	if (send(fd, response, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+	{
+		LOG_WARN("send error response to client[%d] error!", fd);
+	}
+	CloseConn_(client);
+}
+
+// 子线程里决定丢弃请求，交回循环线程回复503
+void WebServer::Shed_(HttpConn *client)
+{
+	loop_->QueueInLoop([this, client]
+					   {
+		client->SetBusy(false);
+		RejectBusy_(client); });
+}
+
+// 按排队时间和利用率调整各通道的线程数
+void WebServer::AdaptLanes_()
+{
+	Lane *lanes[] = {staticLane_.get(), dbLane_.get()};
+	for (Lane *lane : lanes)
+	{
+		if (!lane || !lane->IsAdaptive())
+		{
+			continue;
+		}
+		int delta = lane->Adapt();
+		if (delta != 0)
+		{
+			Lane::Stats stats = lane->GetStats();
+			LOG_INFO("Lane %s %s to %zu threads, busy %.0f%%, queued %zu", lane->Name(),
+					 delta > 0 ? "grows" : "shrinks", stats.threads, stats.busy * 100, stats.queued);
+		}
+	}
+}
+
+void WebServer::LogStats_()
+{
+	Lane *lanes[] = {staticLane_.get(), dbLane_.get()};
+	for (Lane *lane : lanes)
+	{
+		if (!lane)
+		{
+			continue;
+		}
+		Lane::Stats stats = lane->GetStats();
+		LOG_INFO("Lane %s threads: %zu, queued: %zu/%zu, rejected: %zu, shed: %zu%s, executed: %zu, wait avg %.1fus max %.1fus, exec avg %.1fus",
+				 lane->Name(), stats.threads, stats.queued, stats.capacity, stats.rejected, stats.shed, stats.overloaded ? " (overloaded)" : "",
+				 stats.executed, stats.avgWaitUs, stats.maxWaitUs, stats.avgExecUs);
+	}
+	if (memHighWater_ > 0)
+	{
+		LOG_INFO("Buffer memory in use: %zuKB / %zuKB, paused conns: %zu, rejected: %zu",
+				 BlockPool::InUseBytes() >> 10, memHighWater_ >> 10, paused_.size(), budgetRejected_);
+	}
+
+	/* 按连接状态统计缓冲区占用的内存：处理中(在子线程里)、等待发送、空闲 */
+	size_t count[3] = {0}, bytes[3] = {0};
+	for (auto &it : users_)
+	{
+		HttpConn &conn = it.second;
+		if (conn.IsClosed())
+		{
+			continue;
+		}
+		int state = conn.IsBusy() ? 0 : (conn.ToWriteBytes() > 0 ? 1 : 2);
+		count[state]++;
+		bytes[state] += conn.BufferBytes();
+	}
+	LOG_INFO("Buffers processing: %zu conns %zuKB, writing: %zu conns %zuKB, idle: %zu conns %zuKB, free blocks: %zu local %zu shared",
+			 count[0], bytes[0] >> 10, count[1], bytes[1] >> 10, count[2], bytes[2] >> 10,
+			 BlockPool::CachedBlocks(), BlockPool::SharedBlocks());
+}
+
+// 关闭连接（从epoll和时间轮中删除，解除响应对象中的内存映射，用户数递减，关闭文件描述符）
+// 只在循环线程中执行，子线程需要关闭连接时通过FinishTask_投递过来
 void WebServer::CloseConn_(HttpConn *client)
 {
 	assert(client);
+	assert(loop_->IsInLoopThread());
 	LOG_INFO("Client[%d] quit!", client->GetFd());
-	epoller_->DelFd(client->GetFd());
+	loop_->GetTimer()->cancel(client->GetFd());
+	loop_->GetEpoller()->DelFd(client->GetFd());
 	client->Close();
 }
 
+// 超时回调(循环线程)
+void WebServer::OnTimeout_(HttpConn *client)
+{
+	assert(client);
+	if (client->IsBusy())
+	{
+		/* 子线程还在处理这个连接，等它处理完再说 */
+		loop_->GetTimer()->add(client->GetFd(), timeoutMS_, [this, client]
+							   { OnTimeout_(client); });
+		return;
+	}
+	CloseConn_(client);
+}
+
 // 添加客户端
 void WebServer::AddClient_(int fd, sockaddr_in addr)
 {
@@ -181,10 +422,12 @@ void WebServer::AddClient_(int fd, sockaddr_in addr)
 	if (timeoutMS_ > 0)
 	{ // timeoutMS_ = 60000ms
 		// 添加到定时器对象中，当检测到超时时执行CloseConn_函数进行关闭连接
-		timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+		HttpConn *client = &users_[fd];
+		loop_->GetTimer()->add(fd, timeoutMS_, [this, client]
+							   { OnTimeout_(client); });
 	}
 	// 添加到epoll中进行管理
-	epoller_->AddFd(fd, EPOLLIN | connEvent_);
+	loop_->GetEpoller()->AddFd(fd, EPOLLIN | connEvent_);
 	// 设置文件描述符非阻塞
 	SetFdNonblock(fd);
 	LOG_INFO("Client[%d] in!", users_[fd].GetFd());
@@ -204,10 +447,12 @@ void WebServer::DealListen_()
 		}
 		else if (HttpConn::userCount >= MAX_FD)
 		{
-			SendError_(fd, "Server busy!");
+			metrics->Add(ACCEPT_FULL);
+			SendError_(fd, BUSY_RESPONSE);
 			LOG_WARN("Clients is full!");
 			return;
 		}
+		metrics->Add(ACCEPTED);
 		AddClient_(fd, addr); // 添加客户端
 	} while (listenEvent_ & EPOLLET);
 }
@@ -217,17 +462,62 @@ void WebServer::DealRead_(HttpConn *client)
 {
 	assert(client);
 	ExtentTime_(client); // 延长这个客户端的超时时间(延长了60s)
-	// 加入到队列中等待线程池中的线程处理（读取数据）
-	threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+	if (OverBudget_())
+	{
+		/* 缓冲区内存用完了，新请求不再读进来 */
+		budgetRejected_++;
+		metrics->Add(REJECTED_BUDGET);
+		Reject_(client, BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1);
+		return;
+	}
+	if (staticLane_->ShouldShed())
+	{
+		/* 过载，预计排队时间太长，新请求不再入队 */
+		RejectBusy_(client);
+		return;
+	}
+	client->MarkArrival();
+	TraceSpan span("DealRead_", client->TraceId());
+	if (inlineStatic_)
+	{
+		ReadInline_(client);
+		return;
+	}
+	client->SetBusy(true);
+	// 加入到队列中等待线程池中的线程处理（读取数据），过载时排队太久的请求会被丢弃
+	if (!staticLane_->Submit([this, client]
+							 { OnRead_(client); },
+							 [this, client]
+							 { Shed_(client); }))
+	{
+		/* 队列满了，新请求直接拒绝 */
+		client->SetBusy(false);
+		LOG_WARN("ThreadPool queue is full, reject client[%d]", client->GetFd());
+		RejectBusy_(client);
+	}
 }
 
 // 处理写
 void WebServer::DealWrite_(HttpConn *client)
 {
 	assert(client);
+	TraceSpan span("DealWrite_", client->TraceId());
 	ExtentTime_(client); // 延长这个客户端的超时时间(延长了60s)
+	if (inlineStatic_ && client->IsResponseCached())
+	{
+		/* 内容在内存里，写不会阻塞在磁盘上，直接在循环线程里写 */
+		WriteInline_(client);
+		return;
+	}
+	client->SetBusy(true);
 	// 加入到队列中等待线程池中的线程处理（写数据）
-	threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+	if (!staticLane_->Submit([this, client]
+							 { OnWrite_(client); }))
+	{
+		/* 响应已经在发送了，不能拒绝，过一会儿再提交；期间保持busy，超时不会关闭它 */
+		loop_->RunAfter(BUSY_RETRY_MS, [this, client]
+						{ DealWrite_(client); });
+	}
 }
 
 // 延长客户端的超时时间
@@ -236,7 +526,7 @@ void WebServer::ExtentTime_(HttpConn *client)
 	assert(client);
 	if (timeoutMS_ > 0)
 	{
-		timer_->adjust(client->GetFd(), timeoutMS_);
+		loop_->GetTimer()->adjust(client->GetFd(), timeoutMS_);
 	}
 }
 
@@ -244,12 +534,13 @@ void WebServer::ExtentTime_(HttpConn *client)
 void WebServer::OnRead_(HttpConn *client)
 {
 	assert(client);
+	TraceSpan span("OnRead_", client->TraceId());
 	int ret = -1;
 	int readErrno = 0;
 	ret = client->read(&readErrno); // 读取客户端的数据
 	if (ret <= 0 && readErrno != EAGAIN)
 	{
-		CloseConn_(client);
+		FinishTask_(client, 0);
 		return;
 	}
 
@@ -260,14 +551,109 @@ void WebServer::OnRead_(HttpConn *client)
 // 业务逻辑的处理
 void WebServer::OnProcess(HttpConn *client)
 {
-	if (client->process())
+	if (!client->parse())
 	{
-		epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+		FinishTask_(client, EPOLLIN);
+		return;
 	}
-	else
+	if (client->NeedsDb() && dbLane_)
+	{
+		/* 访问数据库的请求交给数据库通道，数据库变慢不会占住静态文件通道的线程 */
+		if (dbLane_->ShouldShed())
+		{
+			Shed_(client);
+		}
+		else if (!dbLane_->Submit([this, client]
+								  { OnDbProcess_(client); },
+								  [this, client]
+								  { Shed_(client); }))
+		{
+			LOG_WARN("DB lane queue is full, reject client[%d]", client->GetFd());
+			Shed_(client);
+		}
+		return;
+	}
+	client->verify();
+	client->respond();
+	FinishTask_(client, EPOLLOUT);
+}
+
+void WebServer::OnDbProcess_(HttpConn *client)
+{
+	TraceSpan span("OnDbProcess_", client->TraceId());
+	client->verify();
+	client->respond();
+	FinishTask_(client, EPOLLOUT);
+}
+
+// 子线程处理完后，由循环线程重新注册事件或关闭连接，events为0表示关闭
+void WebServer::FinishTask_(HttpConn *client, uint32_t events)
+{
+	loop_->QueueInLoop([this, client, events]
+					   {
+		client->SetBusy(false);
+		if (events == 0)
+		{
+			CloseConn_(client);
+		}
+		else
+		{
+			if (events & EPOLLIN)
+			{
+				WaitRead_(client);
+			}
+			else
+			{
+				loop_->GetEpoller()->ModFd(client->GetFd(), connEvent_ | events);
+			}
+		} });
+}
+
+bool WebServer::OverBudget_() const
+{
+	return memHighWater_ > 0 && BlockPool::InUseBytes() >= memHighWater_;
+}
+
+// 请求还不完整，需要继续读：读缓冲区满了说明请求太大；内存预算用完就先不读，等降下来再说
+void WebServer::WaitRead_(HttpConn *client)
+{
+	assert(loop_->IsInLoopThread());
+	client->ReleaseIdle(); // 等下一个请求期间不占缓冲区
+	if (client->IsReadFull())
 	{
-		epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+		LOG_WARN("Client[%d] request exceeds %zu bytes, reject", client->GetFd(), HttpConn::readLimit);
+		metrics->Add(REJECTED_TOO_LARGE);
+		Reject_(client, TOO_LARGE_RESPONSE, sizeof(TOO_LARGE_RESPONSE) - 1);
+		return;
+	}
+	if (OverBudget_())
+	{
+		/* 不注册EPOLLIN，数据留在内核的接收缓冲区里 */
+		client->SetPaused(true);
+		paused_.push_back(client);
+		metrics->Set(PAUSED, static_cast<double>(paused_.size()));
+		return;
+	}
+	loop_->GetEpoller()->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+}
+
+void WebServer::ResumePaused_()
+{
+	if (paused_.empty() || BlockPool::InUseBytes() >= memLowWater_)
+	{
+		return;
+	}
+	for (HttpConn *client : paused_)
+	{
+		/* 暂停期间超时关闭(甚至文件描述符被新连接复用)的，标记已经被清掉了 */
+		if (client->IsPaused())
+		{
+			client->SetPaused(false);
+			loop_->GetEpoller()->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+		}
 	}
+	paused_.clear();
+	metrics->Set(PAUSED, 0);
 }
 
 // 写数据
@@ -293,10 +679,93 @@ void WebServer::OnWrite_(HttpConn *client)
 		if (writeErrno == EAGAIN)
 		{
 			/* 继续传输 */
-			epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+			FinishTask_(client, EPOLLOUT);
+			return;
+		}
+	}
+	FinishTask_(client, 0);
+}
+
+// 循环线程里直接读和解析，省掉一次线程切换
+void WebServer::ReadInline_(HttpConn *client)
+{
+	TraceSpan span("ReadInline_", client->TraceId());
+	int readErrno = 0;
+	ssize_t ret = client->read(&readErrno);
+	if (ret <= 0 && readErrno != EAGAIN)
+	{
+		CloseConn_(client);
+		return;
+	}
+	ProcessInline_(client);
+}
+
+// 命中缓存的请求直接生成响应并尝试发送，其他请求(查数据库、读磁盘)交给子线程
+void WebServer::ProcessInline_(HttpConn *client)
+{
+	if (!client->parse())
+	{
+		WaitRead_(client);
+		return;
+	}
+	if (!client->IsCheap())
+	{
+		bool db = client->NeedsDb() && dbLane_;
+		Lane *lane = db ? dbLane_.get() : staticLane_.get();
+		if (lane->ShouldShed())
+		{
+			RejectBusy_(client);
+			return;
+		}
+		client->SetBusy(true);
+		bool ok;
+		if (db)
+		{
+			/* 数据库通道只查库和生成响应，发送交回循环线程(DealWrite_)，不占数据库通道的线程 */
+			ok = lane->Submit([this, client]
+							  { OnDbProcess_(client); },
+							  [this, client]
+							  { Shed_(client); });
+		}
+		else
+		{
+			ok = lane->Submit([this, client]
+							  {
+				client->verify();
+				client->respond();
+				OnWrite_(client); },
+							  [this, client]
+							  { Shed_(client); });
+		}
+		if (!ok)
+		{
+			client->SetBusy(false);
+			RejectBusy_(client);
+		}
+		return;
+	}
+	client->respond();
+	WriteInline_(client);
+}
+
+// 在循环线程里写，写不完(发送缓冲区满了)才注册EPOLLOUT
+void WebServer::WriteInline_(HttpConn *client)
+{
+	int writeErrno = 0;
+	ssize_t ret = client->write(&writeErrno);
+	if (client->ToWriteBytes() == 0)
+	{
+		if (client->IsKeepAlive())
+		{
+			ProcessInline_(client); // 处理已经读到的下一个请求，没有就等EPOLLIN
 			return;
 		}
 	}
+	else if (ret < 0 && writeErrno == EAGAIN)
+	{
+		loop_->GetEpoller()->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+		return;
+	}
 	CloseConn_(client);
 }
 
@@ -365,7 +834,7 @@ bool WebServer::InitSocket_()
 		return false;
 	}
 
-	ret = epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN);
+	ret = loop_->GetEpoller()->AddFd(listenFd_, listenEvent_ | EPOLLIN);
 	if (ret == 0)
 	{
 		LOG_ERROR("Add listen error!");